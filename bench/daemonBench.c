@@ -0,0 +1,278 @@
+/*
+ * Load generator for the encryptUtil daemon (encryptUtil --serve).
+ * Starts a daemon with a random key (or uses a running one with --socket), then runs concurrent clients, each
+ * sending requests of the given size one after the other on its own connection (its own stream).
+ * Reports requests/sec and the per-request latency percentiles (send to reply received) as one JSON line.
+ *
+ * Build: make daemonBench (or gcc -O2 bench/daemonBench.c src/daemonProtocol.c -o daemonBench -lpthread)
+ * Run:   ./daemonBench [--binary path] [--socket path] [--key-size size] [--threads n] [--clients n]
+ *                      [--requests n] [--size size] [--dir path]
+ */
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+
+#include "../include/daemonProtocol.h"
+
+#define BENCH_PATH_SIZE 512
+#define BENCH_CONNECT_TRIES 500
+
+typedef struct benchOptions{
+    const char* binary;
+    const char* socketPath;
+    const char* dir;
+    long keySize;
+    int threads;
+    int clients;
+    long requests;
+    long size;
+} benchOptions;
+
+typedef struct clientData{
+    const benchOptions* options;
+    const char* socketPath;
+    uint64_t* latencies;
+    int failed;
+} clientData;
+
+
+static uint64_t nowNanos(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/*
+ * Bytes, optionally followed by a K or M (binary) suffix.
+ */
+static long parseBenchSize(const char* text){
+    char* end;
+    long size = strtol(text, &end, 10);
+    if(end == text || size < 0){
+        return -1;
+    }
+    if(*end == 'k' || *end == 'K'){
+        size *= 1024L;
+        end++;
+    }
+    else if(*end == 'm' || *end == 'M'){
+        size *= 1024L * 1024;
+        end++;
+    }
+    return *end == '\0' ? size : -1;
+}
+
+
+static int compareLatencies(const void* a, const void* b){
+    uint64_t first = *(const uint64_t*)a;
+    uint64_t second = *(const uint64_t*)b;
+    return first < second ? -1 : first > second;
+}
+
+
+static void* clientFunction(void* arg){
+    clientData* client = (clientData*)arg;
+    const benchOptions* options = client->options;
+    client->failed = 1;
+
+    int fd = daemonConnect(client->socketPath);
+    if(fd < 0){
+        return NULL;
+    }
+    uint8_t* request = (uint8_t*)malloc(options->size > 0 ? options->size : 1);
+    uint8_t* reply = (uint8_t*)malloc(DAEMON_MAX_FRAME + options->keySize);
+    if(request == NULL || reply == NULL){
+        fprintf(stderr, "Error: Failed to allocate the client buffers.\n");
+        close(fd);
+        return NULL;
+    }
+    for(long i = 0; i < options->size; i++){
+        request[i] = (uint8_t)(i * 131 + 7);
+    }
+
+    long i = 0;
+    for(; i < options->requests; i++){
+        uint64_t start = nowNanos();
+        daemonHeader header;
+        if(!daemonSendFrame(fd, DAEMON_FRAME_DATA, request, options->size) || daemonReadFull(fd, &header, sizeof(header)) != 1
+           || header.length > DAEMON_MAX_FRAME + options->keySize || daemonReadFull(fd, reply, header.length) < 0 || header.type != DAEMON_STATUS_OK){
+            fprintf(stderr, "Error: Request %ld failed.\n", i);
+            break;
+        }
+        client->latencies[i] = nowNanos() - start;
+    }
+
+    close(fd);
+    free(request);
+    free(reply);
+    client->failed = i < options->requests;
+    return NULL;
+}
+
+
+/*
+ * Writes a random key and starts the daemon on a socket in the scratch directory.
+ */
+static pid_t startDaemon(const benchOptions* options, char* keyPath, char* socketPath){
+    snprintf(keyPath, BENCH_PATH_SIZE, "%s/daemonBenchKey.%d", options->dir, (int)getpid());
+    snprintf(socketPath, BENCH_PATH_SIZE, "%s/daemonBench.%d.sock", options->dir, (int)getpid());
+
+    FILE* keyFile = fopen(keyPath, "wb");
+    if(keyFile == NULL){
+        fprintf(stderr, "Error: Can't create %s.\n", keyPath);
+        return -1;
+    }
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for(long i = 0; i < options->keySize; i++){
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        fputc((int)(state & 0xFF), keyFile);
+    }
+    fclose(keyFile);
+
+    char threads[16];
+    snprintf(threads, sizeof(threads), "%d", options->threads);
+    pid_t pid = fork();
+    if(pid == 0){
+        execl(options->binary, options->binary, "-n", threads, "-k", keyPath, "--serve", socketPath, (char*)NULL);
+        perror("Error: exec");
+        _exit(127);
+    }
+    if(pid < 0){
+        perror("Error: fork");
+        return -1;
+    }
+
+    // Wait for it to accept connections
+    for(int i = 0; i < BENCH_CONNECT_TRIES; i++){
+        struct stat info;
+        if(stat(socketPath, &info) == 0){
+            return pid;
+        }
+        struct timespec pause = {0, 10 * 1000000};
+        nanosleep(&pause, NULL);
+    }
+    fprintf(stderr, "Error: The daemon didn't start.\n");
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+
+static int processBenchInput(int argc, char* argv[], benchOptions* options){
+    options->binary = "./encryptUtil";
+    options->socketPath = NULL;
+    options->dir = "/tmp";
+    options->keySize = 16;
+    options->threads = 4;
+    options->clients = 8;
+    options->requests = 2000;
+    options->size = 4096;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--binary") == 0 && i < argc - 1){
+            options->binary = argv[++i];
+        }
+        else if(strcmp(argv[i], "--socket") == 0 && i < argc - 1){
+            options->socketPath = argv[++i];
+        }
+        else if(strcmp(argv[i], "--dir") == 0 && i < argc - 1){
+            options->dir = argv[++i];
+        }
+        else if(strcmp(argv[i], "--key-size") == 0 && i < argc - 1){
+            options->keySize = parseBenchSize(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--threads") == 0 && i < argc - 1){
+            options->threads = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--clients") == 0 && i < argc - 1){
+            options->clients = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--requests") == 0 && i < argc - 1){
+            options->requests = atol(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--size") == 0 && i < argc - 1){
+            options->size = parseBenchSize(argv[++i]);
+        }
+        else {
+            fprintf(stderr, "Error: Unknown argument %s.\n", argv[i]);
+            return 0;
+        }
+    }
+
+    if(options->keySize <= 0 || options->threads < 1 || options->clients < 1 || options->requests < 1 || options->size < 0 || options->size > DAEMON_MAX_FRAME){
+        fprintf(stderr, "Error: Invalid benchmark options.\n");
+        return 0;
+    }
+    return 1;
+}
+
+
+int main(int argc, char* argv[]){
+    benchOptions options;
+    if(!processBenchInput(argc, argv, &options)){
+        return 1;
+    }
+
+    char keyPath[BENCH_PATH_SIZE] = "";
+    char socketPath[BENCH_PATH_SIZE];
+    pid_t daemonPid = -1;
+    if(options.socketPath == NULL){
+        daemonPid = startDaemon(&options, keyPath, socketPath);
+        if(daemonPid < 0){
+            unlink(keyPath);
+            return 1;
+        }
+        options.socketPath = socketPath;
+    }
+
+    uint64_t* latencies = (uint64_t*)malloc(options.clients * options.requests * sizeof(uint64_t));
+    clientData clients[options.clients];
+    pthread_t threads[options.clients];
+    if(latencies == NULL){
+        fprintf(stderr, "Error: Failed to allocate the latencies.\n");
+        return 1;
+    }
+
+    uint64_t start = nowNanos();
+    int created = 0;
+    for(; created < options.clients; created++){
+        clients[created].options = &options;
+        clients[created].socketPath = options.socketPath;
+        clients[created].latencies = latencies + created * options.requests;
+        if(pthread_create(&threads[created], NULL, &clientFunction, &clients[created]) != 0){
+            fprintf(stderr, "Error: Failed to create the client thread(s)\n");
+            break;
+        }
+    }
+    int failed = created < options.clients;
+    for(int i = 0; i < created; i++){
+        pthread_join(threads[i], NULL);
+        failed |= clients[i].failed;
+    }
+    double seconds = (nowNanos() - start) / 1e9;
+
+    if(daemonPid > 0){
+        kill(daemonPid, SIGTERM);
+        waitpid(daemonPid, NULL, 0);
+        unlink(keyPath);
+    }
+    if(failed){
+        free(latencies);
+        return 1;
+    }
+
+    long total = options.clients * options.requests;
+    qsort(latencies, total, sizeof(uint64_t), compareLatencies);
+    printf("{\"clients\":%d,\"threads\":%d,\"keySize\":%ld,\"requestSize\":%ld,\"requests\":%ld,\"seconds\":%.3f,\"requestsPerSecond\":%.0f,"
+           "\"p50Us\":%.1f,\"p90Us\":%.1f,\"p99Us\":%.1f,\"maxUs\":%.1f}\n",
+           options.clients, options.threads, options.keySize, options.size, total, seconds, total / seconds,
+           latencies[total / 2] / 1e3, latencies[total * 9 / 10] / 1e3, latencies[total * 99 / 100] / 1e3, latencies[total - 1] / 1e3);
+
+    free(latencies);
+    return 0;
+}
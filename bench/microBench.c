@@ -0,0 +1,928 @@
+/*
+ * Microbenchmarks of the building blocks of the pipeline, each operation measured on its own.
+ * Queues: enqueue, enqueueNode, dequeue, isEmpty and getSize of the mutex Queue (queue.h) side by side with the
+ * lock-free LfQueue (lfQueue.h) and the per-worker WorkQueues (workQueues.h), alone and under N-thread contention,
+ * and the reorder buffer with blocks arriving in order, shuffled, or interleaved by N threads.
+ * Kernels: leftShiftKey, rotateKey, rotateKeyCopy and encryptBlock, every XOR kernel and every fused rotate-and-XOR
+ * kernel (xorKernel.h), and a chunk through the key cursor built each way (rotated copy, fused, table), per key size.
+ *
+ * Each case runs warmup rounds, then timed rounds of ops operations (all the threads together), and reports the
+ * per-operation time percentiles over the rounds. When the kernel allows perf_event_open() (perf_event_paranoid),
+ * single-threaded cases also report cycles, instructions and dTLB misses per operation; they're null otherwise.
+ * One JSON object per case on stdout, a one-line summary per case on stderr.
+ *
+ * Build: make microBench (or gcc -O2 bench/microBench.c src/queue.c src/lfQueue.c src/workQueues.c src/pipelineStats.c
+ *                         src/xorStream.c src/xorKernel.c src/keyCache.c -o microBench -lpthread)
+ * Run:   ./microBench [--filter text] [--rounds n] [--warmup n] [--threads list] [--keys list] [--quick] > micro.json
+ * Lists are comma separated sizes with optional K, M, G suffixes (e.g. --keys 16,4K,1M). --filter keeps the cases
+ * whose "group/name/variant" contains the text (e.g. --filter queue/dequeue, --filter /avx2).
+ */
+#include <time.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
+#include <linux/perf_event.h>
+
+#include "../include/queue.h"
+#include "../include/lfQueue.h"
+#include "../include/workQueues.h"
+#include "../include/xorStream.h"
+
+#define BENCH_MAX_VALUES 16
+#define BENCH_QUEUE_OPS 4096
+#define BENCH_REORDER_WINDOW 256
+#define BENCH_KERNEL_BYTES (4L * 1024 * 1024)
+#define BENCH_CHUNK_SIZE (256L * 1024)
+#define BENCH_TABLE_BUDGET (64L * 1024 * 1024)
+#define BENCH_PERF_EVENTS 3
+
+typedef struct benchOptions{
+    const char* filter;
+    int rounds;
+    int warmup;
+    long threads[BENCH_MAX_VALUES];
+    int threadCount;
+    long keys[BENCH_MAX_VALUES];
+    int keyCount;
+} benchOptions;
+
+/*
+ * One case: work() is run by every thread of the round (id 0 is the main thread), reset() before each round (untimed).
+ * ops is the number of operations of a round, all the threads together, bytes the bytes one operation processes.
+ */
+typedef struct benchCase{
+    const char* group;
+    const char* name;
+    const char* variant;
+    long size;
+    int threads;
+    long ops;
+    long bytes;
+    void* state;
+    void (*work)(struct benchCase* bench, int id);
+    void (*reset)(struct benchCase* bench);
+} benchCase;
+
+/*
+ * The threads of a case: they run work() between the two barriers of every round, until stop is set.
+ */
+typedef struct benchTeam{
+    benchCase* bench;
+    pthread_barrier_t start;
+    pthread_barrier_t end;
+    int stop;
+} benchTeam;
+
+typedef struct teamArg{
+    benchTeam* team;
+    int id;
+} teamArg;
+
+typedef struct perfCounters{
+    int fds[BENCH_PERF_EVENTS];
+    int available;
+} perfCounters;
+
+typedef struct queueState{
+    Queue* queue;
+    LfQueue* lfQueue;
+    WorkQueues* work;
+    ReorderBuffer* reorder;
+    Node* nodes;
+    long* order;
+    atomic_long taken;
+    uint8_t data;
+} queueState;
+
+typedef struct kernelState{
+    uint8_t* key;
+    uint8_t* scratch;
+    uint8_t* data;
+    const xorKernel* kernel;
+    KeyCursor cursor;
+    KeyCache* cache;
+} kernelState;
+
+// Results nobody reads, so the compiler can't drop the calls
+static volatile long sink;
+
+
+static uint64_t nowNanos(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/*
+ * Same syntax as encryptUtil's --chunk: bytes, optionally followed by a K, M or G (binary) suffix.
+ */
+static long parseBenchSize(const char* text, char** end){
+    long size = strtol(text, end, 10);
+    if(*end == text || size < 0){
+        return -1;
+    }
+    switch(**end){
+        case 'k': case 'K':
+            size *= 1024L;
+            (*end)++;
+            break;
+        case 'm': case 'M':
+            size *= 1024L * 1024;
+            (*end)++;
+            break;
+        case 'g': case 'G':
+            size *= 1024L * 1024 * 1024;
+            (*end)++;
+            break;
+    }
+    return size;
+}
+
+
+/*
+ * Parses a comma separated list of sizes, returns the number of values or -1 if the list is invalid.
+ */
+static int parseList(const char* text, long* values){
+    int count = 0;
+    char* end;
+
+    while(count < BENCH_MAX_VALUES){
+        long value = parseBenchSize(text, &end);
+        if(value <= 0){
+            return -1;
+        }
+        values[count++] = value;
+        if(*end == '\0'){
+            return count;
+        }
+        if(*end != ','){
+            return -1;
+        }
+        text = end + 1;
+    }
+    return -1;
+}
+
+
+static void fillRandom(uint8_t* buffer, long size, uint64_t seed){
+    uint64_t state = seed | 1;
+    for(long i = 0; i < size; i++){
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        buffer[i] = (uint8_t)state;
+    }
+}
+
+
+static int compareDoubles(const void* a, const void* b){
+    double first = *(const double*)a;
+    double second = *(const double*)b;
+    return first < second ? -1 : first > second;
+}
+
+
+/*
+ * Opens cycles, instructions and dTLB read misses of the calling thread as one group, disabled.
+ */
+static void perfOpen(perfCounters* counters){
+    uint64_t configs[BENCH_PERF_EVENTS][2] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    };
+
+    counters->available = 1;
+    for(int i = 0; i < BENCH_PERF_EVENTS; i++){
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = (uint32_t)configs[i][0];
+        attr.config = configs[i][1];
+        attr.disabled = i == 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        counters->fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : counters->fds[0], 0);
+        if(counters->fds[i] < 0){
+            counters->available = 0;
+        }
+    }
+}
+
+
+static void perfControl(perfCounters* counters, unsigned long request){
+    if(counters->available){
+        ioctl(counters->fds[0], request, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+
+static int perfRead(perfCounters* counters, uint64_t* values){
+    uint64_t group[1 + BENCH_PERF_EVENTS];
+    if(!counters->available || read(counters->fds[0], group, sizeof(group)) != (ssize_t)sizeof(group)){
+        return 0;
+    }
+    memcpy(values, group + 1, BENCH_PERF_EVENTS * sizeof(uint64_t));
+    return 1;
+}
+
+
+static void perfClose(perfCounters* counters){
+    for(int i = 0; i < BENCH_PERF_EVENTS; i++){
+        if(counters->fds[i] >= 0){
+            close(counters->fds[i]);
+        }
+    }
+}
+
+
+static void* teamFunction(void* arg){
+    teamArg* member = (teamArg*)arg;
+    benchTeam* team = member->team;
+
+    while(1){
+        pthread_barrier_wait(&team->start);
+        if(team->stop){
+            break;
+        }
+        team->bench->work(team->bench, member->id);
+        pthread_barrier_wait(&team->end);
+    }
+    return NULL;
+}
+
+
+static int selected(const benchOptions* options, const benchCase* bench){
+    if(options->filter == NULL){
+        return 1;
+    }
+    char label[256];
+    snprintf(label, sizeof(label), "%s/%s/%s", bench->group, bench->name, bench->variant);
+    return strstr(label, options->filter) != NULL;
+}
+
+
+/*
+ * Runs the warmup and timed rounds of a case on a team of bench->threads threads, and prints its results.
+ */
+static void runCase(const benchOptions* options, benchCase* bench){
+    if(!selected(options, bench)){
+        return;
+    }
+
+    int helpers = bench->threads - 1;
+    benchTeam team;
+    team.bench = bench;
+    team.stop = 0;
+    pthread_barrier_init(&team.start, NULL, bench->threads);
+    pthread_barrier_init(&team.end, NULL, bench->threads);
+    pthread_t threads[helpers > 0 ? helpers : 1];
+    teamArg args[helpers > 0 ? helpers : 1];
+    for(int i = 0; i < helpers; i++){
+        args[i].team = &team;
+        args[i].id = i + 1;
+        if(pthread_create(&threads[i], NULL, &teamFunction, &args[i]) != 0){
+            fprintf(stderr, "Error: Failed to create the benchmark threads.\n");
+            exit(1);
+        }
+    }
+
+    // Counters only follow the calling thread, so only single-threaded cases get them
+    perfCounters counters;
+    counters.available = 0;
+    for(int i = 0; i < BENCH_PERF_EVENTS; i++){
+        counters.fds[i] = -1;
+    }
+    if(bench->threads == 1){
+        perfOpen(&counters);
+        perfControl(&counters, PERF_EVENT_IOC_RESET);
+    }
+
+    double samples[options->rounds];
+    for(int round = -options->warmup; round < options->rounds; round++){
+        if(bench->reset != NULL){
+            bench->reset(bench);
+        }
+        if(round >= 0){
+            perfControl(&counters, PERF_EVENT_IOC_ENABLE);
+        }
+        uint64_t start = nowNanos();
+        if(helpers > 0){
+            pthread_barrier_wait(&team.start);
+        }
+        bench->work(bench, 0);
+        if(helpers > 0){
+            pthread_barrier_wait(&team.end);
+        }
+        uint64_t elapsed = nowNanos() - start;
+        if(round >= 0){
+            perfControl(&counters, PERF_EVENT_IOC_DISABLE);
+            samples[round] = (double)elapsed / bench->ops;
+        }
+    }
+
+    team.stop = 1;
+    if(helpers > 0){
+        pthread_barrier_wait(&team.start);
+    }
+    for(int i = 0; i < helpers; i++){
+        pthread_join(threads[i], NULL);
+    }
+    pthread_barrier_destroy(&team.start);
+    pthread_barrier_destroy(&team.end);
+
+    uint64_t events[BENCH_PERF_EVENTS] = {0};
+    int counted = perfRead(&counters, events);
+    perfClose(&counters);
+
+    int rounds = options->rounds;
+    qsort(samples, rounds, sizeof(double), compareDoubles);
+    double p50 = samples[rounds / 2];
+    double totalOps = (double)bench->ops * rounds;
+
+    printf("{\"group\":\"%s\",\"name\":\"%s\",\"variant\":\"%s\",\"size\":%ld,\"threads\":%d,\"ops\":%ld,\"rounds\":%d,"
+           "\"nsPerOp\":{\"min\":%.2f,\"p50\":%.2f,\"p90\":%.2f,\"p99\":%.2f,\"max\":%.2f}",
+           bench->group, bench->name, bench->variant, bench->size, bench->threads, bench->ops, rounds,
+           samples[0], p50, samples[rounds * 9 / 10], samples[rounds * 99 / 100], samples[rounds - 1]);
+    if(bench->bytes > 0){
+        printf(",\"gbps\":%.2f", bench->bytes / p50);
+    }
+    if(counted){
+        printf(",\"cyclesPerOp\":%.1f,\"instructionsPerOp\":%.1f,\"dtlbMissesPerOp\":%.3f}\n",
+               events[0] / totalOps, events[1] / totalOps, events[2] / totalOps);
+    }
+    else {
+        printf(",\"cyclesPerOp\":null,\"instructionsPerOp\":null,\"dtlbMissesPerOp\":null}\n");
+    }
+    fflush(stdout);
+
+    fprintf(stderr, "%-6s %-26s %-12s size %-9ld threads %-3d p50 %10.1f ns/op", bench->group, bench->name, bench->variant, bench->size, bench->threads, p50);
+    if(bench->bytes > 0){
+        fprintf(stderr, " %8.2f GB/s", bench->bytes / p50);
+    }
+    fprintf(stderr, "\n");
+}
+
+
+/*
+ * Queues - the same operation on the mutex queue ("mutex"), the lock-free ring ("lockfree") and the per-worker
+ * rings with stealing ("work"). Nodes are preallocated, except for enqueue()/lfEnqueue() which allocate their own.
+ */
+static void drainQueues(queueState* state){
+    Node* node;
+    while((node = dequeue(state->queue)) != NULL || (node = lfDequeue(state->lfQueue)) != NULL){
+        // Nodes created by enqueue()/lfEnqueue() are freed, preallocated ones are not
+        if(node->data == &state->data){
+            free(node);
+        }
+    }
+    int stolen;
+    while(workPop(state->work, 0, &stolen) != NULL){
+    }
+}
+
+
+static void resetEmpty(benchCase* bench){
+    drainQueues((queueState*)bench->state);
+}
+
+
+static void resetFull(benchCase* bench){
+    queueState* state = (queueState*)bench->state;
+    drainQueues(state);
+    for(long i = 0; i < bench->ops; i++){
+        if(strcmp(bench->variant, "mutex") == 0){
+            enqueueNode(state->queue, &state->nodes[i]);
+        }
+        else if(strcmp(bench->variant, "lockfree") == 0){
+            lfEnqueueNode(state->lfQueue, &state->nodes[i]);
+        }
+        else {
+            workPush(state->work, &state->nodes[i], -1);
+        }
+    }
+}
+
+
+/*
+ * A few nodes in, so isEmpty/getSize don't take an empty fast path.
+ */
+static void resetFew(benchCase* bench){
+    queueState* state = (queueState*)bench->state;
+    drainQueues(state);
+    for(long i = 0; i < 16; i++){
+        enqueueNode(state->queue, &state->nodes[i]);
+        lfEnqueueNode(state->lfQueue, &state->nodes[16 + i]);
+        workPush(state->work, &state->nodes[32 + i], -1);
+    }
+}
+
+
+static void benchEnqueue(benchCase* bench, int id){
+    (void)id;
+    queueState* state = (queueState*)bench->state;
+    if(strcmp(bench->variant, "mutex") == 0){
+        for(long i = 0; i < bench->ops; i++){
+            enqueue(state->queue, &state->data, 1, i);
+        }
+    }
+    else {
+        for(long i = 0; i < bench->ops; i++){
+            lfEnqueue(state->lfQueue, &state->data, 1, i);
+        }
+    }
+}
+
+
+static void benchEnqueueNode(benchCase* bench, int id){
+    (void)id;
+    queueState* state = (queueState*)bench->state;
+    if(strcmp(bench->variant, "mutex") == 0){
+        for(long i = 0; i < bench->ops; i++){
+            enqueueNode(state->queue, &state->nodes[i]);
+        }
+    }
+    else if(strcmp(bench->variant, "lockfree") == 0){
+        for(long i = 0; i < bench->ops; i++){
+            lfEnqueueNode(state->lfQueue, &state->nodes[i]);
+        }
+    }
+    else {
+        for(long i = 0; i < bench->ops; i++){
+            workPush(state->work, &state->nodes[i], -1);
+        }
+    }
+}
+
+
+static void benchDequeue(benchCase* bench, int id){
+    (void)id;
+    queueState* state = (queueState*)bench->state;
+    long found = 0;
+    int stolen;
+    if(strcmp(bench->variant, "mutex") == 0){
+        for(long i = 0; i < bench->ops; i++){
+            found += dequeue(state->queue) != NULL;
+        }
+    }
+    else if(strcmp(bench->variant, "lockfree") == 0){
+        for(long i = 0; i < bench->ops; i++){
+            found += lfDequeue(state->lfQueue) != NULL;
+        }
+    }
+    else {
+        for(long i = 0; i < bench->ops; i++){
+            found += workPop(state->work, 0, &stolen) != NULL;
+        }
+    }
+    sink = found;
+}
+
+
+static void benchIsEmpty(benchCase* bench, int id){
+    (void)id;
+    queueState* state = (queueState*)bench->state;
+    long empty = 0;
+    if(strcmp(bench->variant, "mutex") == 0){
+        for(long i = 0; i < bench->ops; i++){
+            empty += isEmpty(state->queue);
+        }
+    }
+    else if(strcmp(bench->variant, "lockfree") == 0){
+        for(long i = 0; i < bench->ops; i++){
+            empty += lfIsEmpty(state->lfQueue);
+        }
+    }
+    else {
+        for(long i = 0; i < bench->ops; i++){
+            empty += workIsEmpty(state->work);
+        }
+    }
+    sink = empty;
+}
+
+
+static void benchGetSize(benchCase* bench, int id){
+    (void)id;
+    queueState* state = (queueState*)bench->state;
+    long size = 0;
+    if(strcmp(bench->variant, "mutex") == 0){
+        for(long i = 0; i < bench->ops; i++){
+            size += getSize(state->queue);
+        }
+    }
+    else if(strcmp(bench->variant, "lockfree") == 0){
+        for(long i = 0; i < bench->ops; i++){
+            size += lfGetSize(state->lfQueue);
+        }
+    }
+    else {
+        for(long i = 0; i < bench->ops; i++){
+            size += workSize(state->work);
+        }
+    }
+    sink = size;
+}
+
+
+/*
+ * Under contention: every thread pushes one of its own nodes and pops one, like the reader and the workers do.
+ * An op is a push and a pop.
+ */
+static void benchPushPop(benchCase* bench, int id){
+    queueState* state = (queueState*)bench->state;
+    long share = bench->ops / bench->threads;
+    Node* nodes = state->nodes + id * share;
+    int stolen;
+
+    for(long i = 0; i < share; i++){
+        if(strcmp(bench->variant, "mutex") == 0){
+            enqueueNode(state->queue, &nodes[i]);
+            while(dequeue(state->queue) == NULL){
+                sched_yield();
+            }
+        }
+        else if(strcmp(bench->variant, "lockfree") == 0){
+            while(!lfEnqueueNode(state->lfQueue, &nodes[i])){
+                sched_yield();
+            }
+            while(lfDequeue(state->lfQueue) == NULL){
+                sched_yield();
+            }
+        }
+        else {
+            while(!workPush(state->work, &nodes[i], id)){
+                sched_yield();
+            }
+            while(workPop(state->work, id, &stolen) == NULL){
+                sched_yield();
+            }
+        }
+    }
+}
+
+
+/*
+ * Reorder buffer - blocks are inserted in the order of state->order (thread i takes every threads-th one from i),
+ * and every inserter takes out whatever became ready, like the workers and the writer around toWrite.
+ */
+static void resetReorder(benchCase* bench){
+    queueState* state = (queueState*)bench->state;
+    if(state->reorder != NULL){
+        reorderDestroy(state->reorder);
+    }
+    state->reorder = createReorderBuffer(BENCH_REORDER_WINDOW);
+    atomic_store(&state->taken, 0);
+}
+
+
+static void benchReorder(benchCase* bench, int id){
+    queueState* state = (queueState*)bench->state;
+    for(long i = id; i < bench->ops; i += bench->threads){
+        Node* node = &state->nodes[i];
+        node->blockNum = state->order[i];
+        while(!reorderHasRoom(state->reorder, node->blockNum)){
+            sched_yield();
+        }
+        reorderInsert(state->reorder, node);
+        while(reorderTakeNext(state->reorder) != NULL){
+            atomic_fetch_add(&state->taken, 1);
+        }
+    }
+    // The last blocks may be taken by another thread
+    while(atomic_load(&state->taken) < bench->ops){
+        if(reorderTakeNext(state->reorder) != NULL){
+            atomic_fetch_add(&state->taken, 1);
+        }
+    }
+}
+
+
+static void runQueueCases(const benchOptions* options){
+    long maxThreads = 1;
+    for(int i = 0; i < options->threadCount; i++){
+        maxThreads = options->threads[i] > maxThreads ? options->threads[i] : maxThreads;
+    }
+
+    queueState state;
+    state.queue = createQueue();
+    state.lfQueue = createLfQueue(BENCH_QUEUE_OPS);
+    state.work = createWorkQueues(1, BENCH_QUEUE_OPS);
+    state.reorder = NULL;
+    state.nodes = (Node*)calloc(BENCH_QUEUE_OPS * maxThreads, sizeof(Node));
+    state.order = (long*)malloc(BENCH_QUEUE_OPS * sizeof(long));
+    if(state.queue == NULL || state.lfQueue == NULL || state.work == NULL || state.nodes == NULL || state.order == NULL){
+        fprintf(stderr, "Error: Failed to allocate the queue benchmark data.\n");
+        exit(1);
+    }
+    atomic_init(&state.taken, 0);
+
+    const char* variants[] = {"mutex", "lockfree", "work"};
+    for(int v = 0; v < 3; v++){
+        benchCase cases[] = {
+            {"queue", "enqueue", variants[v], 0, 1, BENCH_QUEUE_OPS, 0, &state, benchEnqueue, resetEmpty},
+            {"queue", "enqueueNode", variants[v], 0, 1, BENCH_QUEUE_OPS, 0, &state, benchEnqueueNode, resetEmpty},
+            {"queue", "dequeue", variants[v], 0, 1, BENCH_QUEUE_OPS, 0, &state, benchDequeue, resetFull},
+            {"queue", "isEmpty", variants[v], 0, 1, BENCH_QUEUE_OPS, 0, &state, benchIsEmpty, resetFew},
+            {"queue", "getSize", variants[v], 0, 1, BENCH_QUEUE_OPS, 0, &state, benchGetSize, resetFew},
+        };
+        // enqueue() allocates its node, the per-worker rings only take nodes
+        for(int c = v == 2 ? 1 : 0; c < (int)(sizeof(cases) / sizeof(cases[0])); c++){
+            runCase(options, &cases[c]);
+        }
+    }
+
+    // Contention: one ring per thread for the work queues, like one per worker
+    for(int t = 0; t < options->threadCount; t++){
+        int threads = (int)options->threads[t];
+        WorkQueues* single = state.work;
+        state.work = createWorkQueues(threads, BENCH_QUEUE_OPS);
+        if(state.work == NULL){
+            fprintf(stderr, "Error: Failed to allocate the work queues.\n");
+            exit(1);
+        }
+        for(int v = 0; v < 3; v++){
+            benchCase bench = {"queue", "enqueueNode+dequeue", variants[v], 0, threads, BENCH_QUEUE_OPS * threads, 0, &state, benchPushPop, resetEmpty};
+            runCase(options, &bench);
+        }
+        workQueuesDestroy(state.work);
+        state.work = single;
+    }
+
+    // Reorder buffer: in order, shuffled inside each window, and interleaved between threads
+    for(long i = 0; i < BENCH_QUEUE_OPS; i++){
+        state.order[i] = i;
+    }
+    benchCase inOrder = {"reorder", "reorderInsert+takeNext", "in-order", 0, 1, BENCH_QUEUE_OPS, 0, &state, benchReorder, resetReorder};
+    runCase(options, &inOrder);
+
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    for(long base = 0; base < BENCH_QUEUE_OPS; base += BENCH_REORDER_WINDOW){
+        for(long i = BENCH_REORDER_WINDOW - 1; i > 0; i--){
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            long j = (long)(seed % (uint64_t)(i + 1));
+            long swap = state.order[base + i];
+            state.order[base + i] = state.order[base + j];
+            state.order[base + j] = swap;
+        }
+    }
+    benchCase shuffled = {"reorder", "reorderInsert+takeNext", "shuffled", 0, 1, BENCH_QUEUE_OPS, 0, &state, benchReorder, resetReorder};
+    runCase(options, &shuffled);
+
+    for(long i = 0; i < BENCH_QUEUE_OPS; i++){
+        state.order[i] = i;
+    }
+    for(int t = 0; t < options->threadCount; t++){
+        if(options->threads[t] > 1){
+            benchCase interleaved = {"reorder", "reorderInsert+takeNext", "interleaved", 0, (int)options->threads[t], BENCH_QUEUE_OPS, 0, &state, benchReorder, resetReorder};
+            runCase(options, &interleaved);
+        }
+    }
+
+    if(state.reorder != NULL){
+        reorderDestroy(state.reorder);
+    }
+    drainQueues(&state);
+    queueDistroyMutex(state.queue);
+    free(state.queue);
+    lfQueueDestroy(state.lfQueue);
+    workQueuesDestroy(state.work);
+    free(state.nodes);
+    free(state.order);
+}
+
+
+/*
+ * Kernels - an op is one call on a key-sized block (or one chunk for the cursor), rotations spread over the period.
+ */
+static long rotationOf(long i, long size){
+    return (i * 7919 + 3) % (size * 8);
+}
+
+
+static void benchLeftShift(benchCase* bench, int id){
+    (void)id;
+    kernelState* state = (kernelState*)bench->state;
+    for(long i = 0; i < bench->ops; i++){
+        leftShiftKey(state->scratch, bench->size);
+    }
+}
+
+
+static void benchRotate(benchCase* bench, int id){
+    (void)id;
+    kernelState* state = (kernelState*)bench->state;
+    for(long i = 0; i < bench->ops; i++){
+        rotateKey(state->scratch, rotationOf(i, bench->size), bench->size);
+    }
+}
+
+
+static void benchRotateCopy(benchCase* bench, int id){
+    (void)id;
+    kernelState* state = (kernelState*)bench->state;
+    for(long i = 0; i < bench->ops; i++){
+        rotateKeyCopy(state->scratch, state->key, rotationOf(i, bench->size), bench->size);
+    }
+}
+
+
+static void benchEncryptBlock(benchCase* bench, int id){
+    (void)id;
+    kernelState* state = (kernelState*)bench->state;
+    for(long i = 0; i < bench->ops; i++){
+        encryptBlock(state->data, state->key, bench->size);
+    }
+}
+
+
+static void benchXorBlock(benchCase* bench, int id){
+    (void)id;
+    kernelState* state = (kernelState*)bench->state;
+    for(long i = 0; i < bench->ops; i++){
+        state->kernel->run(state->data, state->data, state->key, bench->size);
+    }
+}
+
+
+static void benchXorRotated(benchCase* bench, int id){
+    (void)id;
+    kernelState* state = (kernelState*)bench->state;
+    for(long i = 0; i < bench->ops; i++){
+        xorBlockRotated(state->data, state->data, state->key, bench->size, rotationOf(i, bench->size), bench->size);
+    }
+}
+
+
+/*
+ * A chunk through the key cursor, each block's key built the way the variant says.
+ */
+static void benchCursor(benchCase* bench, int id){
+    (void)id;
+    kernelState* state = (kernelState*)bench->state;
+    long keySize = bench->size;
+
+    for(long i = 0; i < bench->ops; i++){
+        long firstBlock = i * (bench->bytes / keySize);
+        if(strcmp(bench->variant, "rotated-copy") == 0){
+            for(long offset = 0; offset < bench->bytes; offset += keySize){
+                long blockLength = bench->bytes - offset < keySize ? bench->bytes - offset : keySize;
+                long blockNum = firstBlock + offset / keySize;
+                xorBlock(state->data + offset, state->data + offset, keyCursorBlockKey(&state->cursor, blockNum, blockLength), blockLength);
+            }
+        }
+        else if(strcmp(bench->variant, "fused") == 0){
+            for(long offset = 0; offset < bench->bytes; offset += keySize){
+                long blockLength = bench->bytes - offset < keySize ? bench->bytes - offset : keySize;
+                long blockNum = firstBlock + offset / keySize;
+                xorBlockRotated(state->data + offset, state->data + offset, state->key, keySize, blockNum % (blockLength * 8), blockLength);
+            }
+        }
+        else {
+            keyCursorEncrypt(&state->cursor, state->data, state->data, bench->bytes, firstBlock);
+        }
+    }
+}
+
+
+static void runKernelCases(const benchOptions* options){
+    int kernelCount;
+    const xorKernel* kernels = xorKernelList(&kernelCount);
+
+    for(int k = 0; k < options->keyCount; k++){
+        long size = options->keys[k];
+        long chunk = size > BENCH_CHUNK_SIZE ? size : BENCH_CHUNK_SIZE / size * size;
+        long ops = BENCH_KERNEL_BYTES / size > 0 ? BENCH_KERNEL_BYTES / size : 1;
+
+        kernelState state;
+        state.key = (uint8_t*)malloc(size);
+        state.scratch = (uint8_t*)malloc(size);
+        state.data = (uint8_t*)aligned_alloc(64, (chunk + 63) / 64 * 64);
+        state.cache = NULL;
+        if(state.key == NULL || state.scratch == NULL || state.data == NULL || !keyCursorInit(&state.cursor, state.key, size)){
+            fprintf(stderr, "Error: Failed to allocate the kernel benchmark data.\n");
+            exit(1);
+        }
+        fillRandom(state.key, size, 0x1234 + size);
+        memcpy(state.scratch, state.key, size);
+        fillRandom(state.data, chunk, 0x5678);
+
+        benchCase rotations[] = {
+            {"kernel", "leftShiftKey", "current", size, 1, ops, size, &state, benchLeftShift, NULL},
+            {"kernel", "rotateKey", "current", size, 1, ops, size, &state, benchRotate, NULL},
+            {"kernel", "rotateKeyCopy", "current", size, 1, ops, size, &state, benchRotateCopy, NULL},
+            {"kernel", "encryptBlock", xorKernelName(), size, 1, ops, size, &state, benchEncryptBlock, NULL},
+        };
+        for(int c = 0; c < (int)(sizeof(rotations) / sizeof(rotations[0])); c++){
+            runCase(options, &rotations[c]);
+        }
+
+        // Every kernel variant side by side, plain and fused with the rotation
+        for(int v = 0; v < kernelCount; v++){
+            if(!kernels[v].supported()){
+                continue;
+            }
+            state.kernel = &kernels[v];
+            benchCase plain = {"kernel", "xorBlock", kernels[v].name, size, 1, ops, size, &state, benchXorBlock, NULL};
+            runCase(options, &plain);
+
+            selectXorKernel(kernels[v].name);
+            benchCase fused = {"kernel", "xorBlockRotated", kernels[v].name, size, 1, ops, size, &state, benchXorRotated, NULL};
+            runCase(options, &fused);
+            selectXorKernel(NULL);
+        }
+
+        // A chunk through the cursor: the rotated copy, the fused kernel, the whole table (when it fits the budget)
+        long chunkOps = BENCH_KERNEL_BYTES / chunk > 0 ? BENCH_KERNEL_BYTES / chunk : 1;
+        benchCase copied = {"cursor", "keyCursorEncrypt", "rotated-copy", size, 1, chunkOps, chunk, &state, benchCursor, NULL};
+        runCase(options, &copied);
+        benchCase fused = {"cursor", "keyCursorEncrypt", "fused", size, 1, chunkOps, chunk, &state, benchCursor, NULL};
+        runCase(options, &fused);
+        if(size <= BENCH_TABLE_BUDGET / size / 8 && selected(options, &(benchCase){.group = "cursor", .name = "keyCursorEncrypt", .variant = "table"})){
+            state.cache = keyCacheCreate(state.key, size, BENCH_TABLE_BUDGET, get_nprocs() - 1);
+            if(state.cache != NULL){
+                keyCursorSetCache(&state.cursor, state.cache);
+                benchCase table = {"cursor", "keyCursorEncrypt", "table", size, 1, chunkOps, chunk, &state, benchCursor, NULL};
+                runCase(options, &table);
+                keyCursorSetCache(&state.cursor, NULL);
+                keyCacheDestroy(state.cache);
+            }
+        }
+
+        keyCursorFree(&state.cursor);
+        free(state.key);
+        free(state.scratch);
+        free(state.data);
+    }
+}
+
+
+static int processBenchInput(int argc, char* argv[], benchOptions* options){
+    options->filter = NULL;
+    options->rounds = 31;
+    options->warmup = 3;
+    options->threadCount = parseList("1,2,4", options->threads);
+    options->keyCount = parseList("16,64,1K,64K,1M", options->keys);
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--filter") == 0 && i < argc - 1){
+            options->filter = argv[++i];
+        }
+        else if(strcmp(argv[i], "--rounds") == 0 && i < argc - 1){
+            options->rounds = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--warmup") == 0 && i < argc - 1){
+            options->warmup = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--threads") == 0 && i < argc - 1){
+            options->threadCount = parseList(argv[++i], options->threads);
+        }
+        else if(strcmp(argv[i], "--keys") == 0 && i < argc - 1){
+            options->keyCount = parseList(argv[++i], options->keys);
+        }
+        else if(strcmp(argv[i], "--quick") == 0){
+            options->rounds = 7;
+            options->warmup = 1;
+            options->threadCount = parseList("1,2", options->threads);
+            options->keyCount = parseList("16,1K,1M", options->keys);
+        }
+        else {
+            fprintf(stderr, "Error: Unknown argument %s.\n", argv[i]);
+            return 0;
+        }
+    }
+
+    if(options->rounds < 1 || options->warmup < 0 || options->threadCount < 1 || options->keyCount < 1){
+        fprintf(stderr, "Error: Invalid benchmark options.\n");
+        return 0;
+    }
+    for(int i = 0; i < options->threadCount; i++){
+        if(options->threads[i] > 256){
+            fprintf(stderr, "Error: At most 256 threads.\n");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+int main(int argc, char* argv[]){
+    benchOptions options;
+    if(!processBenchInput(argc, argv, &options)){
+        return 1;
+    }
+    if(!selectXorKernel(NULL)){
+        return 1;
+    }
+
+    runQueueCases(&options);
+    runKernelCases(&options);
+    return 0;
+}
@@ -0,0 +1,422 @@
+/*
+ * End-to-end throughput benchmark of the encryptUtil pipeline.
+ * Generates synthetic inputs and keys in a scratch directory, then runs the binary over a matrix of
+ * key sizes, thread counts (-n) and input sizes. Each case reports MB/s, CPU time and peak RSS as JSON (one case per line).
+ * With --baseline, every case is compared with the same case of a saved report, and a drop in MB/s larger than
+ * the tolerance makes the benchmark fail (exit code 2).
+ *
+ * Build: make bench (or gcc -O2 bench/pipelineBench.c -o pipelineBench)
+ * Run:   ./pipelineBench [--binary path] [--keys list] [--threads list] [--sizes list] [--runs n] [--dir path]
+ *                        [--baseline report.json] [--tolerance percent] [--quick] > report.json
+ * Lists are comma separated sizes with optional K, M, G suffixes (e.g. --keys 16,4K,1M,16M).
+ */
+#include <time.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/sysinfo.h>
+
+#define BENCH_MAX_VALUES 16
+#define BENCH_MAX_CASES (BENCH_MAX_VALUES * BENCH_MAX_VALUES * BENCH_MAX_VALUES)
+#define BENCH_WRITE_SIZE (1024 * 1024)
+#define BENCH_PATH_SIZE 512
+
+typedef struct benchCase{
+    long keySize;
+    long threads;
+    long inputSize;
+    double seconds;
+    double mbps;
+    double cpuSeconds;
+    long peakRssKiB;
+} benchCase;
+
+typedef struct benchOptions{
+    const char* binary;
+    const char* dir;
+    const char* baseline;
+    long keys[BENCH_MAX_VALUES];
+    int keyCount;
+    long threads[BENCH_MAX_VALUES];
+    int threadCount;
+    long sizes[BENCH_MAX_VALUES];
+    int sizeCount;
+    int runs;
+    double tolerance;
+} benchOptions;
+
+
+static double nowSeconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*
+ * Same syntax as encryptUtil's --chunk: bytes, optionally followed by a K, M or G (binary) suffix.
+ */
+static long parseBenchSize(const char* text, char** end){
+    long size = strtol(text, end, 10);
+    if(*end == text || size < 0){
+        return -1;
+    }
+    switch(**end){
+        case 'k': case 'K':
+            size *= 1024L;
+            (*end)++;
+            break;
+        case 'm': case 'M':
+            size *= 1024L * 1024;
+            (*end)++;
+            break;
+        case 'g': case 'G':
+            size *= 1024L * 1024 * 1024;
+            (*end)++;
+            break;
+    }
+    return size;
+}
+
+
+/*
+ * Parses a comma separated list of sizes, returns the number of values or -1 if the list is invalid.
+ */
+static int parseList(const char* text, long* values){
+    int count = 0;
+    char* end;
+
+    while(count < BENCH_MAX_VALUES){
+        long value = parseBenchSize(text, &end);
+        if(value < 0){
+            return -1;
+        }
+        values[count++] = value;
+        if(*end == '\0'){
+            return count;
+        }
+        if(*end != ','){
+            return -1;
+        }
+        text = end + 1;
+    }
+    return -1;
+}
+
+
+/*
+ * Writes size pseudo-random bytes (xorshift64, seeded so the files are the same on every run) to path.
+ */
+static int generateFile(const char* path, long size, uint64_t seed){
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        perror("Error: creating a benchmark file");
+        return 0;
+    }
+
+    static uint64_t buffer[BENCH_WRITE_SIZE / sizeof(uint64_t)];
+    uint64_t state = seed | 1;
+    long left = size;
+    while(left > 0){
+        for(size_t i = 0; i < sizeof(buffer) / sizeof(buffer[0]); i++){
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            buffer[i] = state;
+        }
+        long length = left < BENCH_WRITE_SIZE ? left : BENCH_WRITE_SIZE;
+        if(write(fd, buffer, length) != length){
+            perror("Error: writing a benchmark file");
+            close(fd);
+            return 0;
+        }
+        left -= length;
+    }
+
+    close(fd);
+    return 1;
+}
+
+
+/*
+ * Runs the binary once with stdin from the input file and stdout to /dev/null.
+ * Fills the wall time, the child's CPU time and its peak RSS. Returns 1 if it exited successfully.
+ */
+static int runOnce(const benchOptions* options, const char* keyPath, const char* inputPath, long threads, benchCase* result){
+    char threadsArg[32];
+    snprintf(threadsArg, sizeof(threadsArg), "%ld", threads);
+
+    double start = nowSeconds();
+    pid_t pid = fork();
+    if(pid < 0){
+        perror("Error: fork");
+        return 0;
+    }
+    if(pid == 0){
+        int in = open(inputPath, O_RDONLY);
+        int out = open("/dev/null", O_WRONLY);
+        if(in < 0 || out < 0 || dup2(in, STDIN_FILENO) < 0 || dup2(out, STDOUT_FILENO) < 0){
+            _exit(127);
+        }
+        execl(options->binary, options->binary, "-n", threadsArg, "-k", keyPath, (char*)NULL);
+        perror("Error: running the binary");
+        _exit(127);
+    }
+
+    // wait4 gives the resources of this child alone (RUSAGE_CHILDREN would add up every run)
+    int status;
+    struct rusage usage;
+    while(wait4(pid, &status, 0, &usage) < 0){
+        if(errno != EINTR){
+            perror("Error: wait4");
+            return 0;
+        }
+    }
+    result->seconds = nowSeconds() - start;
+    result->cpuSeconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    result->peakRssKiB = usage.ru_maxrss;
+
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+        fprintf(stderr, "Error: %s -n %ld -k %s failed (status %d)\n", options->binary, threads, keyPath, status);
+        return 0;
+    }
+    return 1;
+}
+
+
+static void printCase(FILE* stream, const benchCase* result, int last){
+    fprintf(stream, "    {\"keySize\": %ld, \"threads\": %ld, \"inputSize\": %ld, \"seconds\": %.6f, \"mbps\": %.2f, \"cpuSeconds\": %.6f, \"peakRssKiB\": %ld}%s\n",
+            result->keySize, result->threads, result->inputSize, result->seconds, result->mbps, result->cpuSeconds, result->peakRssKiB, last ? "" : ",");
+}
+
+
+/*
+ * Loads the cases of a report written by this program (one case per line, see printCase()).
+ * Returns the number of cases, or -1 if the file can't be read.
+ */
+static int loadBaseline(const char* path, benchCase* cases){
+    FILE* file = fopen(path, "r");
+    if(file == NULL){
+        perror("Error: opening the baseline");
+        return -1;
+    }
+
+    char line[512];
+    int count = 0;
+    while(count < BENCH_MAX_CASES && fgets(line, sizeof(line), file) != NULL){
+        benchCase* entry = &cases[count];
+        if(sscanf(line, " {\"keySize\": %ld, \"threads\": %ld, \"inputSize\": %ld, \"seconds\": %lf, \"mbps\": %lf, \"cpuSeconds\": %lf, \"peakRssKiB\": %ld",
+                  &entry->keySize, &entry->threads, &entry->inputSize, &entry->seconds, &entry->mbps, &entry->cpuSeconds, &entry->peakRssKiB) == 7){
+            count++;
+        }
+    }
+
+    fclose(file);
+    return count;
+}
+
+
+/*
+ * Compares every case with the same case of the baseline (cases missing from the baseline are skipped).
+ * Returns the number of regressions, each one is reported on stderr.
+ */
+static int compareBaseline(const benchOptions* options, const benchCase* results, int count){
+    static benchCase baseline[BENCH_MAX_CASES];
+    int baselineCount = loadBaseline(options->baseline, baseline);
+    if(baselineCount < 0){
+        return 1;
+    }
+
+    int regressions = 0;
+    for(int i = 0; i < count; i++){
+        const benchCase* current = &results[i];
+        for(int j = 0; j < baselineCount; j++){
+            const benchCase* base = &baseline[j];
+            if(base->keySize != current->keySize || base->threads != current->threads || base->inputSize != current->inputSize){
+                continue;
+            }
+            double change = (current->mbps - base->mbps) / base->mbps * 100;
+            if(change < -options->tolerance){
+                fprintf(stderr, "REGRESSION: key %ld, -n %ld, input %ld: %.2f MB/s vs %.2f MB/s in the baseline (%.1f%%)\n",
+                        current->keySize, current->threads, current->inputSize, current->mbps, base->mbps, change);
+                regressions++;
+            }
+            break;
+        }
+    }
+
+    if(regressions == 0){
+        fprintf(stderr, "No regression against %s (tolerance %.1f%%).\n", options->baseline, options->tolerance);
+    }
+    return regressions;
+}
+
+
+static int processBenchInput(int argc, char* argv[], benchOptions* options){
+    options->binary = "./encryptUtil";
+    options->dir = "/tmp";
+    options->baseline = NULL;
+    options->runs = 3;
+    options->tolerance = 10;
+
+    // Key sizes from 16 B to 16 MiB, no workers up to every core, a small and a large input
+    long keys[] = {16, 4096, 1024 * 1024, 16 * 1024 * 1024};
+    long sizes[] = {16 * 1024 * 1024, 256 * 1024 * 1024};
+    long cores = get_nprocs();
+    options->keyCount = sizeof(keys) / sizeof(keys[0]);
+    memcpy(options->keys, keys, sizeof(keys));
+    options->sizeCount = sizeof(sizes) / sizeof(sizes[0]);
+    memcpy(options->sizes, sizes, sizeof(sizes));
+    options->threadCount = 0;
+    options->threads[options->threadCount++] = 0;
+    options->threads[options->threadCount++] = 1;
+    for(long n = 2; n <= cores && options->threadCount < BENCH_MAX_VALUES; n *= 2){
+        options->threads[options->threadCount++] = n;
+    }
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--binary") == 0 && i < argc - 1){
+            options->binary = argv[++i];
+        }
+        else if(strcmp(argv[i], "--dir") == 0 && i < argc - 1){
+            options->dir = argv[++i];
+        }
+        else if(strcmp(argv[i], "--baseline") == 0 && i < argc - 1){
+            options->baseline = argv[++i];
+        }
+        else if(strcmp(argv[i], "--runs") == 0 && i < argc - 1){
+            options->runs = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--tolerance") == 0 && i < argc - 1){
+            options->tolerance = atof(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--keys") == 0 && i < argc - 1){
+            options->keyCount = parseList(argv[++i], options->keys);
+        }
+        else if(strcmp(argv[i], "--threads") == 0 && i < argc - 1){
+            options->threadCount = parseList(argv[++i], options->threads);
+        }
+        else if(strcmp(argv[i], "--sizes") == 0 && i < argc - 1){
+            options->sizeCount = parseList(argv[++i], options->sizes);
+        }
+        // A short matrix for a quick sanity check
+        else if(strcmp(argv[i], "--quick") == 0){
+            options->keys[0] = 16;
+            options->keys[1] = 1024 * 1024;
+            options->keyCount = 2;
+            options->threads[0] = 0;
+            options->threads[1] = cores;
+            options->threadCount = 2;
+            options->sizes[0] = 16 * 1024 * 1024;
+            options->sizeCount = 1;
+            options->runs = 1;
+        }
+        else {
+            fprintf(stderr, "Error: Unknown argument %s.\n", argv[i]);
+            return 0;
+        }
+    }
+
+    if(options->keyCount <= 0 || options->threadCount <= 0 || options->sizeCount <= 0 || options->runs <= 0){
+        fprintf(stderr, "Error: Invalid benchmark matrix.\n");
+        return 0;
+    }
+    for(int i = 0; i < options->keyCount; i++){
+        if(options->keys[i] == 0){
+            fprintf(stderr, "Error: The key size must be > 0.\n");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+int main(int argc, char* argv[]){
+    benchOptions options;
+    if(!processBenchInput(argc, argv, &options)){
+        fprintf(stderr, "Error: Usage ./pipelineBench [--binary path] [--keys list] [--threads list] [--sizes list] [--runs n] [--dir path] [--baseline report.json] [--tolerance percent] [--quick]\n");
+        return 1;
+    }
+    if(access(options.binary, X_OK) != 0){
+        fprintf(stderr, "Error: %s is not an executable (build it with make first).\n", options.binary);
+        return 1;
+    }
+
+    // Generate the keys and the inputs once, every case reads them from the page cache
+    char path[BENCH_PATH_SIZE];
+    snprintf(path, sizeof(path), "%s/pipelineBench.XXXXXX", options.dir);
+    char* scratch = mkdtemp(path);
+    if(scratch == NULL){
+        perror("Error: creating the scratch directory");
+        return 1;
+    }
+    char keyPaths[BENCH_MAX_VALUES][BENCH_PATH_SIZE];
+    char inputPaths[BENCH_MAX_VALUES][BENCH_PATH_SIZE];
+    int generated = 1;
+    for(int i = 0; i < options.keyCount; i++){
+        snprintf(keyPaths[i], BENCH_PATH_SIZE, "%s/key%d", scratch, i);
+        generated = generated && generateFile(keyPaths[i], options.keys[i], 0x9e3779b97f4a7c15ULL + i);
+    }
+    for(int i = 0; i < options.sizeCount; i++){
+        snprintf(inputPaths[i], BENCH_PATH_SIZE, "%s/input%d", scratch, i);
+        generated = generated && generateFile(inputPaths[i], options.sizes[i], 0xd1b54a32d192ed03ULL + i);
+    }
+
+    static benchCase results[BENCH_MAX_CASES];
+    int count = 0;
+    int failed = !generated;
+    for(int s = 0; s < options.sizeCount && !failed; s++){
+        for(int k = 0; k < options.keyCount && !failed; k++){
+            for(int t = 0; t < options.threadCount && !failed; t++){
+                benchCase* result = &results[count];
+                // Best of the runs: the noise (other processes, cold caches) only ever makes a run slower
+                for(int r = 0; r < options.runs; r++){
+                    benchCase run;
+                    if(!runOnce(&options, keyPaths[k], inputPaths[s], options.threads[t], &run)){
+                        failed = 1;
+                        break;
+                    }
+                    if(r == 0 || run.seconds < result->seconds){
+                        *result = run;
+                    }
+                }
+                result->keySize = options.keys[k];
+                result->threads = options.threads[t];
+                result->inputSize = options.sizes[s];
+                result->mbps = result->inputSize / result->seconds / 1e6;
+                fprintf(stderr, "key %ld, -n %ld, input %ld: %.2f MB/s\n", result->keySize, result->threads, result->inputSize, result->mbps);
+                count++;
+            }
+        }
+    }
+
+    // Remove the generated files
+    for(int i = 0; i < options.keyCount; i++){
+        unlink(keyPaths[i]);
+    }
+    for(int i = 0; i < options.sizeCount; i++){
+        unlink(inputPaths[i]);
+    }
+    rmdir(scratch);
+    if(failed){
+        return 1;
+    }
+
+    printf("{\n  \"binary\": \"%s\",\n  \"runs\": %d,\n  \"cases\": [\n", options.binary, options.runs);
+    for(int i = 0; i < count; i++){
+        printCase(stdout, &results[i], i == count - 1);
+    }
+    printf("  ]\n}\n");
+    fflush(stdout);
+
+    if(options.baseline != NULL && compareBaseline(&options, results, count) > 0){
+        return 2;
+    }
+    return 0;
+}
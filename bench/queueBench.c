@@ -0,0 +1,160 @@
+/*
+ * Contention benchmark: the mutex Queue (queue.h) against the lock-free LfQueue (lfQueue.h).
+ * P producers push nodes while C consumers pop them, like the reader and the workers on toEncrypt.
+ *
+ * Build: gcc -O2 bench/queueBench.c src/queue.c src/lfQueue.c src/pipelineStats.c src/workQueues.c -o queueBench -lpthread
+ * Run:   ./queueBench [producers] [consumers] [nodes per producer]
+ */
+#include <time.h>
+#include <string.h>
+#include <sched.h>
+
+#include "../include/queue.h"
+#include "../include/lfQueue.h"
+
+#define BENCH_CAPACITY 512
+
+typedef struct benchData{
+    Queue* queue;
+    LfQueue* lfQueue;
+    Node* nodes;
+    long perProducer;
+    long total;
+    atomic_long consumed;
+} benchData;
+
+typedef struct benchArg{
+    benchData* data;
+    int id;
+} benchArg;
+
+
+static double nowSeconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void* mutexProducer(void* arg){
+    benchArg* bArg = (benchArg*)arg;
+    benchData* data = bArg->data;
+
+    // The mutex queue is unbounded, so the capacity is enforced the way the reader used to (polling the size)
+    for(long i = 0; i < data->perProducer; i++){
+        Node* node = &data->nodes[bArg->id * data->perProducer + i];
+        while(getSize(data->queue) >= BENCH_CAPACITY){
+            sched_yield();
+        }
+        enqueueNode(data->queue, node);
+    }
+    return NULL;
+}
+
+
+static void* mutexConsumer(void* arg){
+    benchData* data = ((benchArg*)arg)->data;
+
+    while(atomic_load(&data->consumed) < data->total){
+        Node* node = dequeue(data->queue);
+        if(node != NULL){
+            atomic_fetch_add(&data->consumed, 1);
+        }
+        else {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+
+static void* lfProducer(void* arg){
+    benchArg* bArg = (benchArg*)arg;
+    benchData* data = bArg->data;
+
+    for(long i = 0; i < data->perProducer; i++){
+        Node* node = &data->nodes[bArg->id * data->perProducer + i];
+        while(!lfEnqueueNode(data->lfQueue, node)){
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+
+static void* lfConsumer(void* arg){
+    benchData* data = ((benchArg*)arg)->data;
+
+    while(atomic_load(&data->consumed) < data->total){
+        Node* node = lfDequeue(data->lfQueue);
+        if(node != NULL){
+            atomic_fetch_add(&data->consumed, 1);
+        }
+        else {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+
+/*
+ * Runs one round with the given producer/consumer functions and returns the elapsed time in seconds.
+ */
+static double runRound(benchData* data, int producers, int consumers, void* (*producer)(void*), void* (*consumer)(void*)){
+    pthread_t threads[producers + consumers];
+    benchArg args[producers + consumers];
+
+    atomic_store(&data->consumed, 0);
+    double start = nowSeconds();
+
+    for(int i = 0; i < producers + consumers; i++){
+        args[i].data = data;
+        args[i].id = i < producers ? i : i - producers;
+        pthread_create(&threads[i], NULL, i < producers ? producer : consumer, &args[i]);
+    }
+    for(int i = 0; i < producers + consumers; i++){
+        pthread_join(threads[i], NULL);
+    }
+
+    return nowSeconds() - start;
+}
+
+
+int main(int argc, char* argv[]){
+    int producers = argc > 1 ? atoi(argv[1]) : 1;
+    int consumers = argc > 2 ? atoi(argv[2]) : 4;
+    long perProducer = argc > 3 ? atol(argv[3]) : 1000000;
+
+    if(producers <= 0 || consumers <= 0 || perProducer <= 0){
+        fprintf(stderr, "Error: Usage ./queueBench [producers] [consumers] [nodes per producer]\n");
+        return 1;
+    }
+
+    benchData data;
+    data.perProducer = perProducer;
+    data.total = perProducer * producers;
+    data.nodes = (Node*)calloc(data.total, sizeof(Node));
+    data.queue = createQueue();
+    data.lfQueue = createLfQueue(BENCH_CAPACITY);
+    if(data.nodes == NULL || data.queue == NULL || data.lfQueue == NULL){
+        fprintf(stderr, "Error: Failed to allocate the benchmark data.\n");
+        return 1;
+    }
+    for(long i = 0; i < data.total; i++){
+        data.nodes[i].blockNum = i;
+    }
+
+    double mutexTime = runRound(&data, producers, consumers, mutexProducer, mutexConsumer);
+    double lfTime = runRound(&data, producers, consumers, lfProducer, lfConsumer);
+
+    printf("producers=%d consumers=%d nodes=%ld\n", producers, consumers, data.total);
+    printf("mutex queue:     %8.3f s  %8.2f Mops/s\n", mutexTime, data.total / mutexTime / 1e6);
+    printf("lock-free queue: %8.3f s  %8.2f Mops/s\n", lfTime, data.total / lfTime / 1e6);
+
+    queueDistroyMutex(data.queue);
+    free(data.queue);
+    lfQueueDestroy(data.lfQueue);
+    free(data.nodes);
+    return 0;
+}
@@ -0,0 +1,72 @@
+#ifndef AUTO_TUNE_H
+#define AUTO_TUNE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+/*
+ * The length of a measurement window, in nanoseconds.
+ */
+#define AUTO_TUNE_WINDOW_NS (100 * 1000000ULL)
+
+/*
+ * The relative throughput gain a level must show over the best one to be kept (below that, it's noise).
+ */
+#define AUTO_TUNE_GAIN 0.02
+
+/*
+ * The number of windows spent at the chosen level before probing its neighbours again (the workload may change).
+ */
+#define AUTO_TUNE_REPROBE 50
+
+
+/*
+ * Data structure to hold the state of a hill-climbing tuner.
+ * It measures the throughput of each window at the current level, moves one level at a time in the direction that
+ * improves it, turns around once if the first step didn't help, and settles on the best level it measured.
+ * Pure bookkeeping: the caller feeds it the bytes done and the time, and applies the level it returns.
+ */
+typedef struct AutoTuner{
+    int minLevel;
+    int maxLevel;
+    int level;
+    int bestLevel;
+    double bestRate;
+    int direction;
+    int turned;
+    int settled;
+    int settledWindows;
+    int warmedUp;
+    int reported;
+    uint64_t windowStart;
+    long windowBytes;
+
+} AutoTuner;
+
+
+/*
+ * @brief Initialize a tuner.
+ *
+ * @param [out] tuner   - A pointer to the tuner to initialize.
+ * @param [in] minLevel - The lowest level allowed.
+ * @param [in] maxLevel - The highest level allowed.
+ * @param [in] start    - The level to start from (clamped to [minLevel, maxLevel]).
+ * @param [in] now      - The current time in nanoseconds.
+*/
+void autoTuneInit(AutoTuner* tuner, int minLevel, int maxLevel, int start, uint64_t now);
+
+
+/*
+ * @brief Record work done, and move to another level when a window ends.
+ * The first window is a warm-up and isn't measured.
+ *
+ * @param [in] tuner    - A pointer to the tuner.
+ * @param [in] bytes    - The number of bytes done since the last call.
+ * @param [in] now      - The current time in nanoseconds.
+ * @return Return 1 if the level changed (read it from tuner->level), else 0.
+*/
+int autoTuneRecord(AutoTuner* tuner, long bytes, uint64_t now);
+
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef BATCH_MODE_H
+#define BATCH_MODE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "xorStream.h"
+
+
+/*
+ * Data structure to hold one file of a batch.
+ * The files are opened by the first worker that needs them and closed by the one finishing their last segment,
+ * so only the files being worked on are open, however many the batch has.
+ * state is 0 before the file is opened, 1 once it's open and -1 if it failed.
+ */
+typedef struct batchFile{
+    char* inputPath;
+    char* outputPath;
+    long size;
+    int inputFd;
+    int outputFd;
+    int state;
+    atomic_long pending;
+    pthread_mutex_t mutexFile;
+
+} batchFile;
+
+
+/*
+ * Data structure to hold a piece of a file: length bytes from offset (a multiple of the key size, since every file's
+ * block numbering starts at 0), up to the end of a chunk or the end of the file.
+ */
+typedef struct batchSegment{
+    long file;
+    long offset;
+    long length;
+
+} batchSegment;
+
+
+/*
+ * Data structure to hold a work unit: consecutive segments adding up to about a chunk.
+ * A big file is cut into chunk-sized units, small files (and the tails of big ones) are packed together.
+ */
+typedef struct batchUnit{
+    long firstSegment;
+    long segmentCount;
+
+} batchUnit;
+
+
+/*
+ * Data structure to hold what the threads of a batch share: the key, the files and the units they claim in turn.
+ */
+typedef struct batchJob{
+    const uint8_t* key;
+    long keySize;
+    KeyCache* keyCache;
+    long chunkSize;
+    batchFile* files;
+    long fileCount;
+    batchSegment* segments;
+    long segmentCount;
+    batchUnit* units;
+    long unitCount;
+    atomic_long nextUnit;
+    atomic_int failed;
+
+} batchJob;
+
+
+/*
+ * @brief List the files of a batch.
+ * A directory gives its regular files (not recursively), any other file is read as a list of paths, one per line.
+ * It is the caller's responsibility to free the paths and the array.
+ *
+ * @param [in] path     - The directory or the list file.
+ * @param [out] paths   - A pointer to store the allocated array of paths.
+ * @param [out] count   - A pointer to store the number of paths.
+ * @return Return 1 if successful, else 0.
+*/
+int listBatchFiles(const char* path, char*** paths, long* count);
+
+
+/*
+ * @brief Plan a batch: name the outputs, get the sizes and cut the files into segments and units.
+ * An input that isn't a regular file is reported and skipped (no segments, the job is marked failed for the end).
+ * Fails when two inputs would be written to the same output, or an output is its own input: the job is then
+ * released (paths included) and left empty. It is the caller's responsibility to release the job with batchJobFree().
+ *
+ * @param [out] job         - A pointer to the job to fill.
+ * @param [in] paths        - The input paths (the job takes them over).
+ * @param [in] count        - The number of paths.
+ * @param [in] outputDir    - The directory the outputs are written to, under the inputs' base names.
+ * @param [in] key          - The encryption key.
+ * @param [in] keySize      - The size of the key in bytes.
+ * @param [in] chunkSize    - The work unit size, a whole number of key blocks.
+ * @return Return 1 if successful, else 0.
+*/
+int planBatch(batchJob* job, char** paths, long count, const char* outputDir, const uint8_t* key, long keySize, long chunkSize);
+
+
+/*
+ * @brief Encrypt all the files of a planned batch with threadsNum threads plus the calling thread.
+ * The threads are created once for the whole batch, each with its own key cursor and buffer, and claim units in turn.
+ * A file that can't be read or written is reported and the others go on.
+ *
+ * @param [in] job          - A pointer to the planned job.
+ * @param [in] threadsNum   - The number of threads to create.
+ * @return Return 1 if every file was encrypted, else 0.
+*/
+int runBatch(batchJob* job, int threadsNum);
+
+
+/*
+ * @brief Release a job's files, segments and units.
+ *
+ * @param [in] job  - A pointer to the job.
+*/
+void batchJobFree(batchJob* job);
+
+
+/*
+ * @brief Encrypt many files in one run (--batch): list, plan and run the batch.
+ * Each file gets its own block numbering and rotation, so each output is the same as encrypting the file on its own.
+ *
+ * @param [in] listPath     - The directory or the list file (see listBatchFiles()).
+ * @param [in] outputDir    - The directory the outputs are written to.
+ * @param [in] key          - The encryption key.
+ * @param [in] keySize      - The size of the key in bytes.
+ * @param [in] keyCache     - The keystream period cache shared by the threads, or NULL.
+ * @param [in] chunkSize    - The work unit size, a whole number of key blocks.
+ * @param [in] threadsNum   - The number of threads to create.
+ * @return Return 1 if every file was encrypted, else 0.
+*/
+int encryptBatch(const char* listPath, const char* outputDir, const uint8_t* key, long keySize, KeyCache* keyCache, long chunkSize, int threadsNum);
+
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef BLOCK_POOL_H
+#define BLOCK_POOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+
+#include "queue.h"
+
+/*
+ * The number of free nodes each thread keeps for itself.
+ * Threads move nodes to/from the shared free list in batches of half that size, so the pool lock is taken once per batch.
+ */
+#define POOL_CACHE_SIZE 32
+
+/*
+ * The alignment of the data buffers. Page aligned buffers can be read into and spliced out whole pages at a time.
+ */
+#define POOL_ALIGNMENT 4096
+
+/*
+ * The size of a huge page (x86-64 and arm64 with 4K base pages). The buffer arena is aligned to it.
+ */
+#define POOL_HUGE_PAGE (2L * 1024 * 1024)
+
+/*
+ * How the slab's data buffers are backed (see BlockPool).
+ */
+#define POOL_PAGES_HEAP 0
+#define POOL_PAGES_THP 1
+#define POOL_PAGES_HUGETLB 2
+
+
+/*
+ * Data structure representing a pool of recycled blocks.
+ * Each node comes with a data buffer of blockSize bytes. Nodes are carved from a slab sized to the pipeline depth,
+ * and data buffers are allocated the first time their node is used, then kept with it forever.
+ * In steady state blocks go from the writer back to the reader without any heap traffic.
+ *
+ * The slab nodes' buffers are slices of one arena (stride bytes apart, page aligned), mapped up front but only
+ * touched on first use. The arena is made of explicit huge pages when some are reserved (vm.nr_hugepages), otherwise
+ * it's 2 MiB aligned and marked for transparent huge pages: a chunk then spans one or two TLB entries instead of
+ * dozens. pages tells which one it got. Nodes beyond the slab get their own buffer from the heap.
+ * lockMutex locks mutexPool, pthread_mutex_lock() unless the owner set its own (see poolSetLockHook()).
+ */
+typedef struct BlockPool {
+    long blockSize;
+    long depth;
+    Node* slab;
+    uint8_t* arena;
+    long arenaSize;
+    long stride;
+    int pages;
+    Node* freeList;
+    pthread_mutex_t mutexPool;
+    void (*lockMutex)(pthread_mutex_t* mutex);
+    atomic_long heapAllocations;
+    atomic_long acquired;
+    atomic_long recycled;
+    atomic_long inUse;
+    atomic_long peakInUse;
+} BlockPool;
+
+
+/*
+ * @brief Create a pool of blocks.
+ * The caller is responsible for freeing the allocated memory (see poolDestroy()).
+ * 
+ * @param [in] blockSize    - The size of the data buffer of each block.
+ * @param [in] depth        - The number of nodes in the slab, the number of blocks expected in flight at once.
+ * @return A pointer to the created pool if successful. Otherwise, returns NULL.
+*/
+BlockPool* createBlockPool(long blockSize, long depth);
+
+
+/*
+ * @brief Replace the function locking the pool's shared free list, e.g. to time the waits.
+ * Must be called before the pool is shared between threads.
+ *
+ * @param [in] pool         - A pointer to the pool.
+ * @param [in] lockMutex    - The function to lock the mutex with, NULL for pthread_mutex_lock().
+*/
+void poolSetLockHook(BlockPool* pool, void (*lockMutex)(pthread_mutex_t* mutex));
+
+
+/*
+ * @brief Get a free node with a data buffer of blockSize bytes.
+ * The node comes from the calling thread's cache, then from the shared free list; when both are empty a new one is allocated.
+ * 
+ * @param [in] pool     - A pointer to the pool.
+ * @return A pointer to the node, or NULL if an allocation failed.
+*/
+Node* poolAcquire(BlockPool* pool);
+
+
+/*
+ * @brief Give a node (and its data buffer) back to the pool.
+ * 
+ * @param [in] pool     - A pointer to the pool.
+ * @param [in] node     - A pointer to a node acquired from the same pool.
+*/
+void poolRelease(BlockPool* pool, Node* node);
+
+
+/*
+ * @brief Move the calling thread's cached nodes back to the shared free list.
+ * Threads should call it before they exit, so the nodes can be reused (and freed by poolDestroy()).
+ * 
+ * @param [in] pool     - A pointer to the pool.
+*/
+void poolFlushCache(BlockPool* pool);
+
+
+/*
+ * @brief Print the pool's allocation counters and the process peak RSS to stderr.
+ * 
+ * @param [in] pool     - A pointer to the pool.
+*/
+void poolReport(BlockPool* pool);
+
+
+/*
+ * @brief Free the pool, its slab and all the data buffers.
+ * All the nodes must have been released and all the thread caches flushed.
+ * 
+ * @param [in] pool     - A pointer to the pool.
+*/
+void poolDestroy(BlockPool* pool);
+
+
+#endif
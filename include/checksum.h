@@ -0,0 +1,57 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+
+/*
+ * The CRC32C (Castagnoli) polynomial, reflected.
+ */
+#define CRC32C_POLY 0x82F63B78U
+
+/*
+ * The lane sizes of the hardware CRC: long buffers are split in three lanes of CRC32C_LONG bytes (then CRC32C_SHORT)
+ * computed at once, the crc32 instruction's latency is three times its throughput. The lanes are joined by shifting
+ * their CRCs over the bytes after them, with a table per size (four lookups).
+ */
+#define CRC32C_LONG 8192
+#define CRC32C_SHORT 256
+
+
+/*
+ * @brief Continue a CRC32C over more data. Starting from 0, the result is the standard CRC32C of the data
+ * (the same as iSCSI, ext4, or `crc32c` tools), so crc32cUpdate(crc32cUpdate(0, a), b) is the CRC32C of a then b.
+ * Uses the SSE4.2 crc32 instruction when the CPU has it, tables otherwise. The function is thread-safe.
+ *
+ * @param [in] crc      - The CRC32C of the data before, 0 for none.
+ * @param [in] data     - The data.
+ * @param [in] length   - The size of the data in bytes.
+ * @return The CRC32C of the data before followed by this data.
+*/
+uint32_t crc32cUpdate(uint32_t crc, const uint8_t* data, long length);
+
+
+/*
+ * @brief Combine the CRC32C of two consecutive pieces of data into the CRC32C of both, without the data.
+ * Pieces encrypted in any order can be checksummed separately and combined in stream order.
+ *
+ * @param [in] first        - The CRC32C of the first piece.
+ * @param [in] second       - The CRC32C of the second piece.
+ * @param [in] secondLength - The size of the second piece in bytes.
+ * @return The CRC32C of the first piece followed by the second.
+*/
+uint32_t crc32cCombine(uint32_t first, uint32_t second, long secondLength);
+
+
+/*
+ * @brief Build the tables and pick the implementation (hardware or tables) used by crc32cUpdate().
+ * Meant to be called once at startup, before any thread starts checksumming. The first crc32cUpdate() call does it otherwise.
+ *
+ * @return The name of the implementation ("sse4.2" or "table").
+*/
+const char* crc32cInit();
+
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+#include <endian.h>
+#include <sys/stat.h>
+
+#include "xorStream.h"
+#include "checksum.h"
+
+/*
+ * The container format (--container), all fields little-endian:
+ *
+ *   header      64 bytes: magic, version, key fingerprint, key size, chunk size, total bytes and chunks
+ *   chunk 0     24-byte frame (chunk number, length, CRC32C of the payload), then the payload
+ *   chunk 1     ...
+ *   index       one 24-byte entry per chunk, the same as its frame (with CONTAINER_ENTRY_MAGIC)
+ *   footer      32 bytes: where the index starts, the number of chunks and the total bytes
+ *
+ * Every chunk holds chunkSize bytes of ciphertext but the last one, so chunk n is at a fixed offset and is encrypted
+ * from key block n * chunkSize / keySize: any chunk can be decrypted on its own, in any order, by any thread or process.
+ * The totals are only known at the end. They're written in the footer, and patched into the header when the output
+ * is seekable (CONTAINER_UNKNOWN otherwise). A container cut short (a crash) is still readable up to its last
+ * complete chunk, and the frames are enough to find them without the index.
+ */
+#define CONTAINER_MAGIC "XORCTNR1"
+#define CONTAINER_VERSION 2
+#define CONTAINER_CHUNK_MAGIC 0x4B4E4358U
+#define CONTAINER_ENTRY_MAGIC 0x544E4558U
+#define CONTAINER_FOOTER_MAGIC 0x58444958U
+#define CONTAINER_UNKNOWN UINT64_MAX
+
+/*
+ * The largest chunk a frame can describe (its length is 32 bits).
+ */
+#define CONTAINER_MAX_CHUNK 0xFFFFFFFFL
+
+
+/*
+ * Data structure of the container header, at the start of the container.
+ * The key fingerprint tells which key a container was made with: 64 bits of a SHA-256 of the key, see keyFingerprint().
+ */
+typedef struct containerHeader{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t keyFingerprint;
+    uint64_t keySize;
+    uint64_t chunkSize;
+    uint64_t totalBytes;
+    uint64_t totalChunks;
+    uint64_t reserved;
+
+} containerHeader;
+
+
+/*
+ * Data structure of a chunk frame (before each chunk's payload), and of an index entry.
+ * cipherCrc is the CRC32C of the payload as stored. There's no CRC of the plaintext: XORed with cipherCrc it would be
+ * the CRC of the keystream, a linear function of the key bits.
+ */
+typedef struct containerChunk{
+    uint32_t magic;
+    uint32_t length;
+    uint64_t number;
+    uint32_t cipherCrc;
+    uint32_t reserved;
+
+} containerChunk;
+
+
+/*
+ * Data structure of the container footer, the last bytes of a complete container.
+ */
+typedef struct containerFooter{
+    uint32_t magic;
+    uint32_t indexCrc;
+    uint64_t indexOffset;
+    uint64_t totalChunks;
+    uint64_t totalBytes;
+
+} containerFooter;
+
+
+/*
+ * Data structure to hold the index of a container being written: the frames of the chunks written so far, in order
+ * (host byte order). Only the thread writing the chunks adds to it.
+ */
+typedef struct ContainerIndex{
+    containerChunk* entries;
+    long count;
+    long capacity;
+    long bytes;
+
+} ContainerIndex;
+
+
+/*
+ * @brief Fill a header for a new container (totals unknown).
+ *
+ * @param [out] header      - A pointer to the header, in host byte order.
+ * @param [in] key          - The encryption key.
+ * @param [in] keySize      - The size of the key in bytes.
+ * @param [in] chunkSize    - The payload size of the chunks, a whole number of key blocks.
+*/
+void containerInitHeader(containerHeader* header, const uint8_t* key, long keySize, long chunkSize);
+
+
+/*
+ * @brief Write a header at the current position of a file descriptor.
+ *
+ * @param [in] fd       - The file descriptor.
+ * @param [in] header   - A pointer to the header, in host byte order.
+ * @return Return 1 if successful, else 0.
+*/
+int containerWriteHeader(int fd, const containerHeader* header);
+
+
+/*
+ * @brief Add the next chunk to the index and fill its frame, ready to be written before the payload.
+ *
+ * @param [in,out] index    - A pointer to the index.
+ * @param [in] length       - The payload size in bytes.
+ * @param [in] cipherCrc    - The CRC32C of the payload (ciphertext).
+ * @param [out] frame       - A pointer to store the frame, in file byte order.
+ * @return Return 1 if successful, else 0 (allocation failure).
+*/
+int containerAddChunk(ContainerIndex* index, long length, uint32_t cipherCrc, containerChunk* frame);
+
+
+/*
+ * @brief Finish a container: write the index and the footer at the current position of fd, then patch the totals
+ * into the header at base when fd is seekable.
+ *
+ * @param [in] fd       - The file descriptor the container is written to.
+ * @param [in] base     - The offset of the header in fd, -1 if fd isn't seekable.
+ * @param [in] header   - A pointer to the header (host byte order), its totals are set.
+ * @param [in] index    - A pointer to the index of every chunk.
+ * @return Return 1 if successful, else 0.
+*/
+int containerFinish(int fd, long base, containerHeader* header, const ContainerIndex* index);
+
+
+/*
+ * @brief Pick up an interrupted container (--resume): check that the header at the start of fd was made with the
+ * same key and chunk size, then verify the chunks in order (frame and payload CRC) up to the first missing or damaged
+ * one. The verified chunks go to the index, the rest of the file is cut off, and fd is positioned after them.
+ * An empty file (or the start of the header) is a new container: the header is written and no chunk is verified.
+ *
+ * @param [in] fd           - The file descriptor of the container (a regular file, opened for reading and writing).
+ * @param [in] header       - A pointer to the header the container must have (host byte order).
+ * @param [out] index       - A pointer to an empty index, to store the verified chunks.
+ * @param [out] complete    - A pointer to store 1 if the container was already complete (its index and footer stay), else 0.
+ * @return The number of verified chunks, -1 on error (another key or chunk size, I/O error).
+*/
+long containerResume(int fd, const containerHeader* header, ContainerIndex* index, int* complete);
+
+
+/*
+ * @brief Release an index.
+ *
+ * @param [in] index    - A pointer to the index.
+*/
+void containerIndexFree(ContainerIndex* index);
+
+
+/*
+ * @brief Decrypt a container from stdin to stdout (--extract).
+ * The header must match the key (see keyFingerprint in containerHeader). Each chunk's payload is checked against its
+ * CRC before it's decrypted: a damaged chunk is reported instead of written.
+ * When both sides are regular files, threadsNum threads plus the calling thread claim chunks from the index and
+ * decrypt them with pread()/pwrite() at their own offsets, in any order. The output then isn't truncated first:
+ * with resume, a chunk whose plaintext is already there (it encrypts back to the payload's CRC) is skipped, and first/last restricts the work to
+ * those chunks, so several processes can share a container. Otherwise the chunks are read and written in order.
+ * A container without its index (cut short) is decrypted up to its last complete chunk, with a warning.
+ *
+ * @param [in] key          - The encryption key.
+ * @param [in] keySize      - The size of the key in bytes.
+ * @param [in] keyCache     - The keystream period cache, or NULL.
+ * @param [in] threadsNum   - The number of threads to create (regular files only).
+ * @param [in] first        - The first chunk to decrypt.
+ * @param [in] last         - The last chunk to decrypt, -1 for the last one of the container.
+ * @param [in] resume       - Skip the chunks already decrypted in the output.
+ * @return Return 1 if every chunk was decrypted, else 0.
+*/
+int extractContainer(const uint8_t* key, long keySize, KeyCache* keyCache, int threadsNum, long first, long last, int resume);
+
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef DAEMON_PROTOCOL_H
+#define DAEMON_PROTOCOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+/*
+ * The framed protocol of the daemon (--serve), over a Unix domain stream socket.
+ * Every message is a daemonHeader followed by length bytes of payload. Both ends are on the same host, so the
+ * header is in host byte order.
+ *
+ * A connection is one stream: the client sends DATA frames with the next bytes of the stream and gets back a frame
+ * with the encrypted bytes (up to keySize - 1 bytes of a partial key block are held back until the next frame, like
+ * xorStreamUpdate()). A FINAL frame (empty) ends the stream: the reply holds the held back bytes, and the next DATA
+ * frame starts a new stream at block 0. Replies come back in request order, one per request.
+ */
+#define DAEMON_FRAME_DATA 1
+#define DAEMON_FRAME_FINAL 2
+
+/*
+ * The status of a reply (in its type field). An error reply carries a message, the daemon then closes the connection.
+ */
+#define DAEMON_STATUS_OK 0
+#define DAEMON_STATUS_ERROR 1
+
+/*
+ * The largest DATA payload the daemon accepts. Bigger streams are sent in several frames.
+ */
+#define DAEMON_MAX_FRAME (1024 * 1024)
+
+
+typedef struct daemonHeader{
+    uint32_t type;
+    uint32_t length;
+
+} daemonHeader;
+
+
+/*
+ * @brief Read exactly length bytes from a socket (retrying on short reads and EINTR).
+ *
+ * @param [in] fd       - The socket.
+ * @param [out] buffer  - Where to store the bytes.
+ * @param [in] length   - The number of bytes to read.
+ * @return Return 1 if all the bytes were read, 0 on end of stream before any byte, -1 on error or a cut frame.
+*/
+int daemonReadFull(int fd, void* buffer, long length);
+
+
+/*
+ * @brief Send a frame: its header and its payload with a single sendmsg() when possible (never raises SIGPIPE).
+ *
+ * @param [in] fd       - The socket.
+ * @param [in] type     - The frame type (or the reply status).
+ * @param [in] payload  - The payload (may be NULL when length is 0).
+ * @param [in] length   - The size of the payload in bytes.
+ * @return Return 1 if successful, else 0.
+*/
+int daemonSendFrame(int fd, uint32_t type, const void* payload, long length);
+
+
+/*
+ * @brief Connect to a daemon.
+ *
+ * @param [in] path     - The path of the daemon's socket.
+ * @return The connected socket, or -1 on failure.
+*/
+int daemonConnect(const char* path);
+
+
+#endif
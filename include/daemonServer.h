@@ -0,0 +1,112 @@
+#ifndef DAEMON_SERVER_H
+#define DAEMON_SERVER_H
+
+// epoll, accept4 - must come before any system header
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "xorStream.h"
+#include "daemonProtocol.h"
+
+/*
+ * The number of events a worker takes from epoll at once.
+ */
+#define DAEMON_EVENTS 16
+
+/*
+ * The longest a worker waits for the rest of a frame that started arriving, in seconds.
+ * A client stalling in the middle of a frame is dropped instead of holding the worker.
+ */
+#define DAEMON_FRAME_TIMEOUT 5
+
+
+/*
+ * Data structure to hold one client connection: its socket and its stream (block counter and held back bytes).
+ * Connections are registered with EPOLLONESHOT, so only one worker at a time serves a connection.
+ */
+typedef struct daemonClient{
+    int fd;
+    XorStream* stream;
+
+} daemonClient;
+
+
+/*
+ * Data structure to hold what the daemon's workers share.
+ * stopFd is an eventfd (level triggered in epoll) that wakes every worker when the daemon stops.
+ */
+typedef struct daemonServer{
+    const uint8_t* key;
+    long keySize;
+    KeyCache* keyCache;
+    int listenFd;
+    int epollFd;
+    int stopFd;
+    atomic_long clients;
+    atomic_long requests;
+
+} daemonServer;
+
+
+/*
+ * Data structure to hold the buffers of one worker, allocated once when the worker starts.
+ */
+typedef struct daemonWorker{
+    daemonServer* server;
+    uint8_t* input;
+    uint8_t* output;
+
+} daemonWorker;
+
+
+/*
+ * @brief Create the daemon's listening socket. A stale socket file (nobody accepting on it) is replaced.
+ *
+ * @param [in] path     - The path of the socket.
+ * @return The listening socket, or -1 on failure.
+*/
+int daemonListen(const char* path);
+
+
+/*
+ * @brief Serve one frame of a client: read it, encrypt it with the client's stream and send the reply.
+ *
+ * @param [in] worker   - A pointer to the worker (its buffers).
+ * @param [in] client   - A pointer to the client.
+ * @return Return 1 if the connection stays open, 0 if it must be closed (end of stream or error).
+*/
+int daemonServeFrame(daemonWorker* worker, daemonClient* client);
+
+
+/*
+ * @brief Run the daemon (--serve): listen on the socket and serve clients with threadsNum workers until SIGINT or SIGTERM.
+ * The key is loaded once, the workers and their buffers are set up once. Every connection gets its own stream.
+ *
+ * @param [in] path         - The path of the socket.
+ * @param [in] key          - The encryption key.
+ * @param [in] keySize      - The size of the key in bytes.
+ * @param [in] keyCache     - The keystream period cache shared by the streams, or NULL.
+ * @param [in] threadsNum   - The number of worker threads (at least 1).
+ * @return Return 1 if the daemon stopped cleanly, else 0.
+*/
+int runDaemon(const char* path, const uint8_t* key, long keySize, KeyCache* keyCache, int threadsNum);
+
+
+#endif
@@ -1,6 +1,11 @@
 #ifndef ENCRYPT_UTIL_H
 #define ENCRYPT_UTIL_H
 
+// Linux specific I/O (IOV_MAX, and later splice/vmsplice, affinity) - must come before any system header
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 /*
  * The number of threads per CPU core (assumption).
  * This constant determines the maximum number of threads that can be created based on the available CPU cores.
@@ -8,12 +13,81 @@
  */
 #define THREADS_PER_CORE 4
 
+/*
+ * The number of worker threads per CPU core created with -n auto.
+ * Only some of them are active at a time, the tuner picks how many (see autoTune.h).
+ */
+#define AUTO_THREADS_PER_CORE 2
+
 /*
  * The maximum size of the queue.
- * This constant defines the maximum number of elements that can be stored in the toEncrypt queue.
+ * This constant defines the maximum number of elements that can be stored in the toEncrypt queues (split between the workers).
  */
 #define MAX_QUEUE_SIZE 512
 
+/*
+ * The maximum size of the reorder window.
+ * This constant defines the maximum number of chunks in flight (read but not yet written) at any time.
+ * It must be larger than MAX_QUEUE_SIZE so the toEncrypt queue can fill up before the reader waits for the writer.
+ */
+#define REORDER_WINDOW (2 * MAX_QUEUE_SIZE)
+
+/*
+ * The high-water mark of the toEncrypt queue.
+ * When the queue holds that many chunks, the main thread stops reading and waits for the workers to make room.
+ */
+#define HIGH_WATER_MARK (3 * MAX_QUEUE_SIZE / 4)
+
+/*
+ * The number of empty rounds a worker spins before parking.
+ * Short idle gaps are common when the pipeline is busy, parking and waking up costs a couple of syscalls.
+ */
+#define SPIN_ROUNDS 128
+
+/*
+ * The maximum number of consecutive blocks the writer flushes with a single writev().
+ */
+#define MAX_WRITE_BATCH 1024
+
+/*
+ * The default size of a work unit (chunk), rounded up to a whole number of key-sized blocks.
+ * Big enough that queue, lock and rotation overhead is negligible next to the XOR, even with tiny keys.
+ */
+#define DEFAULT_CHUNK_SIZE (256 * 1024)
+
+/*
+ * The amount of data the pipeline tries to keep in flight (read but not yet written).
+ * The reorder window, in chunks, is derived from it (but never more than REORDER_WINDOW chunks).
+ */
+#define PIPELINE_BYTES (64L * 1024 * 1024)
+
+/*
+ * The pipe size requested on stdout when the output is spliced (the kernel may keep a smaller one).
+ */
+#define SPLICE_PIPE_SIZE (1024 * 1024)
+
+/*
+ * The io_uring engine limits: reads and writes in flight at once when the file is seekable (pipes get one at a time).
+ * URING_QUEUE_DEPTH is the size of the submission ring, it must hold all of them plus the wakeup read.
+ */
+#define URING_MAX_READS 8
+#define URING_MAX_WRITES 8
+#define URING_QUEUE_DEPTH 32
+
+/*
+ * The kind of request a completion belongs to, stored in the upper half of its user_data (the lower half is the buffer index).
+ */
+#define URING_OP_READ 1
+#define URING_OP_WRITE 2
+#define URING_OP_WAKE 3
+
+/*
+ * What --checksum digests: nothing, the output (the bytes written) or the input (the bytes read).
+ */
+#define CHECKSUM_OFF 0
+#define CHECKSUM_OUTPUT 1
+#define CHECKSUM_INPUT 2
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
@@ -21,29 +95,152 @@
 #include <inttypes.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sched.h>
 
 #include "queue.h"
+#include "lfQueue.h"
+#include "workQueues.h"
+#include "autoTune.h"
+#include "batchMode.h"
+#include "daemonServer.h"
+#include "eventCount.h"
+#include "blockPool.h"
+#include "xorKernel.h"
+#include "xorStream.h"
+#include "uring.h"
+#include "pipelineStats.h"
+#include "checksum.h"
+#include "container.h"
+
+/*
+ * Data structure to hold the input and output files when both are mapped in memory.
+ * size is -1 when the files are streamed through stdin/stdout instead.
+ */
+typedef struct mappedFiles{
+    const uint8_t* input;
+    uint8_t* output;
+    long size;
+
+} mappedFiles;
+
 
 /*
  * Data structure to hold thread-specific data.
  * This struct contains the data needed by each thread during the encryption process.
+ * Idle workers park on workEvent, the writer on writeEvent, and the main thread parks on spaceEvent when it must stop reading.
+ * totalBlocks is the number of chunks read, valid once finishFlag is set. Nodes carry chunk numbers, not key-block numbers.
+ * pipeSize is the size of the stdout pipe when the writer uses vmsplice, 0 when it uses writev.
+ * wakeFd is an eventfd the workers signal when the next chunk to write is ready, for the io_uring engine (-1 otherwise).
+ * With --affinity, cpus lists the CPUs to pin the workers to, in NUMA node order (cpuCount is 0 otherwise), and
+ * placedWorkers counts the workers done placing their share of the pool buffers on their own node.
+ * With -n auto, tuner is the reader's throughput tuner (NULL otherwise): only the first activeWorkers workers run,
+ * the others park on tuneEvent until the tuner wants them or the input ends.
+ * With --checksum, the workers store the CRC32C of each chunk (input or output side) in its node while it's still in
+ * their cache, and the writer (or the io_uring engine) combines them in order into digest, over digestBytes bytes.
+ * With --container, container is the index of the chunks written: the workers checksum both sides of each chunk, and the
+ * writer puts a frame before each one (see container.h). firstChunk is the number of chunks a --resume skipped, the
+ * chunk read as blockNum is encrypted as chunk firstChunk + blockNum.
  */
 typedef struct threadData{
-    Queue* toEncrypt;
-    Queue* toWrite;
+    WorkQueues* toEncrypt;
+    ReorderBuffer* toWrite;
+    BlockPool* pool;
     uint8_t* key;
     long keySize;
-    long blockNumber;
-    int finishFlag;
+    KeyCache* keyCache;
+    long blocksPerChunk;
+    int pipeSize;
+    int wakeFd;
+    int* cpus;
+    int cpuCount;
+    atomic_int placedWorkers;
+    AutoTuner* tuner;
+    atomic_int activeWorkers;
+    atomic_int finishFlag;
+    atomic_long totalBlocks;
+    int checksum;
+    uint32_t digest;
+    long digestBytes;
+    ContainerIndex* container;
+    long firstChunk;
+    EventCount workEvent;
+    EventCount spaceEvent;
+    EventCount writeEvent;
+    EventCount tuneEvent;
 
 } threadData;
 
 
+/*
+ * Data structure to hold the data private to one worker (a thread, or the main thread when it helps).
+ * Its key cursor keeps the rotated key of the last block the worker encrypted (see xorStream.h).
+ * id is the worker's own toEncrypt queue (the main thread shares queue 0).
+ */
+typedef struct workerData{
+    threadData* shared;
+    KeyCursor cursor;
+    int id;
+
+} workerData;
+
+
+/*
+ * Data structure to hold the state of one buffer of the io_uring engine (registered with the ring at the same index).
+ * done is the number of bytes already read into it, or written from it, when a request came back short.
+ */
+typedef struct uringBuffer{
+    Node* node;
+    long chunk;
+    long length;
+    long done;
+
+} uringBuffer;
+
+
+/*
+ * Data structure to hold the command-line options.
+ * Filled by processInput(), optional options keep their default value when not given.
+ */
+typedef struct programOptions{
+    int threads;
+    int autoThreads;
+    char* keyPath;
+    const char* kernel;
+    int allocStats;
+    long chunkSize;
+    char* inputPath;
+    char* outputPath;
+    const char* ioMode;
+    int stats;
+    long rangeOffset;
+    long rangeLength;
+    int affinity;
+    char* batchPath;
+    char* servePath;
+    long keyCacheBytes;
+    int checksum;
+    char* checksumPath;
+    int container;
+    int extract;
+    int resume;
+    long chunkFirst;
+    long chunkLast;
+
+} programOptions;
+
+
 /*
  * @brief Reads the encryption key from the specified key file.
- * This function reads the contents of a key file specified by the filename and returns
- * the encryption key as a dynamically allocated uint8_t array.
- * It is the caller's responsibility to free the memory allocated for the key array.
+ * This function maps the key file (a non-empty regular file) read-only in memory and returns it as a uint8_t array,
+ * so even a huge key costs no copy and no heap: all the threads read the page cache's pages.
+ * It is the caller's responsibility to release the array (see releaseKey()). The array must not be written to.
  * 
  * @param [in] filename      - The path to the key file. If it is a relative path, it is relative to the current working directory.
  * @param [out] fileSize     - A pointer to store the size of the key file in bytes.
@@ -53,47 +250,60 @@ uint8_t* readKeyFile(const uint8_t* filename, long* fileSize);
 
 
 /*
- * @brief Rotates the bits of the encryption key by the specified amount (in place). 
- * It performs a left shift operation on the bits of the encryption key and rolling the LMB to be the RMB.
- *
- * @param [in,out] key  - The unsigned char array of the encryption key to be rotated.
- * @param [in] amount    - The number of times to left-shift the bits of the key.
- * @param [in] size      - The size of the encryption key in bytes.
+ * @brief Release a key returned by readKeyFile().
+ * 
+ * @param [in] key          - The key array, or NULL.
+ * @param [in] keySize      - The size of the key in bytes.
+*/
+void releaseKey(uint8_t* key, long keySize);
+
+
+/*
+ * @brief Writes the encrypted data to the standard output (stdout).
+ * The data goes straight to file descriptor 1, without stdio buffering.
+ * 
+ * @param [in] encrypted     - A pointer to the block of encrypted data.
+ * @param [in] length        - The size of the encrypted data in bytes.
+ * @return Return 1 if all the data was written, else 0.
 */
-void rotateKey(uint8_t* key, long amount, long size);
+int writeEncrypted(const uint8_t* encrypted, long legnth);
 
 
 /*
- * @brief Rotates the encryption key left by one bit.
- * The leftmost bit is rolled over to become the rightmost bit.
- *
- * @param [in,out] key  - A char array containing the encryption key.
- * @param [in] size      - The size of the encryption key in bytes.
+ * @brief Writes several blocks of encrypted data to the standard output (stdout) with as few writev() calls as possible.
+ * Partial writes are resumed where they stopped. The iovec array is modified.
+ * 
+ * @param [in,out] iov      - An array of iovec, one per block, in output order.
+ * @param [in] count        - The number of entries in the array.
+ * @return Return 1 if all the data was written, else 0.
 */
-void leftShiftKey(uint8_t* key, long size);
+int writeEncryptedBatch(struct iovec* iov, int count);
 
 
 /*
- * @brief Performs XOR encryption on a block of data using the provided encryption key.
+ * @brief Hands several blocks of encrypted data to the stdout pipe with vmsplice(), without copying them.
+ * The pipe references the blocks' pages until its reader consumes them, the caller must not modify them meanwhile.
+ * Partial writes are resumed where they stopped. The iovec array is modified.
  * 
- * @param [in,out] text     - An unsigned char pointer to the block of data to be encrypted.
- * @param [in] key          - An unsigned char pointer of the encryption key.
- * @param [in] blockSize    - The size of the block to be encrypted.
+ * @param [in,out] iov      - An array of iovec, one per block, in output order.
+ * @param [in] count        - The number of entries in the array.
+ * @return Return 1 if all the data was spliced, 0 on error, -1 if vmsplice isn't usable (nothing was written, use writev).
 */
-void encryptBlock(uint8_t* text, const uint8_t* key, long blockSize);
+int spliceEncryptedBatch(struct iovec* iov, int count);
 
 
 /*
- * @brief Writes the encrypted data to the standard output (stdout).
+ * @brief Decide if the writer should vmsplice to stdout (--io=splice and stdout is a pipe), and enlarge the pipe if so.
  * 
- * @param [in] encrypted     - A pointer to the block of encrypted data.
- * @param [in] length        - The size of the encrypted data in bytes.
+ * @param [in] ioMode   - The I/O mode given with --io ("auto", "splice", "rw" or "uring").
+ * @return The size of the stdout pipe if the output should be spliced, else 0.
 */
-void writeEncrypted(const uint8_t* encrypted, long legnth);
+int setupSpliceOutput(const char* ioMode);
 
 
 /*
  * @brief Reads plaintext data, in specified block size, from the standard input (stdin) into an array.
+ * The data is read straight from file descriptor 0 with read(), until the array is full or the input ends.
  * 
  * @param [out] input    - A pointer to a block-sized char array to store the input data.
  * @param [in] length    - The size of the input data in bytes.
@@ -103,24 +313,241 @@ long readInput(uint8_t* input, long length);
 
 
 /*
- * @brief The thread function responsible for encrypting data, rotating the key, and writing it to stdout.
- * The function will continue running until both the toEncrypt and toWrite queues are empty and main thread indictes it finished to read from stdin.
+ * @brief The reader loop of the regular pipeline: reads stdin chunk by chunk into pool blocks and queues them for the workers.
+ * It stops reading when the reorder window or toEncrypt is full, and does the encryption itself when there are no workers.
+ * Returns once the input ended and finishFlag is set.
  * 
- * @param [in] arg  - A pointer to a threadData structure containing the necessary data for the thread.
+ * @param [in] thData       - A pointer to the threadData structure shared with the workers and the writer.
+ * @param [in] threadsNum   - The number of worker threads.
+ * @param [in] mainWorker   - A pointer to the main thread's worker data.
+ * @return Return 1 if successful, else 0.
+*/
+int streamInput(threadData* thData, int threadsNum, workerData* mainWorker);
+
+
+/*
+ * @brief The io_uring engine: runs both the read and the write stage on one ring, in place of streamInput() and the writer thread.
+ * Regular files are read and written at explicit offsets with several requests in flight, pipes one request at a time.
+ * The buffers are taken from the pool once and registered with the ring (plain reads/writes if registering fails).
+ * The workers signal thData->wakeFd when the next chunk to write is ready, so a single wait covers the I/O and the encryption.
+ * Returns once everything was written.
+ * 
+ * @param [in] thData       - A pointer to the threadData structure shared with the workers (wakeFd must be an eventfd).
+ * @param [in] ring         - A pointer to an initialized ring.
+ * @param [in] threadsNum   - The number of worker threads.
+ * @param [in] mainWorker   - A pointer to the main thread's worker data (encrypts when there are no workers).
+ * @return Return 1 if successful, else 0.
+*/
+int uringPipeline(threadData* thData, Uring* ring, int threadsNum, workerData* mainWorker);
+
+
+/*
+ * @brief Initialize the private data of a worker.
+ * It is the caller's responsibility to release it with freeWorker().
+ * 
+ * @param [out] worker  - A pointer to the workerData structure to initialize.
+ * @param [in] thData   - A pointer to the threadData structure shared by all the workers.
+ * @param [in] id       - The worker's number, its own toEncrypt queue.
+ * @return Return 1 if successful, else 0.
+*/
+int initWorker(workerData* worker, threadData* thData, int id);
+
+
+/*
+ * @brief List the CPUs the process may run on, grouped by NUMA node (node 0's CPUs first, then node 1's...).
+ * Consecutive workers pinned in this order share a node until it's full. Without NUMA information, it's the plain CPU order.
+ * It is the caller's responsibility to free the list.
+ * 
+ * @param [out] cpus    - A pointer to store the allocated list.
+ * @return The number of CPUs in the list, 0 on failure.
+*/
+int listNumaCpus(int** cpus);
+
+
+/*
+ * @brief Pin the calling worker to its CPU and place its share of the pool's data buffers on its NUMA node.
+ * The buffers are first touched by the worker (Linux allocates a page on the node of the thread touching it first)
+ * and tagged with its id, so the reader queues the chunks read into them to this worker.
+ * Signals spaceEvent once done, the reader waits for all the workers to be placed before reading.
+ * 
+ * @param [in] worker   - A pointer to the worker's data (thData->cpus must be set).
+ * @return Return 1 if successful, else 0.
+*/
+int placeWorker(workerData* worker);
+
+
+/*
+ * @brief Release the private data of a worker.
+ * 
+ * @param [in] worker   - A pointer to the workerData structure to release.
+*/
+void freeWorker(workerData* worker);
+
+
+/*
+ * @brief Feed the -n auto tuner with the bytes just read, and apply the number of active workers it picks.
+ * The reader's throughput is the pipeline's (it's held back when any stage lags behind). The level is logged to
+ * stderr every time the tuner settles on a new one. Does nothing without a tuner.
+ * 
+ * @param [in] thData   - A pointer to the threadData structure.
+ * @param [in] bytes    - The number of bytes read since the last call.
+*/
+void tuneWorkers(threadData* thData, long bytes);
+
+
+/*
+ * @brief Encrypt a chunk of consecutive key-sized blocks.
+ * Each block is XORed with the key rotated for its own block number, so the output is the same whatever the chunk size.
+ * 
+ * @param [in] worker       - A pointer to the worker's data (holds the rotated key).
+ * @param [out] dest        - Where to store the encrypted chunk. May be the same buffer as src (in place).
+ * @param [in] src          - The chunk of data to be encrypted.
+ * @param [in] length       - The size of the chunk in bytes. Only the last block may be shorter than the key.
+ * @param [in] firstBlock   - The block number of the first key-sized block of the chunk.
+*/
+void encryptChunk(workerData* worker, uint8_t* dest, const uint8_t* src, long length, long firstBlock);
+
+
+/*
+ * @brief Do one round of work: encrypt one chunk if any and put it in the reorder buffer for the writer.
+ * 
+ * @param [in] worker   - A pointer to the worker's data.
+ * @return Return 1 if some work was done, 0 if there was nothing to do, -1 on error.
+*/
+int processStep(workerData* worker);
+
+
+/*
+ * @brief Run the worker loop until the pipeline is drained.
+ * The worker calls processStep() while there's work, spins for SPIN_ROUNDS empty rounds, and then parks on the
+ * workEvent until a block is enqueued. A worker the tuner doesn't want parks on tuneEvent instead.
+ * 
+ * @param [in] worker   - A pointer to the worker's data.
+ * @return Return 1 if the pipeline was drained, 0 on error.
+*/
+int runWorker(workerData* worker);
+
+
+/*
+ * @brief The thread function responsible for encrypting data and rotating the key.
+ * The function will continue running until the toEncrypt queues are empty and main thread indictes it finished to read from stdin.
+ * 
+ * @param [in] arg  - A pointer to the thread's workerData structure, with shared and id set (initialized by the thread).
  * @return NULL
 */
 void* threadFunction(void* arg);
 
+
+/*
+ * @brief The thread function of the writer, the only thread writing to stdout.
+ * It collects every consecutive encrypted block ready in the toWrite reorder buffer and flushes them with a single writev().
+ * The function will continue running until all the blocks read by the main thread were written.
+ * 
+ * @param [in] arg  - A pointer to a threadData structure containing the necessary data for the thread.
+ * @return NULL
+*/
+void* writerFunction(void* arg);
+
+
+/*
+ * @brief Print the --checksum digest: the CRC32C of the whole output (or input) stream, combined from the chunks'.
+ * The line ("crc32c <8 hex digits> <bytes> output|input") goes to the sidecar file given with --checksum-file, or to stderr.
+ * 
+ * @param [in] options  - A pointer to the program options.
+ * @param [in] digest   - The CRC32C of the stream.
+ * @param [in] bytes    - The size of the stream in bytes.
+ * @return Return 1 if successful, else 0.
+*/
+int reportChecksum(const programOptions* options, uint32_t digest, long bytes);
+
+
+/*
+ * @brief Open the files given with -i and -o.
+ * When both are regular files, the output is sized like the input and both are mapped in memory (files->size >= 0).
+ * Otherwise, or when only a range, a checksum, a container or the stats are requested, they replace stdin/stdout (dup2) and are streamed (files->size is -1).
+ * 
+ * @param [in] options  - A pointer to the program options.
+ * @param [out] files   - A pointer to a mappedFiles structure to store the mappings.
+ * @return Return 1 if successful, else 0.
+*/
+int openFiles(const programOptions* options, mappedFiles* files);
+
+
+/*
+ * @brief Encrypt the mapped input into the mapped output with threadsNum threads plus the main thread, then unmap them.
+ * The work is done by xorStreamProcessBuffer(), the files are just one big in-memory message.
+ * 
+ * @param [in] stream       - A pointer to the streaming context holding the key.
+ * @param [in] files        - A pointer to the mapped files.
+ * @param [in] threadsNum   - The number of threads to create.
+ * @param [in] chunkSize    - The work unit size in bytes.
+ * @return Return 1 if successful, else 0.
+*/
+int encryptMapped(const XorStream* stream, mappedFiles* files, int threadsNum, long chunkSize);
+
+
+/*
+ * @brief Encrypt (or decrypt) only the bytes [offset, offset + length) of the stdin stream, to stdout.
+ * Rotation only depends on the block number, so the work starts at the key block containing offset: the key is
+ * rotated once for it and only the blocks overlapping the range are read and XORed.
+ * A seekable input is read at that position with pread() (nothing before it is touched). Otherwise the bytes
+ * before it are read and dropped. The block at the end of the input keeps its short-block rotation.
+ * 
+ * @param [in] key          - The encryption key.
+ * @param [in] keySize      - The size of the key in bytes.
+ * @param [in] keyCache     - The keystream period cache, or NULL.
+ * @param [in] chunkSize    - The size of the reads, a whole number of key blocks.
+ * @param [in] offset       - The first byte of the range.
+ * @param [in] length       - The size of the range in bytes, -1 for everything up to the end of the input.
+ * @return Return 1 if successful, else 0.
+*/
+int encryptRange(const uint8_t* key, long keySize, KeyCache* keyCache, long chunkSize, long offset, long length);
+
+
+/*
+ * @brief Parse a size given on the command line.
+ * 
+ * @param [in] text     - The size in bytes, optionally followed by a K, M or G (binary) suffix.
+ * @return The size in bytes, or -1 if the text is not a valid size.
+*/
+long parseSize(const char* text);
+
+
 /*
  * @brief Process the input parameters and confirm that the arguments are valid.
  * Searches for the values provided by the user (indicated by '-n' and '-k') for the number of threads and the path to the encryption key file.
+ * '-n auto' creates AUTO_THREADS_PER_CORE threads per core and lets the pipeline tune how many are active, see tuneWorkers().
+ * Optional arguments:
+ *   -i PATH         - Read from a file instead of stdin. Mapped in memory when the output is a regular file too.
+ *   -o PATH         - Write to a file instead of stdout.
+ *   --chunk SIZE    - The work unit size (K, M, G suffixes), rounded up to whole key-sized blocks. DEFAULT_CHUNK_SIZE by default.
+ *   --io=MODE       - auto or rw (read/writev, the default), splice (vmsplice to stdout when it's a pipe, only safe
+ *                     when the consumer reads the pipe rather than splicing it on) or uring (io_uring for both reading
+ *                     and writing, falls back to auto when the kernel doesn't allow it).
+ *   --kernel=NAME   - Force the XOR kernel (scalar, sse2, avx2, avx512) instead of the best one the CPU supports.
+ *   --alloc-stats   - Print the block pool's allocation counters and the peak RSS to stderr at exit.
+ *   --stats[=json]  - Print per-stage times, chunk latency histograms, queue depths and lock waits to stderr at exit.
+ *                     Streaming pipeline only: -i/-o files are streamed rather than mapped, other modes are refused.
+ *   --offset SIZE   - Only output the bytes from this offset on (K, M, G suffixes), see encryptRange().
+ *   --length SIZE   - Only output that many bytes (K, M, G suffixes), see encryptRange().
+ *   --batch PATH    - Encrypt every file of a directory or a list (one path per line) into the -o directory, see encryptBatch().
+ *   --serve PATH    - Run as a daemon serving encryption on a Unix domain socket, see runDaemon().
+ *   --key-cache-mb N - Build the keystream period cache with a budget of N MiB (see keyCache.h), 0 (default) for none.
+ *   --checksum[=output|input] - Compute the CRC32C of the output (default) or of the input in the workers, see reportChecksum().
+ *   --checksum-file PATH - Write the checksum line to this sidecar file instead of stderr (implies --checksum).
+ *   --container     - Write the output as a container of checksummed chunks with an index (see container.h).
+ *   --extract       - Read the input as a container and write the raw output, see extractContainer().
+ *   --resume        - With --container, continue an interrupted container after its last verified chunk.
+ *                     With --extract, skip the chunks already decrypted in the output. Both need -o.
+ *   --chunks A-B    - With --extract, only decrypt the chunks A to B (or just A), into their place in the -o file.
+ *   --affinity      - Pin the workers to CPUs in NUMA node order and place the pool buffers on their nodes, see placeWorker().
  * 
  * @param [in] argc     - The number of command-line arguments.
  * @param [in] argcv    - An array of strings containing the command-line arguments.
- * @param [out] threads - An int pointer variable to store the number of threads requested by the user.
- * @return A pointer to a string containing the path to the encryption key file. Returns NULL if the arguments are invalid.
+ * @param [out] options - A pointer to a programOptions structure to store the values provided by the user.
+ * @return Return 1 if the arguments are valid, else 0.
 */
-char* processInput(int argc, char* argv[], int* threads);
+int processInput(int argc, char* argv[], programOptions* options);
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,74 @@
+#ifndef EVENT_COUNT_H
+#define EVENT_COUNT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+
+/*
+ * Data structure representing an event count, used to park threads until some condition may have changed.
+ * The waiter takes a ticket with eventPrepareWait(), re-checks its condition, and only then waits for the ticket to expire.
+ * A notification between the ticket and the wait is never lost, and notifying costs a fence and a load when nobody waits.
+ */
+typedef struct EventCount {
+    atomic_uint epoch;
+    atomic_int waiters;
+    pthread_mutex_t mutexEvent;
+    pthread_cond_t condEvent;
+} EventCount;
+
+
+/*
+ * @brief Initialize an event count.
+ * 
+ * @param [out] event   - A pointer to the event count to initialize.
+*/
+void eventInit(EventCount* event);
+
+
+/*
+ * @brief Announce the intention to wait and get a ticket.
+ * The caller must re-check its condition after this call and then either eventWait() or eventCancelWait().
+ * 
+ * @param [in] event    - A pointer to the event count.
+ * @return The ticket to pass to eventWait().
+*/
+unsigned eventPrepareWait(EventCount* event);
+
+
+/*
+ * @brief Give up waiting (the condition became true after eventPrepareWait()).
+ * 
+ * @param [in] event    - A pointer to the event count.
+*/
+void eventCancelWait(EventCount* event);
+
+
+/*
+ * @brief Block until the event is notified after the ticket was taken (returns right away if it already was).
+ * 
+ * @param [in] event    - A pointer to the event count.
+ * @param [in] ticket   - The ticket returned by eventPrepareWait().
+*/
+void eventWait(EventCount* event, unsigned ticket);
+
+
+/*
+ * @brief Wake up all the threads waiting on the event. Call it after making the condition true.
+ * 
+ * @param [in] event    - A pointer to the event count.
+*/
+void eventNotify(EventCount* event);
+
+
+/*
+ * @brief Destroy the event count's mutex and condition variable.
+ * 
+ * @param [in] event    - A pointer to the event count.
+*/
+void eventDestroy(EventCount* event);
+
+
+#endif
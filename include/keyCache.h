@@ -0,0 +1,76 @@
+#ifndef KEY_CACHE_H
+#define KEY_CACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <string.h>
+
+/*
+ * The keystream period cache (opaque), shared by all the threads encrypting with a key.
+ *
+ * The key of block N is the key rotated by N % (8 * keySize) bits, so there are only 8 * keySize different block keys.
+ * When they all fit in the memory budget (8 * keySize^2 bytes), they're built once, in parallel, into one read-only
+ * table where rotation r is stored at r * keySize. Consecutive blocks use consecutive rotations, so the table is
+ * the keystream itself: a run of blocks is XORed with one contiguous part of the table, there's no rotation left.
+ *
+ * Otherwise the budget holds an LRU of the rotations the cursors jump to (the first block of a chunk, a range, a
+ * stream resumed at another offset), the next blocks are still derived incrementally by the cursors. Keys of
+ * FUSED_MIN_KEY_SIZE bytes or more are XORed by the fused kernel without any rotated key, so only the table helps them.
+ */
+typedef struct KeyCache KeyCache;
+
+
+/*
+ * @brief Create a cache for a key: the whole table when it fits in the budget, an LRU of rotations otherwise.
+ * The caller is responsible for freeing it (see keyCacheDestroy()).
+ *
+ * @param [in] key          - The encryption key. Must outlive the cache.
+ * @param [in] keySize      - The size of the key in bytes.
+ * @param [in] budget       - The memory budget in bytes (at least one key's worth).
+ * @param [in] threads      - The number of threads to build the table with, in addition to the calling thread.
+ * @return A pointer to the cache if successful. Otherwise (budget under one key, out of memory) returns NULL without
+ *         printing anything, for the caller to run without it.
+*/
+KeyCache* keyCacheCreate(const uint8_t* key, long keySize, long budget, int threads);
+
+
+/*
+ * @brief Get the whole rotation table, if the cache holds it.
+ *
+ * @param [in] cache    - A pointer to the cache.
+ * @return The table (rotation r at r * keySize), or NULL when the cache is an LRU.
+*/
+const uint8_t* keyCacheTable(const KeyCache* cache);
+
+
+/*
+ * @brief Copy the key rotated by amount bits into dest, from the LRU (rotating it and adding it on a miss).
+ * The function is thread-safe. With the whole table, it's a plain copy from the table.
+ *
+ * @param [in] cache    - A pointer to the cache.
+ * @param [out] dest    - A keySize-bytes array to store the rotated key.
+ * @param [in] amount   - The rotation, between 0 and 8 * keySize - 1.
+*/
+void keyCacheGet(KeyCache* cache, uint8_t* dest, long amount);
+
+
+/*
+ * @brief Print the cache's mode, size and LRU hit rate to stderr.
+ *
+ * @param [in] cache    - A pointer to the cache.
+*/
+void keyCacheReport(KeyCache* cache);
+
+
+/*
+ * @brief Free the cache. No cursor may use it anymore.
+ *
+ * @param [in] cache    - A pointer to the cache.
+*/
+void keyCacheDestroy(KeyCache* cache);
+
+
+#endif
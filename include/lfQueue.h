@@ -0,0 +1,113 @@
+#ifndef LF_QUEUE_H
+#define LF_QUEUE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+
+#include "queue.h"
+
+/*
+ * The size of a cache line, used to keep slots and positions written by different threads apart.
+ */
+#define CACHE_LINE_SIZE 64
+
+
+/*
+ * Data structure representing one slot of the lock-free queue.
+ * The sequence number tells producers and consumers whose turn it is to use the slot.
+ * Each slot takes a whole cache line so threads working on neighbouring slots don't share lines.
+ */
+typedef struct LfSlot {
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t sequence;
+    Node* node;
+} LfSlot;
+
+
+/*
+ * Data structure representing a bounded lock-free multi-producer/multi-consumer queue (Vyukov's ring of sequenced slots).
+ * Same contract as Queue for the FIFO use: nodes come out in the order they were enqueued. There's no blockNum ordering.
+ */
+typedef struct LfQueue {
+    LfSlot* slots;
+    size_t mask;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t enqueuePos;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t dequeuePos;
+} LfQueue;
+
+
+/*
+ * @brief Create an empty lock-free queue.
+ * The caller is responsible for freeing the allocated memory (see lfQueueDestroy()).
+ *
+ * @param [in] capacity - The maximum number of nodes in the queue. Rounded up to a power of 2.
+ * @return A pointer to the created queue if successful. Otherwise, returns NULL.
+*/
+LfQueue* createLfQueue(long capacity);
+
+
+/*
+ * @brief Enqueue a new node into the given queue.
+ * The function will create a new node and add it at the end of the queue.
+ * The function is thread-safe and lock-free.
+ *
+ * @param [in] queue        - A pointer to the queue data structure.
+ * @param [in] data         - An unsigned char data.
+ * @param [in] blockSize    - The size of the data block.
+ * @param [in] blockNum     - The serial number of the data block.
+ * @return Return 1 if successful insertion, else 0 (queue full or allocation failed - the data is still owned by the caller).
+*/
+int lfEnqueue(LfQueue* queue, uint8_t* data, long blockSize, long blockNum);
+
+
+/*
+ * @brief Enqueue an existing node into the given queue.
+ * The function is thread-safe and lock-free.
+ *
+ * @param [in] queue    - A pointer to the queue data structure.
+ * @param [in] node     - A pointer to a node.
+ * @return Return 1 if successful insertion, else 0 (queue full).
+*/
+int lfEnqueueNode(LfQueue* queue, Node* node);
+
+
+/*
+ * @brief Dequeue a node from the given queue.
+ * The function is thread-safe and lock-free.
+ *
+ * @param [in] queue    - A pointer to the queue data structure.
+ * @return Return the front node if successful. NULL if the queue is empty.
+*/
+Node* lfDequeue(LfQueue* queue);
+
+
+/*
+ * @brief Check if the queue is empty.
+ * The result is a snapshot, it may already be outdated when other threads use the queue.
+ *
+ * @param [in] queue - A pointer to the queue data structure.
+ * @return Return 1 if the queue is empty, else 0.
+*/
+int lfIsEmpty(LfQueue* queue);
+
+
+/*
+ * @brief Get the queue size.
+ * The result is a snapshot, it may already be outdated when other threads use the queue.
+ *
+ * @param [in] queue    - A pointer to the queue data structure.
+ * @return Return queue's size.
+*/
+int lfGetSize(LfQueue* queue);
+
+
+/*
+ * @brief Free the queue. Nodes still in the queue are not freed.
+ *
+ * @param [in] queue    - A pointer to the queue data structure.
+*/
+void lfQueueDestroy(LfQueue* queue);
+
+
+#endif
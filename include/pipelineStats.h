@@ -0,0 +1,202 @@
+#ifndef PIPELINE_STATS_H
+#define PIPELINE_STATS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+
+#include "queue.h"
+#include "lfQueue.h"
+#include "workQueues.h"
+
+/*
+ * The number of histogram buckets per power of two (of nanoseconds), and in total.
+ */
+#define STATS_SUB_BUCKETS 4
+#define STATS_BUCKETS (64 * STATS_SUB_BUCKETS)
+
+/*
+ * The queue depth sampling period, and the maximum number of samples kept.
+ * When the samples are full, every other one is dropped and the period doubles, so a long run keeps its whole timeline.
+ */
+#define STATS_SAMPLE_MS 10
+#define STATS_MAX_SAMPLES 1024
+
+/*
+ * Checks if --stats is on. Every recording site tests it first, so the mode costs a predicted branch when it's off.
+ */
+#define STATS_ON __builtin_expect(statsEnabled, 0)
+
+
+/*
+ * Where a thread spends its time. ROTATE and XOR are measured per key-sized block with the CPU's cycle counter,
+ * CHECKSUM (--checksum) per chunk with the cycle counter too,
+ * WAIT is the time parked (reader waiting for room, idle worker, writer waiting for the next chunk, io_uring wait),
+ * the LOCK stages are the time spent waiting for the reorder buffer and pool mutexes.
+ */
+typedef enum statsStage{
+    STAGE_READ,
+    STAGE_ROTATE,
+    STAGE_XOR,
+    STAGE_CHECKSUM,
+    STAGE_WRITE,
+    STAGE_WAIT,
+    STAGE_REORDER_LOCK,
+    STAGE_POOL_LOCK,
+    STAGE_COUNT
+} statsStage;
+
+
+/*
+ * Per-chunk latencies: read to picked up by a worker, encryption, encrypted to taken by the writer, and read to written.
+ */
+typedef enum statsLatency{
+    LATENCY_QUEUED,
+    LATENCY_ENCRYPT,
+    LATENCY_REORDER,
+    LATENCY_TOTAL,
+    LATENCY_COUNT
+} statsLatency;
+
+
+typedef enum statsCounter{
+    COUNTER_CHUNKS_READ,
+    COUNTER_BYTES_READ,
+    COUNTER_CHUNKS_ENCRYPTED,
+    COUNTER_STEALS,
+    COUNTER_OUT_OF_ORDER,
+    COUNTER_CHUNKS_WRITTEN,
+    COUNTER_WRITE_CALLS,
+    COUNTER_PARKS,
+    COUNTER_REORDER_CONTENDED,
+    COUNTER_POOL_CONTENDED,
+    COUNTER_COUNT
+} statsCounter;
+
+
+/*
+ * Data structure to hold the statistics of one thread.
+ * Only the owning thread writes to it, so recording takes no lock and no atomic. The records of all the threads
+ * are kept in a list (even after their thread exited) and merged by statsReport().
+ * stageTime is in nanoseconds, except ROTATE and XOR which are in cycle counter ticks until the report.
+ */
+typedef struct ThreadStats{
+    const char* role;
+    uint64_t stageTime[STAGE_COUNT];
+    long counters[COUNTER_COUNT];
+    uint64_t histograms[LATENCY_COUNT][STATS_BUCKETS];
+    struct ThreadStats* next;
+} ThreadStats;
+
+
+extern int statsEnabled;
+
+
+/*
+ * @brief Turn the statistics on. Meant to be called once at startup, before any thread starts.
+ *
+ * @param [in] json     - 1 to print the report as JSON, 0 for text.
+*/
+void statsInit(int json);
+
+
+/*
+ * @brief Name the calling thread's statistics (e.g. "main", "worker", "writer"). Threads with the same role are merged.
+ *
+ * @param [in] role     - A string that outlives the report.
+*/
+void statsSetRole(const char* role);
+
+
+/*
+ * @brief Get a monotonic timestamp.
+ *
+ * @return The time in nanoseconds.
+*/
+uint64_t statsNow();
+
+
+/*
+ * @brief Get the CPU's cycle counter (a monotonic timestamp on CPUs without one), for the fine grained stages.
+ *
+ * @return The counter value.
+*/
+uint64_t statsTicks();
+
+
+/*
+ * @brief Add time to one of the calling thread's stages.
+ *
+ * @param [in] stage    - The stage.
+ * @param [in] time     - The time in nanoseconds (cycle counter ticks for STAGE_ROTATE, STAGE_XOR and STAGE_CHECKSUM).
+*/
+void statsAddTime(statsStage stage, uint64_t time);
+
+
+/*
+ * @brief Add to one of the calling thread's counters.
+ *
+ * @param [in] counter  - The counter.
+ * @param [in] amount   - The amount to add.
+*/
+void statsCount(statsCounter counter, long amount);
+
+
+/*
+ * @brief Record one chunk latency in the calling thread's histogram.
+ *
+ * @param [in] latency  - The histogram.
+ * @param [in] time     - The latency in nanoseconds.
+*/
+void statsRecordLatency(statsLatency latency, uint64_t time);
+
+
+/*
+ * @brief Lock a mutex, recording the time spent waiting for it when it was contended.
+ *
+ * @param [in] mutex        - The mutex to lock.
+ * @param [in] stage        - The stage to charge the wait to.
+ * @param [in] contended    - The counter of contended locks.
+*/
+void statsLockTimed(pthread_mutex_t* mutex, statsStage stage, statsCounter contended);
+
+
+/*
+ * Locks a mutex, timed with --stats and a plain pthread_mutex_lock() otherwise.
+ */
+static inline void statsMutexLock(pthread_mutex_t* mutex, statsStage stage, statsCounter contended){
+    if(STATS_ON){
+        statsLockTimed(mutex, stage, contended);
+    }
+    else {
+        pthread_mutex_lock(mutex);
+    }
+}
+
+
+/*
+ * @brief Start the thread sampling the depth of the toEncrypt queue and the toWrite reorder buffer every STATS_SAMPLE_MS.
+ *
+ * @param [in] toEncrypt    - A pointer to the toEncrypt queues (the depth is their total).
+ * @param [in] toWrite      - A pointer to the toWrite reorder buffer.
+ * @return Return 1 if successful, else 0.
+*/
+int statsStartSampler(WorkQueues* toEncrypt, ReorderBuffer* toWrite);
+
+
+/*
+ * @brief Stop the sampler thread, if it was started.
+*/
+void statsStopSampler();
+
+
+/*
+ * @brief Merge the statistics of all the threads, print them to stderr (text or JSON) and free them.
+ * All the threads must be done recording.
+*/
+void statsReport();
+
+
+#endif
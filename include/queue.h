@@ -10,12 +10,21 @@
 /*
  * Node data representing a node in the queue.
  * This struct contains a data block to be processed.
+ * owner is the worker whose memory node the data buffer was first touched on (-1 if none), it gets the chunks read into it.
+ * readTime and encryptTime are timestamps for the owner of the pipeline (encryptUtil sets them with --stats, to measure
+ * the chunk's latencies), the queues don't read them.
+ * checksum and inputChecksum are the chunk's CRC32C after and before the XOR, only set with --checksum (checksum with --container too).
  */
 typedef struct Node {
     uint8_t* data;
     long blockSize;
     long blockNum;
     struct Node* next;
+    int owner;
+    uint64_t readTime;
+    uint64_t encryptTime;
+    uint32_t checksum;
+    uint32_t inputChecksum;
 } Node;
 
 
@@ -31,6 +40,23 @@ typedef struct Queue {
 } Queue;
 
 
+/*
+ * Data structure representing a reorder buffer.
+ * Blocks are stored in a fixed window of slots indexed by blockNum % window, so inserting is O(1) whatever the arrival order,
+ * and the blocks can be taken out in blockNum order by polling the slot of the next expected block.
+ * The window must be larger than the number of blocks in flight (see reorderHasRoom()).
+ * lockMutex locks mutexBuffer, pthread_mutex_lock() unless the owner set its own (see reorderSetLockHook()).
+ */
+typedef struct ReorderBuffer {
+    Node** slots;
+    long window;
+    long nextBlock;
+    int size;
+    pthread_mutex_t mutexBuffer;
+    void (*lockMutex)(pthread_mutex_t* mutex);
+} ReorderBuffer;
+
+
 /*
  * @brief Create a new node to store relevant information.
  * The function creates a new node and initializes its data members.
@@ -115,6 +141,91 @@ Node* dequeue(Queue* queue);
 int getSize(Queue* queue);
 
 
+/*
+ * @brief Create an empty reorder buffer.
+ * The first block expected out of the buffer is block 0.
+ * The caller is responsible for freeing the allocated memory (see reorderDestroy()).
+ * 
+ * @param [in] window   - The number of slots, the maximum distance between the next expected block and any stored block.
+ * @return A pointer to the created reorder buffer if successful. Otherwise, returns NULL.
+*/
+ReorderBuffer* createReorderBuffer(long window);
+
+
+/*
+ * @brief Insert a node in the slot of its blockNum.
+ * The function is thread-safe and acquires the lock to ensure synchronized access.
+ * 
+ * @param [in] buffer   - A pointer to the reorder buffer.
+ * @param [in] node     - A pointer to a node. Its blockNum must be within the window (see reorderHasRoom()).
+ * @return Return 1 if the node is the next expected block, 2 if it has to wait for earlier blocks,
+ *         0 on failure (blockNum outside the window or slot already in use).
+*/
+int reorderInsert(ReorderBuffer* buffer, Node* node);
+
+
+/*
+ * @brief Replace the function locking the buffer's mutex, e.g. to time the waits.
+ * Must be called before the buffer is shared between threads.
+ *
+ * @param [in] buffer       - A pointer to the reorder buffer.
+ * @param [in] lockMutex    - The function to lock the mutex with, NULL for pthread_mutex_lock().
+*/
+void reorderSetLockHook(ReorderBuffer* buffer, void (*lockMutex)(pthread_mutex_t* mutex));
+
+
+/*
+ * @brief Take out the next expected block, if it already arrived.
+ * On success the next expected block number is incremented. Callers that must keep the output in order
+ * need to serialize the take and the use of the node (e.g. a single writer thread).
+ * The function is thread-safe and acquires the lock to ensure synchronized access.
+ * 
+ * @param [in] buffer   - A pointer to the reorder buffer.
+ * @return Return the node of the next expected block. NULL if it's not in the buffer yet.
+*/
+Node* reorderTakeNext(ReorderBuffer* buffer);
+
+
+/*
+ * @brief Check if the next expected block already arrived.
+ * The function is thread-safe and acquires the lock to ensure synchronized access.
+ * 
+ * @param [in] buffer   - A pointer to the reorder buffer.
+ * @return Return 1 if reorderTakeNext() would return a node, else 0.
+*/
+int reorderNextReady(ReorderBuffer* buffer);
+
+
+/*
+ * @brief Check if a block can be put in flight without overflowing the window.
+ * The function is thread-safe and acquires the lock to ensure synchronized access.
+ * 
+ * @param [in] buffer   - A pointer to the reorder buffer.
+ * @param [in] blockNum - The serial number of the block.
+ * @return Return 1 if blockNum is within the window, else 0.
+*/
+int reorderHasRoom(ReorderBuffer* buffer, long blockNum);
+
+
+/*
+ * @brief Check if the reorder buffer is empty.
+ * The function is thread safe and acquires the lock to ensure synchronized access.
+ * 
+ * @param [in] buffer   - A pointer to the reorder buffer.
+ * @return Return 1 if the buffer is empty, else 0.
+*/
+int reorderIsEmpty(ReorderBuffer* buffer);
+
+
+/*
+ * @brief Free the reorder buffer and destroy its mutex.
+ * Nodes still in the buffer are not freed.
+ * 
+ * @param [in] buffer   - A pointer to the reorder buffer.
+*/
+void reorderDestroy(ReorderBuffer* buffer);
+
+
 /*
  * @brief Close the mutex of the queue.
  * The function destroys the mutex associated with the queue.
@@ -0,0 +1,98 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+
+/*
+ * Data structure representing an io_uring instance: the submission and completion rings shared with the kernel.
+ * Only the raw system calls are used (no liburing), a single thread submits and reaps.
+ */
+typedef struct Uring {
+    int ringFd;
+    unsigned entries;
+    unsigned toSubmit;
+
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    struct io_uring_sqe* sqes;
+
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+} Uring;
+
+
+/*
+ * @brief Create an io_uring instance and map its rings.
+ * 
+ * @param [out] ring    - A pointer to the ring to initialize.
+ * @param [in] entries  - The number of submission entries (the kernel rounds it up to a power of 2).
+ * @return Return 1 if successful, else 0 (e.g. the kernel doesn't support io_uring, or it's disabled).
+*/
+int uringInit(Uring* ring, unsigned entries);
+
+
+/*
+ * @brief Register buffers with the ring, so fixed reads/writes can use them by index without mapping them every time.
+ * 
+ * @param [in] ring     - A pointer to the ring.
+ * @param [in] buffers  - An array of iovec, one per buffer. A buffer's index in the array is its buf_index.
+ * @param [in] count    - The number of buffers.
+ * @return Return 1 if successful, else 0 (e.g. over RLIMIT_MEMLOCK - plain reads/writes still work).
+*/
+int uringRegisterBuffers(Uring* ring, const struct iovec* buffers, unsigned count);
+
+
+/*
+ * @brief Get a free submission entry, cleared. It is submitted by the next uringSubmit().
+ * 
+ * @param [in] ring     - A pointer to the ring.
+ * @return A pointer to the entry, or NULL if the submission ring is full.
+*/
+struct io_uring_sqe* uringGetSqe(Uring* ring);
+
+
+/*
+ * @brief Submit the pending entries and optionally wait for completions.
+ * 
+ * @param [in] ring     - A pointer to the ring.
+ * @param [in] waitFor  - The number of completions to wait for (0 to only submit).
+ * @return Return 1 if successful, else 0.
+*/
+int uringSubmit(Uring* ring, unsigned waitFor);
+
+
+/*
+ * @brief Take the next completion out of the completion ring.
+ * 
+ * @param [in] ring     - A pointer to the ring.
+ * @param [out] cqe     - A pointer to store a copy of the completion.
+ * @return Return 1 if there was a completion, else 0.
+*/
+int uringNextCqe(Uring* ring, struct io_uring_cqe* cqe);
+
+
+/*
+ * @brief Unmap the rings and close the instance (in-flight requests are cancelled).
+ * 
+ * @param [in] ring     - A pointer to the ring.
+*/
+void uringDestroy(Uring* ring);
+
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef WORK_QUEUES_H
+#define WORK_QUEUES_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+
+#include "queue.h"
+#include "lfQueue.h"
+
+/*
+ * The smallest capacity of one worker's queue.
+ */
+#define MIN_WORK_QUEUE_SIZE 16
+
+
+/*
+ * Data structure representing the work waiting to be encrypted: one bounded lock-free queue per worker.
+ * The reader pushes each chunk to one queue (the queue of the worker whose node holds its buffer, or the next one in turn),
+ * a worker takes from its own queue first and steals from the others' when its own is empty.
+ * Workers mostly touch their own queue's positions, so the queue heads don't bounce between all the cores.
+ * Only the first active queues get new chunks (their workers are the ones running), all of them can be stolen from.
+ */
+typedef struct WorkQueues {
+    LfQueue** queues;
+    int count;
+    int active;
+    _Alignas(CACHE_LINE_SIZE) long nextQueue;
+} WorkQueues;
+
+
+/*
+ * @brief Create the per-worker queues.
+ * The caller is responsible for freeing the allocated memory (see workQueuesDestroy()).
+ * 
+ * @param [in] count        - The number of queues (one per worker).
+ * @param [in] capacity     - The total capacity, split between the queues (each holds at least MIN_WORK_QUEUE_SIZE).
+ * @return A pointer to the created queues if successful. Otherwise, returns NULL.
+*/
+WorkQueues* createWorkQueues(int count, long capacity);
+
+
+/*
+ * @brief Push a node to a worker's queue, or to the next queue with room if that one is full.
+ * Only one thread (the reader) may push.
+ * 
+ * @param [in] work     - A pointer to the queues.
+ * @param [in] node     - A pointer to the node.
+ * @param [in] queue    - The preferred queue, or -1 to take the active queues in turn.
+ * @return Return 1 if successful insertion, else 0 (every active queue is full).
+*/
+int workPush(WorkQueues* work, Node* node, int queue);
+
+
+/*
+ * @brief Set the number of queues getting new chunks (the first ones).
+ * Only the pushing thread may call it.
+ * 
+ * @param [in] work     - A pointer to the queues.
+ * @param [in] active   - The number of active queues, between 1 and the number of queues.
+*/
+void workSetActive(WorkQueues* work, int active);
+
+
+/*
+ * @brief Take a node, from the worker's own queue first, otherwise stolen from the other queues.
+ * The function is thread-safe and lock-free.
+ * 
+ * @param [in] work     - A pointer to the queues.
+ * @param [in] home     - The worker's own queue.
+ * @param [out] stolen  - Set to 1 if the node came from another worker's queue, else 0. May be NULL.
+ * @return Return the node, or NULL if every queue is empty.
+*/
+Node* workPop(WorkQueues* work, int home, int* stolen);
+
+
+/*
+ * @brief Get the number of nodes in all the queues.
+ * The result is a snapshot, it may already be outdated when other threads use the queues.
+ * 
+ * @param [in] work     - A pointer to the queues.
+ * @return Return the number of nodes.
+*/
+long workSize(WorkQueues* work);
+
+
+/*
+ * @brief Check if all the queues are empty.
+ * The result is a snapshot, it may already be outdated when other threads use the queues.
+ * 
+ * @param [in] work     - A pointer to the queues.
+ * @return Return 1 if all the queues are empty, else 0.
+*/
+int workIsEmpty(WorkQueues* work);
+
+
+/*
+ * @brief Free the queues. Nodes still in them are not freed.
+ * 
+ * @param [in] work     - A pointer to the queues.
+*/
+void workQueuesDestroy(WorkQueues* work);
+
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef XOR_KERNEL_H
+#define XOR_KERNEL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+
+
+/*
+ * Signature shared by all the XOR kernels: dest[i] = src[i] ^ key[i] for i < length.
+ * dest and src may be the same buffer (in place encryption), the key must not overlap dest.
+ */
+typedef void (*xorKernelFunc)(uint8_t* dest, const uint8_t* src, const uint8_t* key, long length);
+
+
+/*
+ * Signature shared by all the shifted XOR kernels: the key shifted left by bits (1 to 7) is built on the fly,
+ * dest[i] = src[i] ^ ((key[i] << bits) | (key[i + 1] >> (8 - bits))) for i < length. The key is read up to key[length].
+ */
+typedef void (*xorShiftedFunc)(uint8_t* dest, const uint8_t* src, const uint8_t* key, int bits, long length);
+
+
+/*
+ * Data structure describing one XOR kernel variant.
+ * supported() checks (with cpuid) that the CPU running the program can execute it.
+ * shifted is the same kernel XORing with a key shifted on the fly (see xorBlockRotated()).
+ */
+typedef struct xorKernel{
+    const char* name;
+    xorKernelFunc run;
+    xorShiftedFunc shifted;
+    int (*supported)(void);
+} xorKernel;
+
+
+/*
+ * @brief XORs a block with the key using the kernel selected at startup (see selectXorKernel()).
+ * If no kernel was selected yet, the best kernel supported by the CPU is selected on the first call.
+ *
+ * @param [out] dest    - Where to store the result. May be the same buffer as src.
+ * @param [in] src      - The block of data to be encrypted.
+ * @param [in] key      - The (rotated) encryption key, at least length bytes.
+ * @param [in] length   - The number of bytes to process.
+*/
+void xorBlock(uint8_t* dest, const uint8_t* src, const uint8_t* key, long length);
+
+
+/*
+ * @brief XORs a block with the key rotated left by amount bits, without building the rotated key: the kernel reads
+ * the original key from byte amount / 8 on, merges each byte with the next one for the amount % 8 bits in registers,
+ * and wraps around to the start of the key. The memory traffic is the data and one pass over the key.
+ * Same output as rotateKeyCopy() followed by xorBlock() on the first length bytes.
+ *
+ * @param [out] dest    - Where to store the result. May be the same buffer as src.
+ * @param [in] src      - The block of data to be encrypted.
+ * @param [in] key      - The original encryption key, keySize bytes.
+ * @param [in] keySize  - The size of the key in bytes.
+ * @param [in] amount   - The rotation in bits, between 0 and 8 * keySize - 1.
+ * @param [in] length   - The number of bytes to process, at most keySize.
+*/
+void xorBlockRotated(uint8_t* dest, const uint8_t* src, const uint8_t* key, long keySize, long amount, long length);
+
+
+/*
+ * @brief Select the XOR kernel used by xorBlock().
+ * Meant to be called once at startup, before any thread starts encrypting. Without it, the first use picks the best
+ * kernel once, whichever thread gets there (library users don't have to call it).
+ *
+ * @param [in] name     - The kernel name ("scalar", "sse2", "avx2", "avx512"), or NULL to pick the best one the CPU supports.
+ * @return Return 1 if the kernel was selected, else 0 (unknown name or not supported by this CPU).
+*/
+int selectXorKernel(const char* name);
+
+
+/*
+ * @brief Get the name of the kernel used by xorBlock().
+ *
+ * @return The name of the selected kernel.
+*/
+const char* xorKernelName();
+
+
+/*
+ * @brief Get the list of all the kernels compiled in, ordered from the reference (scalar) to the widest.
+ *
+ * @param [out] count   - An int pointer to store the number of kernels.
+ * @return A pointer to the array of kernels.
+*/
+const xorKernel* xorKernelList(int* count);
+
+
+/*
+ * @brief The kernel variants. The scalar one is the reference and the fallback on every CPU.
+ * The vector ones handle any alignment: a scalar head until dest is aligned, vector body, scalar tail.
+*/
+void xorBlockScalar(uint8_t* dest, const uint8_t* src, const uint8_t* key, long length);
+void xorShiftedScalar(uint8_t* dest, const uint8_t* src, const uint8_t* key, int bits, long length);
+#if defined(__x86_64__) || defined(__i386__)
+void xorBlockSse2(uint8_t* dest, const uint8_t* src, const uint8_t* key, long length);
+void xorBlockAvx2(uint8_t* dest, const uint8_t* src, const uint8_t* key, long length);
+void xorBlockAvx512(uint8_t* dest, const uint8_t* src, const uint8_t* key, long length);
+void xorShiftedSse2(uint8_t* dest, const uint8_t* src, const uint8_t* key, int bits, long length);
+void xorShiftedAvx2(uint8_t* dest, const uint8_t* src, const uint8_t* key, int bits, long length);
+void xorShiftedAvx512(uint8_t* dest, const uint8_t* src, const uint8_t* key, int bits, long length);
+#endif
+
+
+#endif
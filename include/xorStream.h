@@ -0,0 +1,260 @@
+#ifndef XOR_STREAM_H
+#define XOR_STREAM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "xorKernel.h"
+#include "keyCache.h"
+
+/*
+ * The default work unit of xorStreamProcessBuffer(), rounded up to a whole number of key-sized blocks.
+ */
+#define XOR_STREAM_CHUNK_SIZE (256 * 1024)
+
+
+/*
+ * The smallest key encrypted with the fused rotate-and-XOR kernel (see xorBlockRotated()).
+ * A smaller rotated key stays in L1, where shifting it by one bit per block beats splitting each block around the wrap.
+ */
+#define FUSED_MIN_KEY_SIZE 512
+
+
+/*
+ * Data structure to hold the rotation state of one thread encrypting with a key.
+ * It keeps the rotated key of the last block, so the next block's key is usually one bit rotation away.
+ * The key itself is only read, several cursors can share it (and a key cache, see keyCache.h).
+ */
+typedef struct KeyCursor{
+    const uint8_t* key;
+    long keySize;
+    uint8_t* rotatedKey;
+    long rotatedAmount;
+    KeyCache* cache;
+
+} KeyCursor;
+
+
+/*
+ * The streaming context (opaque): a copy of the key, the rotation state, the position in the stream
+ * and the bytes of a partial key block waiting for the rest of it.
+ */
+typedef struct XorStream XorStream;
+
+
+/*
+ * @brief Rotates the bits of the encryption key by the specified amount (in place).
+ * It performs a left shift operation on the bits of the encryption key and rolling the LMB to be the RMB.
+ * The cost is O(size) for any amount: a byte level move followed by a single sub-byte shift.
+ *
+ * @param [in,out] key  - The unsigned char array of the encryption key to be rotated.
+ * @param [in] amount    - The number of times to left-shift the bits of the key.
+ * @param [in] size      - The size of the encryption key in bytes.
+*/
+void rotateKey(uint8_t* key, long amount, long size);
+
+
+/*
+ * @brief Writes the encryption key rotated by the specified amount into dest, the original key stays untouched.
+ * Same result as copying the key and calling rotateKey(), in a single pass.
+ *
+ * @param [out] dest    - A size-bytes array to store the rotated key. Must not overlap the key.
+ * @param [in] key      - The unsigned char array of the original encryption key.
+ * @param [in] amount   - The number of times to left-shift the bits of the key.
+ * @param [in] size     - The size of the encryption key in bytes.
+*/
+void rotateKeyCopy(uint8_t* dest, const uint8_t* key, long amount, long size);
+
+
+/*
+ * @brief Rotates the encryption key left by one bit.
+ * The leftmost bit is rolled over to become the rightmost bit.
+ * Since block N+1 uses block N's key rotated by one more bit, this is also the incremental way to get the next block's key.
+ *
+ * @param [in,out] key  - A char array containing the encryption key.
+ * @param [in] size      - The size of the encryption key in bytes.
+*/
+void leftShiftKey(uint8_t* key, long size);
+
+
+/*
+ * @brief Performs XOR encryption on a block of data using the provided encryption key.
+ * The work is done by the XOR kernel selected at startup (see xorKernel.h).
+ *
+ * @param [in,out] text     - An unsigned char pointer to the block of data to be encrypted.
+ * @param [in] key          - An unsigned char pointer of the encryption key.
+ * @param [in] blockSize    - The size of the block to be encrypted.
+*/
+void encryptBlock(uint8_t* text, const uint8_t* key, long blockSize);
+
+
+/*
+ * @brief Initialize a key cursor.
+ * It is the caller's responsibility to release it with keyCursorFree().
+ *
+ * @param [out] cursor  - A pointer to the cursor to initialize.
+ * @param [in] key      - The encryption key. Must outlive the cursor.
+ * @param [in] keySize  - The size of the key in bytes.
+ * @return Return 1 if successful, else 0.
+*/
+int keyCursorInit(KeyCursor* cursor, const uint8_t* key, long keySize);
+
+
+/*
+ * @brief Make a cursor take its block keys from a cache (NULL to stop).
+ * With the whole table, blocks are XORed straight from it. With an LRU, the cursor gets the rotations it jumps to from it.
+ *
+ * @param [in] cursor   - A pointer to the cursor.
+ * @param [in] cache    - A cache built for the same key. Must outlive the cursor's use of it.
+*/
+void keyCursorSetCache(KeyCursor* cursor, KeyCache* cache);
+
+
+/*
+ * @brief Release a key cursor.
+ *
+ * @param [in] cursor   - A pointer to the cursor to release.
+*/
+void keyCursorFree(KeyCursor* cursor);
+
+
+/*
+ * @brief Get the key of a block, rotated in the cursor's buffer.
+ * The rotation amount depends on the block's length, so a short last block gets its own.
+ *
+ * @param [in] cursor       - A pointer to the cursor.
+ * @param [in] blockNum     - The number of the key-sized block in the stream.
+ * @param [in] blockLength  - The length of the block (the key size, or less for the last block).
+ * @return A pointer to the rotated key, valid until the next call on this cursor (or in the cache's table).
+*/
+const uint8_t* keyCursorBlockKey(KeyCursor* cursor, long blockNum, long blockLength);
+
+
+/*
+ * @brief Encrypt consecutive key-sized blocks.
+ * Each block is XORed with the key rotated for its own block number, so the output is the same however the data is split.
+ *
+ * @param [in] cursor       - A pointer to the cursor.
+ * @param [out] dest        - Where to store the encrypted data. May be the same buffer as src (in place).
+ * @param [in] src          - The data to be encrypted.
+ * @param [in] length       - The size of the data in bytes. Only the last block may be shorter than the key.
+ * @param [in] firstBlock   - The block number of the first key-sized block.
+*/
+void keyCursorEncrypt(KeyCursor* cursor, uint8_t* dest, const uint8_t* src, long length, long firstBlock);
+
+
+/*
+ * @brief Check if keyCursorEncrypt() builds each block's rotated key, rather than reading the blocks' keys from the
+ * cache's table or XORing with the key rotated on the fly (keys of FUSED_MIN_KEY_SIZE bytes or more).
+ *
+ * @param [in] cursor       - A pointer to the cursor.
+ * @return Return 1 if the cursor builds rotated keys, else 0.
+*/
+int keyCursorRotates(const KeyCursor* cursor);
+
+
+/*
+ * @brief Create a streaming context for a key.
+ * The key is copied. The caller is responsible for freeing the context (see xorStreamDestroy()).
+ *
+ * @param [in] key      - The encryption key.
+ * @param [in] keySize  - The size of the key in bytes (> 0).
+ * @return A pointer to the context if successful. Otherwise, returns NULL.
+*/
+XorStream* xorStreamCreate(const uint8_t* key, long keySize);
+
+
+/*
+ * @brief Same as xorStreamCreate(), but the key is used in place instead of copied: contexts for many streams (or a
+ * mapped key file) then share one key in memory. The key must stay valid and unchanged until the context is freed.
+ *
+ * @param [in] key      - The encryption key.
+ * @param [in] keySize  - The size of the key in bytes (> 0).
+ * @return A pointer to the context if successful. Otherwise, returns NULL.
+*/
+XorStream* xorStreamCreateShared(const uint8_t* key, long keySize);
+
+
+/*
+ * @brief Get the size of the context's key (the most xorStreamFinal() can output, and the most update() holds back).
+ *
+ * @param [in] stream   - A pointer to the context.
+ * @return The key size in bytes.
+*/
+long xorStreamKeySize(const XorStream* stream);
+
+
+/*
+ * @brief Encrypt the next part of a stream. The data can be split anywhere, the output is the same as one big call.
+ * A partial key block at the end is held back until the rest of it arrives (or xorStreamFinal(), since the
+ * rotation of a short last block depends on its length), so the output can be up to keySize - 1 bytes longer
+ * or shorter than the input.
+ * Not thread-safe: a context encrypts one stream at a time.
+ *
+ * @param [in] stream   - A pointer to the context.
+ * @param [in] in       - The data to be encrypted.
+ * @param [out] out     - Where to store the encrypted data, room for length + keySize - 1 bytes. May be the same buffer
+ *                        as in only while the stream is at a key block boundary (nothing held back).
+ * @param [in] length   - The size of the data in bytes.
+ * @return The number of bytes stored in out.
+*/
+long xorStreamUpdate(XorStream* stream, const uint8_t* in, uint8_t* out, long length);
+
+
+/*
+ * @brief End the stream: encrypt the partial key block held back, if any, and rewind the context for a new stream.
+ *
+ * @param [in] stream   - A pointer to the context.
+ * @param [out] out     - Where to store the last bytes, room for keySize - 1 bytes.
+ * @return The number of bytes stored in out.
+*/
+long xorStreamFinal(XorStream* stream, uint8_t* out);
+
+
+/*
+ * @brief Rewind the context to the start of a new stream, dropping anything held back.
+ *
+ * @param [in] stream   - A pointer to the context.
+*/
+void xorStreamReset(XorStream* stream);
+
+
+/*
+ * @brief Encrypt a whole in-memory message with several threads (the calling thread included).
+ * The threads claim chunks of chunkSize bytes; a chunk's offset and key rotation only depend on its number.
+ * Same output as xorStreamUpdate() + xorStreamFinal() on a fresh context. Doesn't use or change the stream's position,
+ * so it can be called from several threads at once with the same context.
+ *
+ * @param [in] stream       - A pointer to the context (only its key is used).
+ * @param [in] in           - The message to be encrypted.
+ * @param [out] out         - Where to store the encrypted message, length bytes. May be the same buffer as in.
+ * @param [in] length       - The size of the message in bytes.
+ * @param [in] threads      - The number of threads to create in addition to the calling thread (0 to run inline).
+ * @param [in] chunkSize    - The work unit in bytes, rounded up to whole key-sized blocks (0 for XOR_STREAM_CHUNK_SIZE).
+ * @return Return 1 if successful, else 0.
+*/
+int xorStreamProcessBuffer(const XorStream* stream, const uint8_t* in, uint8_t* out, long length, int threads, long chunkSize);
+
+
+/*
+ * @brief Make the context (and the threads of xorStreamProcessBuffer()) use a key cache, NULL to stop.
+ *
+ * @param [in] stream   - A pointer to the context.
+ * @param [in] cache    - A cache built for the same key. Must outlive the context's use of it.
+*/
+void xorStreamSetKeyCache(XorStream* stream, KeyCache* cache);
+
+
+/*
+ * @brief Free the context.
+ *
+ * @param [in] stream   - A pointer to the context.
+*/
+void xorStreamDestroy(XorStream* stream);
+
+
+#endif
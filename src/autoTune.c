@@ -0,0 +1,99 @@
+#include "../include/autoTune.h"
+
+void autoTuneInit(AutoTuner* tuner, int minLevel, int maxLevel, int start, uint64_t now){
+    if(start < minLevel){
+        start = minLevel;
+    }
+    if(start > maxLevel){
+        start = maxLevel;
+    }
+    tuner->minLevel = minLevel;
+    tuner->maxLevel = maxLevel;
+    tuner->level = start;
+    tuner->bestLevel = start;
+    tuner->bestRate = 0;
+    tuner->direction = 1;
+    tuner->turned = 0;
+    tuner->settled = 0;
+    tuner->settledWindows = 0;
+    tuner->warmedUp = 0;
+    tuner->reported = 0;
+    tuner->windowStart = now;
+    tuner->windowBytes = 0;
+}
+
+
+/*
+ * Stops climbing at the best level measured.
+ */
+static void settle(AutoTuner* tuner){
+    tuner->level = tuner->bestLevel;
+    tuner->settled = 1;
+    tuner->settledWindows = 0;
+}
+
+
+int autoTuneRecord(AutoTuner* tuner, long bytes, uint64_t now){
+    tuner->windowBytes += bytes;
+    if(now - tuner->windowStart < AUTO_TUNE_WINDOW_NS){
+        return 0;
+    }
+
+    double rate = (double)tuner->windowBytes * 1e9 / (double)(now - tuner->windowStart);
+    tuner->windowStart = now;
+    tuner->windowBytes = 0;
+    int previous = tuner->level;
+
+    if(!tuner->warmedUp){
+        tuner->warmedUp = 1;
+        return 0;
+    }
+
+    // Settled - stay there a while, then climb again from here
+    if(tuner->settled){
+        if(++tuner->settledWindows >= AUTO_TUNE_REPROBE){
+            tuner->settled = 0;
+            tuner->turned = 0;
+            tuner->direction = 1;
+            tuner->bestLevel = tuner->level;
+        }
+        return 0;
+    }
+
+    if(tuner->level == tuner->bestLevel){
+        // (Re)measure the level we climb from
+        tuner->bestRate = rate;
+    }
+    else if(rate > tuner->bestRate * (1 + AUTO_TUNE_GAIN)){
+        // Better - keep going this way
+        tuner->bestLevel = tuner->level;
+        tuner->bestRate = rate;
+        tuner->turned = 1;
+    }
+    else if(tuner->turned){
+        settle(tuner);
+        return tuner->level != previous;
+    }
+    else {
+        // The first step didn't help, try the other way
+        tuner->turned = 1;
+        tuner->direction = -tuner->direction;
+    }
+
+    int next = tuner->bestLevel + tuner->direction;
+    if(next < tuner->minLevel || next > tuner->maxLevel){
+        if(tuner->turned){
+            settle(tuner);
+            return tuner->level != previous;
+        }
+        tuner->turned = 1;
+        tuner->direction = -tuner->direction;
+        next = tuner->bestLevel + tuner->direction;
+        if(next < tuner->minLevel || next > tuner->maxLevel){
+            settle(tuner);
+            return tuner->level != previous;
+        }
+    }
+    tuner->level = next;
+    return tuner->level != previous;
+}
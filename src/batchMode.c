@@ -0,0 +1,425 @@
+#include "../include/batchMode.h"
+
+/*
+ * Appends a path to a growing array.
+ */
+static int appendPath(char*** paths, long* count, long* capacity, const char* path){
+    if(*count == *capacity){
+        long grown = *capacity > 0 ? *capacity * 2 : 64;
+        char** larger = (char**)realloc(*paths, grown * sizeof(char*));
+        if(larger == NULL){
+            fprintf(stderr, "Error: Failed to allocate the batch file list.\n");
+            return 0;
+        }
+        *paths = larger;
+        *capacity = grown;
+    }
+    (*paths)[*count] = strdup(path);
+    if((*paths)[*count] == NULL){
+        fprintf(stderr, "Error: Failed to allocate the batch file list.\n");
+        return 0;
+    }
+    (*count)++;
+    return 1;
+}
+
+
+int listBatchFiles(const char* path, char*** paths, long* count){
+    *paths = NULL;
+    *count = 0;
+    long capacity = 0;
+
+    struct stat info;
+    if(stat(path, &info) != 0){
+        fprintf(stderr, "Error: Can't open the batch %s: %s.\n", path, strerror(errno));
+        return 0;
+    }
+
+    // A directory - its regular files
+    if(S_ISDIR(info.st_mode)){
+        DIR* dir = opendir(path);
+        if(dir == NULL){
+            fprintf(stderr, "Error: Can't open the directory %s: %s.\n", path, strerror(errno));
+            return 0;
+        }
+        struct dirent* entry;
+        while((entry = readdir(dir)) != NULL){
+            char* filePath = (char*)malloc(strlen(path) + strlen(entry->d_name) + 2);
+            if(filePath == NULL){
+                fprintf(stderr, "Error: Failed to allocate the batch file list.\n");
+                closedir(dir);
+                return 0;
+            }
+            sprintf(filePath, "%s/%s", path, entry->d_name);
+            int added = 1;
+            if(stat(filePath, &info) == 0 && S_ISREG(info.st_mode)){
+                added = appendPath(paths, count, &capacity, filePath);
+            }
+            free(filePath);
+            if(!added){
+                closedir(dir);
+                return 0;
+            }
+        }
+        closedir(dir);
+        return 1;
+    }
+
+    // A list of paths, one per line (empty lines are skipped)
+    FILE* list = fopen(path, "r");
+    if(list == NULL){
+        fprintf(stderr, "Error: Can't open the batch list %s: %s.\n", path, strerror(errno));
+        return 0;
+    }
+    char* line = NULL;
+    size_t lineSize = 0;
+    ssize_t length;
+    while((length = getline(&line, &lineSize, list)) >= 0){
+        while(length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')){
+            line[--length] = '\0';
+        }
+        if(length > 0 && !appendPath(paths, count, &capacity, line)){
+            free(line);
+            fclose(list);
+            return 0;
+        }
+    }
+    free(line);
+    fclose(list);
+    return 1;
+}
+
+
+static int compareOutputs(const void* a, const void* b){
+    const batchFile* first = *(const batchFile* const*)a;
+    const batchFile* second = *(const batchFile* const*)b;
+    return strcmp(first->outputPath, second->outputPath);
+}
+
+
+/*
+ * Adds a segment, to a new unit when the current one is full (or when asked to).
+ */
+static void addSegment(batchJob* job, long file, long offset, long length, long* unitBytes, int newUnit){
+    if(newUnit || job->unitCount == 0 || *unitBytes >= job->chunkSize){
+        batchUnit* unit = &job->units[job->unitCount++];
+        unit->firstSegment = job->segmentCount;
+        unit->segmentCount = 0;
+        *unitBytes = 0;
+    }
+
+    batchSegment* segment = &job->segments[job->segmentCount++];
+    segment->file = file;
+    segment->offset = offset;
+    segment->length = length;
+    job->units[job->unitCount - 1].segmentCount++;
+    *unitBytes += length;
+    atomic_fetch_add(&job->files[file].pending, 1);
+}
+
+
+/*
+ * Releases a job that couldn't be planned, it stays empty (batchJobFree() can still be called on it).
+ */
+static int abandonPlan(batchJob* job){
+    batchJobFree(job);
+    memset(job, 0, sizeof(batchJob));
+    return 0;
+}
+
+
+int planBatch(batchJob* job, char** paths, long count, const char* outputDir, const uint8_t* key, long keySize, long chunkSize){
+    memset(job, 0, sizeof(batchJob));
+    job->key = key;
+    job->keySize = keySize;
+    job->keyCache = NULL;
+    job->chunkSize = chunkSize;
+    atomic_init(&job->nextUnit, 0);
+    atomic_init(&job->failed, 0);
+
+    job->files = (batchFile*)calloc(count > 0 ? count : 1, sizeof(batchFile));
+    if(job->files == NULL){
+        fprintf(stderr, "Error: Failed to allocate the batch.\n");
+        for(long i = 0; i < count; i++){
+            free(paths[i]);
+        }
+        return 0;
+    }
+    job->fileCount = count;
+    for(long i = 0; i < count; i++){
+        batchFile* file = &job->files[i];
+        file->inputPath = paths[i];
+        file->inputFd = -1;
+        file->outputFd = -1;
+        atomic_init(&file->pending, 0);
+        pthread_mutex_init(&file->mutexFile, NULL);
+    }
+
+    // Name the outputs and get the sizes (and the number of segments: a big file's chunks, plus one for its tail)
+    long segments = 0;
+    for(long i = 0; i < count; i++){
+        batchFile* file = &job->files[i];
+
+        const char* baseName = strrchr(paths[i], '/');
+        baseName = baseName != NULL ? baseName + 1 : paths[i];
+        file->outputPath = (char*)malloc(strlen(outputDir) + strlen(baseName) + 2);
+        if(file->outputPath == NULL){
+            fprintf(stderr, "Error: Failed to allocate the batch.\n");
+            return abandonPlan(job);
+        }
+        sprintf(file->outputPath, "%s/%s", outputDir, baseName);
+
+        struct stat input;
+        struct stat output;
+        // A missing input is reported and skipped like one that fails later, the batch ends as failed
+        if(stat(file->inputPath, &input) != 0 || !S_ISREG(input.st_mode)){
+            fprintf(stderr, "Error: %s is not a readable regular file, skipping it.\n", file->inputPath);
+            file->state = -1;
+            atomic_store(&job->failed, 1);
+            continue;
+        }
+        if(stat(file->outputPath, &output) == 0 && output.st_dev == input.st_dev && output.st_ino == input.st_ino){
+            fprintf(stderr, "Error: The output of %s would overwrite it, use another output directory.\n", file->inputPath);
+            return abandonPlan(job);
+        }
+        file->size = input.st_size;
+        segments += file->size / chunkSize + 1;
+    }
+
+    // Two inputs with the same base name would end up in the same output
+    if(count > 1){
+        batchFile** sorted = (batchFile**)malloc(count * sizeof(batchFile*));
+        if(sorted == NULL){
+            fprintf(stderr, "Error: Failed to allocate the batch.\n");
+            return abandonPlan(job);
+        }
+        long planned = 0;
+        for(long i = 0; i < count; i++){
+            if(job->files[i].state == 0){
+                sorted[planned++] = &job->files[i];
+            }
+        }
+        qsort(sorted, planned, sizeof(batchFile*), compareOutputs);
+        for(long i = 1; i < planned; i++){
+            if(strcmp(sorted[i - 1]->outputPath, sorted[i]->outputPath) == 0){
+                fprintf(stderr, "Error: %s and %s would both be written to %s.\n", sorted[i - 1]->inputPath, sorted[i]->inputPath, sorted[i]->outputPath);
+                free(sorted);
+                return abandonPlan(job);
+            }
+        }
+        free(sorted);
+    }
+
+    job->segments = (batchSegment*)malloc((segments > 0 ? segments : 1) * sizeof(batchSegment));
+    job->units = (batchUnit*)malloc((segments > 0 ? segments : 1) * sizeof(batchUnit));
+    if(job->segments == NULL || job->units == NULL){
+        fprintf(stderr, "Error: Failed to allocate the batch.\n");
+        return abandonPlan(job);
+    }
+
+    // Whole chunks of the big files get a unit each, what's left of every file (small files, tails) is packed.
+    // Every file gets at least one segment, so even an empty one gets its (empty) output.
+    long unitBytes = 0;
+    for(long i = 0; i < count; i++){
+        if(job->files[i].state != 0){
+            continue;
+        }
+        long offset = 0;
+        for(; job->files[i].size - offset >= chunkSize; offset += chunkSize){
+            addSegment(job, i, offset, chunkSize, &unitBytes, 1);
+        }
+        if(offset < job->files[i].size || job->files[i].size == 0){
+            addSegment(job, i, offset, job->files[i].size - offset, &unitBytes, 0);
+        }
+    }
+
+    return 1;
+}
+
+
+/*
+ * Opens a file's input and output, the first time one of its segments is worked on.
+ */
+static int openBatchFile(batchFile* file){
+    pthread_mutex_lock(&file->mutexFile);
+    if(file->state == 0){
+        file->inputFd = open(file->inputPath, O_RDONLY | O_CLOEXEC);
+        if(file->inputFd < 0){
+            fprintf(stderr, "Error: Can't open %s: %s.\n", file->inputPath, strerror(errno));
+        }
+        else {
+            file->outputFd = open(file->outputPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if(file->outputFd < 0){
+                fprintf(stderr, "Error: Can't create %s: %s.\n", file->outputPath, strerror(errno));
+            }
+        }
+        file->state = file->inputFd >= 0 && file->outputFd >= 0 ? 1 : -1;
+    }
+    int state = file->state;
+    pthread_mutex_unlock(&file->mutexFile);
+    return state == 1;
+}
+
+
+/*
+ * Marks one of a file's segments done, the last one closes the file.
+ */
+static void releaseBatchFile(batchFile* file){
+    if(atomic_fetch_sub(&file->pending, 1) == 1){
+        if(file->inputFd >= 0){
+            close(file->inputFd);
+        }
+        if(file->outputFd >= 0 && close(file->outputFd) != 0){
+            fprintf(stderr, "Error: Failed to close %s: %s.\n", file->outputPath, strerror(errno));
+        }
+        file->inputFd = -1;
+        file->outputFd = -1;
+    }
+}
+
+
+/*
+ * Reads, encrypts and writes one segment, through the worker's buffer.
+ */
+static int encryptSegment(batchJob* job, const batchSegment* segment, KeyCursor* cursor, uint8_t* buffer){
+    batchFile* file = &job->files[segment->file];
+    if(!openBatchFile(file)){
+        return 0;
+    }
+
+    long done = 0;
+    while(done < segment->length){
+        ssize_t bytes = pread(file->inputFd, buffer + done, segment->length - done, segment->offset + done);
+        if(bytes < 0 && errno == EINTR){
+            continue;
+        }
+        if(bytes <= 0){
+            fprintf(stderr, "Error: Failed to read %s: %s.\n", file->inputPath, bytes < 0 ? strerror(errno) : "it got shorter");
+            return 0;
+        }
+        done += bytes;
+    }
+
+    keyCursorEncrypt(cursor, buffer, buffer, segment->length, segment->offset / job->keySize);
+
+    done = 0;
+    while(done < segment->length){
+        ssize_t bytes = pwrite(file->outputFd, buffer + done, segment->length - done, segment->offset + done);
+        if(bytes < 0 && errno == EINTR){
+            continue;
+        }
+        if(bytes <= 0){
+            fprintf(stderr, "Error: Failed to write %s: %s.\n", file->outputPath, bytes < 0 ? strerror(errno) : "no progress");
+            return 0;
+        }
+        done += bytes;
+    }
+    return 1;
+}
+
+
+static void* batchThreadFunction(void* arg){
+    batchJob* job = (batchJob*)arg;
+
+    KeyCursor cursor;
+    if(!keyCursorInit(&cursor, job->key, job->keySize)){
+        atomic_store(&job->failed, 1);
+        return NULL;
+    }
+    keyCursorSetCache(&cursor, job->keyCache);
+    void* buffer = NULL;
+    if(posix_memalign(&buffer, 4096, job->chunkSize) != 0){
+        fprintf(stderr, "Error: Failed to allocate a batch buffer.\n");
+        keyCursorFree(&cursor);
+        atomic_store(&job->failed, 1);
+        return NULL;
+    }
+
+    // Claim the next unit until there's none left
+    while(1){
+        long index = atomic_fetch_add(&job->nextUnit, 1);
+        if(index >= job->unitCount){
+            break;
+        }
+        batchUnit* unit = &job->units[index];
+        for(long i = unit->firstSegment; i < unit->firstSegment + unit->segmentCount; i++){
+            if(!encryptSegment(job, &job->segments[i], &cursor, (uint8_t*)buffer)){
+                atomic_store(&job->failed, 1);
+            }
+            releaseBatchFile(&job->files[job->segments[i].file]);
+        }
+    }
+
+    free(buffer);
+    keyCursorFree(&cursor);
+    return NULL;
+}
+
+
+int runBatch(batchJob* job, int threadsNum){
+    // No more threads than units
+    if(threadsNum > job->unitCount - 1){
+        threadsNum = job->unitCount > 0 ? job->unitCount - 1 : 0;
+    }
+
+    pthread_t threads[threadsNum + 1];
+    int created = 0;
+    for(; created < threadsNum; created++){
+        if(pthread_create(&threads[created], NULL, &batchThreadFunction, job) != 0){
+            // Fewer threads only means less parallelism, the others (and this one) claim the rest
+            break;
+        }
+    }
+    batchThreadFunction(job);
+
+    for(int i = 0; i < created; i++){
+        if(pthread_join(threads[i], NULL) != 0){
+            atomic_store(&job->failed, 1);
+        }
+    }
+    return !atomic_load(&job->failed);
+}
+
+
+void batchJobFree(batchJob* job){
+    for(long i = 0; i < job->fileCount; i++){
+        free(job->files[i].inputPath);
+        free(job->files[i].outputPath);
+        pthread_mutex_destroy(&job->files[i].mutexFile);
+    }
+    free(job->files);
+    free(job->segments);
+    free(job->units);
+}
+
+
+int encryptBatch(const char* listPath, const char* outputDir, const uint8_t* key, long keySize, KeyCache* keyCache, long chunkSize, int threadsNum){
+    char** paths;
+    long count;
+    if(!listBatchFiles(listPath, &paths, &count)){
+        for(long i = 0; i < count; i++){
+            free(paths[i]);
+        }
+        free(paths);
+        return 0;
+    }
+
+    struct stat info;
+    if(stat(outputDir, &info) != 0 || !S_ISDIR(info.st_mode)){
+        fprintf(stderr, "Error: The batch output %s is not a directory.\n", outputDir);
+        for(long i = 0; i < count; i++){
+            free(paths[i]);
+        }
+        free(paths);
+        return 0;
+    }
+
+    // The job owns the paths from here
+    batchJob job;
+    int done = planBatch(&job, paths, count, outputDir, key, keySize, chunkSize);
+    job.keyCache = keyCache;
+    done = done && runBatch(&job, threadsNum);
+    batchJobFree(&job);
+    free(paths);
+    return done;
+}
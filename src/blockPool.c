@@ -0,0 +1,280 @@
+#include "../include/blockPool.h"
+
+#include <sys/resource.h>
+#include <sys/mman.h>
+
+/*
+ * The free nodes cached by the current thread, linked through node->next.
+ * A thread only caches nodes of one pool at a time.
+ */
+static __thread BlockPool* cachePool = NULL;
+static __thread Node* cacheHead = NULL;
+static __thread int cacheCount = 0;
+
+
+/*
+ * Maps the buffer arena: explicit huge pages if enough are reserved (the mapping fails otherwise, no SIGBUS later), else regular pages at a 2 MiB
+ * boundary (the unaligned head and tail are given back) with the transparent huge page hint.
+ */
+static uint8_t* mapArena(long size, int* pages){
+#ifdef MAP_HUGETLB
+    long hugeSize = (size + POOL_HUGE_PAGE - 1) / POOL_HUGE_PAGE * POOL_HUGE_PAGE;
+    void* huge = mmap(NULL, hugeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(huge != MAP_FAILED){
+        *pages = POOL_PAGES_HUGETLB;
+        return (uint8_t*)huge;
+    }
+#endif
+
+    void* mapped = mmap(NULL, size + POOL_HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mapped == MAP_FAILED){
+        return NULL;
+    }
+    uintptr_t start = ((uintptr_t)mapped + POOL_HUGE_PAGE - 1) & ~(uintptr_t)(POOL_HUGE_PAGE - 1);
+    if(start > (uintptr_t)mapped){
+        munmap(mapped, start - (uintptr_t)mapped);
+    }
+    munmap((uint8_t*)start + size, (uintptr_t)mapped + POOL_HUGE_PAGE - start);
+
+    *pages = POOL_PAGES_HEAP;
+#ifdef MADV_HUGEPAGE
+    if(madvise((void*)start, size, MADV_HUGEPAGE) == 0){
+        *pages = POOL_PAGES_THP;
+    }
+#endif
+    return (uint8_t*)start;
+}
+
+
+/*
+ * The default lock of the shared free list.
+ */
+static void lockPlain(pthread_mutex_t* mutex){
+    pthread_mutex_lock(mutex);
+}
+
+
+BlockPool* createBlockPool(long blockSize, long depth){
+    if(blockSize <= 0 || depth <= 0){
+        fprintf(stderr, "Error: The pool block size and depth must be > 0.\n");
+        return NULL;
+    }
+
+    BlockPool* pool = (BlockPool*)malloc(sizeof(BlockPool));
+    if(pool == NULL){
+        fprintf(stderr, "Error: Failed to allocate memory for the pool.\n");
+        return NULL;
+    }
+
+    pool->slab = (Node*)calloc(depth, sizeof(Node));
+    if(pool->slab == NULL){
+        fprintf(stderr, "Error: Failed to allocate memory for the node slab.\n");
+        free(pool);
+        return NULL;
+    }
+
+    // All the slab nodes start in the free list, without data buffers yet
+    pool->freeList = NULL;
+    for(long i = depth - 1; i >= 0; i--){
+        pool->slab[i].owner = -1;
+        pool->slab[i].next = pool->freeList;
+        pool->freeList = &pool->slab[i];
+    }
+
+    // The slab's buffers, page aligned so they can be read into and spliced out whole pages at a time
+    pool->stride = (blockSize + POOL_ALIGNMENT - 1) / POOL_ALIGNMENT * POOL_ALIGNMENT;
+    pool->arenaSize = pool->stride * depth;
+    pool->arena = mapArena(pool->arenaSize, &pool->pages);
+    if(pool->arena == NULL){
+        pool->arenaSize = 0;
+        pool->pages = POOL_PAGES_HEAP;
+    }
+
+    pool->blockSize = blockSize;
+    pool->depth = depth;
+    pthread_mutex_init(&pool->mutexPool, NULL);
+    pool->lockMutex = lockPlain;
+    atomic_init(&pool->heapAllocations, 0);
+    atomic_init(&pool->acquired, 0);
+    atomic_init(&pool->recycled, 0);
+    atomic_init(&pool->inUse, 0);
+    atomic_init(&pool->peakInUse, 0);
+
+    return pool;
+}
+
+
+void poolSetLockHook(BlockPool* pool, void (*lockMutex)(pthread_mutex_t* mutex)){
+    pool->lockMutex = lockMutex != NULL ? lockMutex : lockPlain;
+}
+
+
+/*
+ * Checks if the node was carved from the pool's slab (or allocated on its own when the pool ran dry).
+ */
+static int inSlab(BlockPool* pool, Node* node){
+    return node >= pool->slab && node < pool->slab + pool->depth;
+}
+
+
+/*
+ * Makes sure the current thread's cache belongs to the given pool.
+ */
+static void bindCache(BlockPool* pool){
+    if(cachePool != pool){
+        if(cachePool != NULL){
+            poolFlushCache(cachePool);
+        }
+        cachePool = pool;
+    }
+}
+
+
+Node* poolAcquire(BlockPool* pool){
+    bindCache(pool);
+
+    // Refill the cache with a batch from the shared free list
+    if(cacheHead == NULL){
+        pool->lockMutex(&pool->mutexPool);
+        while(pool->freeList != NULL && cacheCount < POOL_CACHE_SIZE / 2){
+            Node* node = pool->freeList;
+            pool->freeList = node->next;
+            node->next = cacheHead;
+            cacheHead = node;
+            cacheCount++;
+        }
+        pthread_mutex_unlock(&pool->mutexPool);
+    }
+
+    Node* node = cacheHead;
+    if(node != NULL){
+        cacheHead = node->next;
+        cacheCount--;
+    }
+    else {
+        // More blocks in flight than the slab holds - grow, the node will be recycled like the others
+        node = (Node*)calloc(1, sizeof(Node));
+        if(node == NULL){
+            fprintf(stderr, "Error: Failed to allocate memory for the node.\n");
+            return NULL;
+        }
+        node->owner = -1;
+        atomic_fetch_add(&pool->heapAllocations, 1);
+    }
+
+    // First use of this node - give it its data buffer
+    if(node->data != NULL){
+        atomic_fetch_add(&pool->recycled, 1);
+    }
+    else if(pool->arena != NULL && inSlab(pool, node)){
+        node->data = pool->arena + (node - pool->slab) * pool->stride;
+    }
+    else {
+        void* data = NULL;
+        if(posix_memalign(&data, POOL_ALIGNMENT, pool->blockSize) != 0){
+            data = NULL;
+        }
+        node->data = (uint8_t*)data;
+        if(node->data == NULL){
+            fprintf(stderr, "Error: Failed to allocate memory for the block.\n");
+            poolRelease(pool, node);
+            return NULL;
+        }
+        atomic_fetch_add(&pool->heapAllocations, 1);
+    }
+
+    node->next = NULL;
+    node->blockSize = pool->blockSize;
+    atomic_fetch_add(&pool->acquired, 1);
+
+    long inUse = atomic_fetch_add(&pool->inUse, 1) + 1;
+    long peak = atomic_load(&pool->peakInUse);
+    while(inUse > peak && !atomic_compare_exchange_weak(&pool->peakInUse, &peak, inUse)){
+    }
+
+    return node;
+}
+
+
+void poolRelease(BlockPool* pool, Node* node){
+    if(node == NULL){
+        return;
+    }
+    bindCache(pool);
+
+    node->next = cacheHead;
+    cacheHead = node;
+    cacheCount++;
+    atomic_fetch_sub(&pool->inUse, 1);
+
+    // Cache full - hand a batch back to the shared free list
+    if(cacheCount >= POOL_CACHE_SIZE){
+        pool->lockMutex(&pool->mutexPool);
+        while(cacheCount > POOL_CACHE_SIZE / 2){
+            Node* cached = cacheHead;
+            cacheHead = cached->next;
+            cached->next = pool->freeList;
+            pool->freeList = cached;
+            cacheCount--;
+        }
+        pthread_mutex_unlock(&pool->mutexPool);
+    }
+}
+
+
+void poolFlushCache(BlockPool* pool){
+    if(cachePool != pool){
+        return;
+    }
+
+    pool->lockMutex(&pool->mutexPool);
+    while(cacheHead != NULL){
+        Node* cached = cacheHead;
+        cacheHead = cached->next;
+        cached->next = pool->freeList;
+        pool->freeList = cached;
+    }
+    pthread_mutex_unlock(&pool->mutexPool);
+
+    cacheCount = 0;
+    cachePool = NULL;
+}
+
+
+void poolReport(BlockPool* pool){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    const char* pages = pool->pages == POOL_PAGES_HUGETLB ? "explicit huge pages" : pool->pages == POOL_PAGES_THP ? "transparent huge pages" : "regular pages";
+    fprintf(stderr, "pool: %ld blocks of %ld bytes used, %ld recycled, %ld heap allocations, peak %ld blocks in flight, peak RSS %ld KiB\n",
+            atomic_load(&pool->acquired), pool->blockSize, atomic_load(&pool->recycled), atomic_load(&pool->heapAllocations),
+            atomic_load(&pool->peakInUse), usage.ru_maxrss);
+    fprintf(stderr, "pool: %ld bytes of slab buffers on %s\n", pool->arenaSize, pool->arena != NULL ? pages : "the heap");
+}
+
+
+void poolDestroy(BlockPool* pool){
+    if(pool == NULL){
+        return;
+    }
+    poolFlushCache(pool);
+
+    while(pool->freeList != NULL){
+        Node* node = pool->freeList;
+        pool->freeList = node->next;
+        if(pool->arena == NULL || !inSlab(pool, node)){
+            free(node->data);
+        }
+        if(!inSlab(pool, node)){
+            free(node);
+        }
+    }
+
+    if(pool->arena != NULL){
+        long size = pool->pages == POOL_PAGES_HUGETLB ? (pool->arenaSize + POOL_HUGE_PAGE - 1) / POOL_HUGE_PAGE * POOL_HUGE_PAGE : pool->arenaSize;
+        munmap(pool->arena, size);
+    }
+    pthread_mutex_destroy(&pool->mutexPool);
+    free(pool->slab);
+    free(pool);
+}
@@ -0,0 +1,211 @@
+#include "../include/checksum.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static uint32_t crcResolve(uint32_t crc, const uint8_t* data, long length);
+
+typedef uint32_t (*crcFunc)(uint32_t crc, const uint8_t* data, long length);
+
+// The implementation used by crc32cUpdate(), on the raw (not inverted) CRC, picked once on first use unless
+// crc32cInit() was called. Threads may get there at the same time: it's atomic, stored after the tables it uses.
+static _Atomic(crcFunc) activeCrc = crcResolve;
+static pthread_once_t resolveOnce = PTHREAD_ONCE_INIT;
+
+// Slicing-by-8 tables: crcTable[k][n] is the CRC of byte n followed by k zero bytes
+static uint32_t crcTable[8][256];
+
+// Shift tables: the CRC of 4 bytes moved over CRC32C_LONG (or CRC32C_SHORT) zero bytes, one table per byte
+static uint32_t longShift[4][256];
+static uint32_t shortShift[4][256];
+
+// x^(2^n) modulo the polynomial, for crc32cCombine()
+static uint32_t powerTable[32];
+
+
+/*
+ * Multiplies two polynomials modulo the CRC polynomial (reflected: bit 31 is x^0).
+ */
+static uint32_t multiplyModPoly(uint32_t a, uint32_t b){
+    uint32_t product = 0;
+    for(uint32_t mask = 1U << 31; mask != 0; mask >>= 1){
+        if(a & mask){
+            product ^= b;
+        }
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return product;
+}
+
+
+/*
+ * x^(8 * bytes) modulo the polynomial: multiplying a CRC by it appends that many zero bytes.
+ */
+static uint32_t zeroBytesPower(long bytes){
+    uint32_t power = 1U << 31;
+    for(int k = 3; bytes != 0; bytes >>= 1, k++){
+        if(bytes & 1){
+            power = multiplyModPoly(powerTable[k & 31], power);
+        }
+    }
+    return power;
+}
+
+
+static void buildShiftTable(uint32_t table[4][256], long bytes){
+    uint32_t power = zeroBytesPower(bytes);
+    for(int k = 0; k < 4; k++){
+        for(uint32_t n = 0; n < 256; n++){
+            table[k][n] = multiplyModPoly(power, n << (8 * k));
+        }
+    }
+}
+
+
+static inline uint32_t shiftCrc(uint32_t table[4][256], uint32_t crc){
+    return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF] ^ table[2][(crc >> 16) & 0xFF] ^ table[3][crc >> 24];
+}
+
+
+static uint32_t crcSoftware(uint32_t crc, const uint8_t* data, long length){
+    while(length > 0 && ((uintptr_t)data & 7) != 0){
+        crc = crcTable[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+        length--;
+    }
+
+    // Eight bytes at a time (the word is little-endian, its first byte goes with the CRC's low byte)
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for(; length >= 8; data += 8, length -= 8){
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        word ^= crc;
+        crc = crcTable[7][word & 0xFF] ^ crcTable[6][(word >> 8) & 0xFF] ^ crcTable[5][(word >> 16) & 0xFF] ^ crcTable[4][(word >> 24) & 0xFF]
+            ^ crcTable[3][(word >> 32) & 0xFF] ^ crcTable[2][(word >> 40) & 0xFF] ^ crcTable[1][(word >> 48) & 0xFF] ^ crcTable[0][word >> 56];
+    }
+#endif
+
+    while(length > 0){
+        crc = crcTable[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+        length--;
+    }
+    return crc;
+}
+
+
+#if defined(__x86_64__)
+
+/*
+ * Three lanes of laneSize bytes at once, then the lanes' CRCs are shifted over the lanes after them and joined.
+ */
+__attribute__((target("sse4.2")))
+static inline uint64_t crcLanes(uint64_t crc, const uint8_t** data, long* length, long laneSize, uint32_t table[4][256]){
+    const uint8_t* position = *data;
+    while(*length >= 3 * laneSize){
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+        const uint8_t* end = position + laneSize;
+        for(; position < end; position += 8){
+            uint64_t word0, word1, word2;
+            memcpy(&word0, position, sizeof(word0));
+            memcpy(&word1, position + laneSize, sizeof(word1));
+            memcpy(&word2, position + 2 * laneSize, sizeof(word2));
+            crc = _mm_crc32_u64(crc, word0);
+            crc1 = _mm_crc32_u64(crc1, word1);
+            crc2 = _mm_crc32_u64(crc2, word2);
+        }
+        crc = shiftCrc(table, (uint32_t)crc) ^ crc1;
+        crc = shiftCrc(table, (uint32_t)crc) ^ crc2;
+        position += 2 * laneSize;
+        *length -= 3 * laneSize;
+    }
+    *data = position;
+    return crc;
+}
+
+
+__attribute__((target("sse4.2")))
+static uint32_t crcHardware(uint32_t crc, const uint8_t* data, long length){
+    while(length > 0 && ((uintptr_t)data & 7) != 0){
+        crc = _mm_crc32_u8(crc, *data++);
+        length--;
+    }
+
+    uint64_t crc64 = crcLanes(crc, &data, &length, CRC32C_LONG, longShift);
+    crc64 = crcLanes(crc64, &data, &length, CRC32C_SHORT, shortShift);
+    for(; length >= 8; data += 8, length -= 8){
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+
+    crc = (uint32_t)crc64;
+    while(length > 0){
+        crc = _mm_crc32_u8(crc, *data++);
+        length--;
+    }
+    return crc;
+}
+
+#endif
+
+
+const char* crc32cInit(){
+    for(uint32_t n = 0; n < 256; n++){
+        uint32_t crc = n;
+        for(int bit = 0; bit < 8; bit++){
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crcTable[0][n] = crc;
+    }
+    for(uint32_t n = 0; n < 256; n++){
+        for(int k = 1; k < 8; k++){
+            crcTable[k][n] = crcTable[0][crcTable[k - 1][n] & 0xFF] ^ (crcTable[k - 1][n] >> 8);
+        }
+    }
+
+    // x^1, then each power of two is the square of the previous one
+    powerTable[0] = 1U << 30;
+    for(int n = 1; n < 32; n++){
+        powerTable[n] = multiplyModPoly(powerTable[n - 1], powerTable[n - 1]);
+    }
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse4.2")){
+        buildShiftTable(longShift, CRC32C_LONG);
+        buildShiftTable(shortShift, CRC32C_SHORT);
+        atomic_store_explicit(&activeCrc, crcHardware, memory_order_release);
+        return "sse4.2";
+    }
+#endif
+    atomic_store_explicit(&activeCrc, crcSoftware, memory_order_release);
+    return "table";
+}
+
+
+static void resolveCrc(){
+    if(atomic_load_explicit(&activeCrc, memory_order_relaxed) == crcResolve){
+        crc32cInit();
+    }
+}
+
+
+static uint32_t crcResolve(uint32_t crc, const uint8_t* data, long length){
+    pthread_once(&resolveOnce, resolveCrc);
+    return atomic_load_explicit(&activeCrc, memory_order_acquire)(crc, data, length);
+}
+
+
+uint32_t crc32cUpdate(uint32_t crc, const uint8_t* data, long length){
+    return ~atomic_load_explicit(&activeCrc, memory_order_acquire)(~crc, data, length);
+}
+
+
+uint32_t crc32cCombine(uint32_t first, uint32_t second, long secondLength){
+    pthread_once(&resolveOnce, resolveCrc);
+    return multiplyModPoly(zeroBytesPower(secondLength), first) ^ second;
+}
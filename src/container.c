@@ -0,0 +1,822 @@
+#include "../include/container.h"
+
+#define CONTAINER_HEADER_SIZE ((long)sizeof(containerHeader))
+#define CONTAINER_FRAME_SIZE ((long)sizeof(containerChunk))
+
+_Static_assert(sizeof(containerHeader) == 64, "The container header must be 64 bytes");
+_Static_assert(sizeof(containerChunk) == 24, "A container frame must be 24 bytes");
+_Static_assert(sizeof(containerFooter) == 32, "The container footer must be 32 bytes");
+
+
+/*
+ * Data structure to hold what the threads of extractContainer() share.
+ * inBase and outBase are where the container starts in stdin and the plaintext starts in stdout.
+ */
+typedef struct extractJob{
+    const uint8_t* key;
+    long keySize;
+    KeyCache* keyCache;
+    long chunkSize;
+    long inBase;
+    long outBase;
+    const containerChunk* chunks;
+    long last;
+    int resume;
+    atomic_long nextChunk;
+    atomic_long skipped;
+    atomic_int failed;
+
+} extractJob;
+
+
+/*
+ * Converts between host and file (little-endian) byte order, both ways.
+ */
+static void headerByteOrder(containerHeader* header){
+    header->version = htole32(header->version);
+    header->headerSize = htole32(header->headerSize);
+    header->keyFingerprint = htole64(header->keyFingerprint);
+    header->keySize = htole64(header->keySize);
+    header->chunkSize = htole64(header->chunkSize);
+    header->totalBytes = htole64(header->totalBytes);
+    header->totalChunks = htole64(header->totalChunks);
+    header->reserved = htole64(header->reserved);
+}
+
+
+static void chunkByteOrder(containerChunk* chunk){
+    chunk->magic = htole32(chunk->magic);
+    chunk->length = htole32(chunk->length);
+    chunk->number = htole64(chunk->number);
+    chunk->cipherCrc = htole32(chunk->cipherCrc);
+    chunk->reserved = htole32(chunk->reserved);
+}
+
+
+static void footerByteOrder(containerFooter* footer){
+    footer->magic = htole32(footer->magic);
+    footer->indexCrc = htole32(footer->indexCrc);
+    footer->indexOffset = htole64(footer->indexOffset);
+    footer->totalChunks = htole64(footer->totalChunks);
+    footer->totalBytes = htole64(footer->totalBytes);
+}
+
+
+static int writeAll(int fd, const void* data, long length){
+    long done = 0;
+    while(done < length){
+        ssize_t bytes = write(fd, (const uint8_t*)data + done, length - done);
+        if(bytes < 0 && errno == EINTR){
+            continue;
+        }
+        if(bytes <= 0){
+            perror("Error: writing the container");
+            return 0;
+        }
+        done += bytes;
+    }
+    return 1;
+}
+
+
+static int pwriteAll(int fd, const void* data, long length, long offset){
+    long done = 0;
+    while(done < length){
+        ssize_t bytes = pwrite(fd, (const uint8_t*)data + done, length - done, offset + done);
+        if(bytes < 0 && errno == EINTR){
+            continue;
+        }
+        if(bytes <= 0){
+            perror("Error: writing the output");
+            return 0;
+        }
+        done += bytes;
+    }
+    return 1;
+}
+
+
+/*
+ * Reads up to length bytes at offset (or at the current position when offset is -1).
+ * Returns the number of bytes read, short at the end of the file, or -1 on error.
+ */
+static long readAt(int fd, void* data, long length, long offset){
+    long done = 0;
+    while(done < length){
+        ssize_t bytes = offset >= 0 ? pread(fd, (uint8_t*)data + done, length - done, offset + done) : read(fd, (uint8_t*)data + done, length - done);
+        if(bytes < 0 && errno == EINTR){
+            continue;
+        }
+        if(bytes < 0){
+            perror("Error: reading the container");
+            return -1;
+        }
+        if(bytes == 0){
+            break;
+        }
+        done += bytes;
+    }
+    return done;
+}
+
+
+/*
+ * Where chunk n's frame starts, from the start of the container.
+ */
+static inline long chunkOffset(long chunkSize, long n){
+    return CONTAINER_HEADER_SIZE + n * (CONTAINER_FRAME_SIZE + chunkSize);
+}
+
+
+/*
+ * SHA-256 (FIPS 180-4), only what keyFingerprint() needs.
+ */
+typedef struct sha256State{
+    uint32_t state[8];
+    uint8_t block[64];
+    long used;
+    uint64_t bytes;
+
+} sha256State;
+
+
+static const uint32_t sha256Rounds[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+static inline uint32_t rotateRight(uint32_t value, int bits){
+    return value >> bits | value << (32 - bits);
+}
+
+
+static void sha256Block(sha256State* sha, const uint8_t* block){
+    uint32_t w[64];
+    for(int i = 0; i < 16; i++){
+        w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 | (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+    }
+    for(int i = 16; i < 64; i++){
+        uint32_t s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t v[8];
+    memcpy(v, sha->state, sizeof(v));
+    for(int i = 0; i < 64; i++){
+        uint32_t s1 = rotateRight(v[4], 6) ^ rotateRight(v[4], 11) ^ rotateRight(v[4], 25);
+        uint32_t choice = (v[4] & v[5]) ^ (~v[4] & v[6]);
+        uint32_t t1 = v[7] + s1 + choice + sha256Rounds[i] + w[i];
+        uint32_t s0 = rotateRight(v[0], 2) ^ rotateRight(v[0], 13) ^ rotateRight(v[0], 22);
+        uint32_t majority = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+        memmove(&v[1], &v[0], 7 * sizeof(uint32_t));
+        v[4] += t1;
+        v[0] = t1 + s0 + majority;
+    }
+    for(int i = 0; i < 8; i++){
+        sha->state[i] += v[i];
+    }
+}
+
+
+static void sha256Init(sha256State* sha){
+    static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(sha->state, initial, sizeof(initial));
+    sha->used = 0;
+    sha->bytes = 0;
+}
+
+
+static void sha256Update(sha256State* sha, const uint8_t* data, long length){
+    sha->bytes += length;
+    while(length > 0){
+        long take = 64 - sha->used < length ? 64 - sha->used : length;
+        memcpy(sha->block + sha->used, data, take);
+        sha->used += take;
+        data += take;
+        length -= take;
+        if(sha->used == 64){
+            sha256Block(sha, sha->block);
+            sha->used = 0;
+        }
+    }
+}
+
+
+static void sha256Final(sha256State* sha, uint8_t digest[32]){
+    uint64_t bits = sha->bytes * 8;
+    uint8_t pad = 0x80;
+    sha256Update(sha, &pad, 1);
+    pad = 0;
+    while(sha->used != 56){
+        sha256Update(sha, &pad, 1);
+    }
+    uint8_t length[8];
+    for(int i = 0; i < 8; i++){
+        length[i] = (uint8_t)(bits >> (56 - 8 * i));
+    }
+    sha256Update(sha, length, sizeof(length));
+    for(int i = 0; i < 32; i++){
+        digest[i] = (uint8_t)(sha->state[i / 4] >> (24 - 8 * (i % 4)));
+    }
+}
+
+
+/*
+ * The first 64 bits of SHA-256("XORCTNR key" || key size || key): telling keys apart without giving bits of them away
+ * (a CRC of the key would be linear in its bits).
+ */
+static uint64_t keyFingerprint(const uint8_t* key, long keySize){
+    sha256State sha;
+    sha256Init(&sha);
+    sha256Update(&sha, (const uint8_t*)"XORCTNR key", strlen("XORCTNR key"));
+    uint64_t size = htole64((uint64_t)keySize);
+    sha256Update(&sha, (const uint8_t*)&size, sizeof(size));
+    sha256Update(&sha, key, keySize);
+    uint8_t digest[32];
+    sha256Final(&sha, digest);
+
+    uint64_t fingerprint;
+    memcpy(&fingerprint, digest, sizeof(fingerprint));
+    return le64toh(fingerprint);
+}
+
+
+void containerInitHeader(containerHeader* header, const uint8_t* key, long keySize, long chunkSize){
+    memset(header, 0, sizeof(containerHeader));
+    memcpy(header->magic, CONTAINER_MAGIC, sizeof(header->magic));
+    header->version = CONTAINER_VERSION;
+    header->headerSize = CONTAINER_HEADER_SIZE;
+    header->keyFingerprint = keyFingerprint(key, keySize);
+    header->keySize = keySize;
+    header->chunkSize = chunkSize;
+    header->totalBytes = CONTAINER_UNKNOWN;
+    header->totalChunks = CONTAINER_UNKNOWN;
+}
+
+
+int containerWriteHeader(int fd, const containerHeader* header){
+    containerHeader stored = *header;
+    headerByteOrder(&stored);
+    return writeAll(fd, &stored, sizeof(stored));
+}
+
+
+int containerAddChunk(ContainerIndex* index, long length, uint32_t cipherCrc, containerChunk* frame){
+    if(index->count == index->capacity){
+        long grown = index->capacity > 0 ? index->capacity * 2 : 1024;
+        containerChunk* larger = (containerChunk*)realloc(index->entries, grown * sizeof(containerChunk));
+        if(larger == NULL){
+            fprintf(stderr, "Error: Failed to allocate the container index.\n");
+            return 0;
+        }
+        index->entries = larger;
+        index->capacity = grown;
+    }
+
+    containerChunk* entry = &index->entries[index->count];
+    entry->magic = CONTAINER_ENTRY_MAGIC;
+    entry->length = (uint32_t)length;
+    entry->number = index->count;
+    entry->cipherCrc = cipherCrc;
+    entry->reserved = 0;
+    index->count++;
+    index->bytes += length;
+
+    *frame = *entry;
+    frame->magic = CONTAINER_CHUNK_MAGIC;
+    chunkByteOrder(frame);
+    return 1;
+}
+
+
+int containerFinish(int fd, long base, containerHeader* header, const ContainerIndex* index){
+    // The index in pieces, its CRC over the bytes as stored
+    containerChunk stored[1024];
+    uint32_t indexCrc = 0;
+    for(long i = 0; i < index->count; i += 1024){
+        long count = index->count - i < 1024 ? index->count - i : 1024;
+        for(long j = 0; j < count; j++){
+            stored[j] = index->entries[i + j];
+            chunkByteOrder(&stored[j]);
+        }
+        indexCrc = crc32cUpdate(indexCrc, (const uint8_t*)stored, count * CONTAINER_FRAME_SIZE);
+        if(!writeAll(fd, stored, count * CONTAINER_FRAME_SIZE)){
+            return 0;
+        }
+    }
+
+    containerFooter footer;
+    footer.magic = CONTAINER_FOOTER_MAGIC;
+    footer.indexCrc = indexCrc;
+    footer.indexOffset = CONTAINER_HEADER_SIZE + index->count * CONTAINER_FRAME_SIZE + index->bytes;
+    footer.totalChunks = index->count;
+    footer.totalBytes = index->bytes;
+    footerByteOrder(&footer);
+    if(!writeAll(fd, &footer, sizeof(footer))){
+        return 0;
+    }
+
+    header->totalBytes = index->bytes;
+    header->totalChunks = index->count;
+    if(base < 0){
+        return 1;
+    }
+    containerHeader patched = *header;
+    headerByteOrder(&patched);
+    return pwriteAll(fd, &patched, sizeof(patched), base);
+}
+
+
+/*
+ * Reads and checks the header at offset (-1 for the current position) against the key's and returns it in host order.
+ */
+static int readHeader(int fd, long offset, const containerHeader* expected, containerHeader* header){
+    long got = readAt(fd, header, sizeof(containerHeader), offset);
+    if(got < 0){
+        return 0;
+    }
+    headerByteOrder(header);
+    if(got < CONTAINER_HEADER_SIZE || memcmp(header->magic, CONTAINER_MAGIC, sizeof(header->magic)) != 0
+       || header->version != CONTAINER_VERSION || header->headerSize != CONTAINER_HEADER_SIZE){
+        fprintf(stderr, "Error: The input isn't a container (or a version this program doesn't know).\n");
+        return 0;
+    }
+    if(header->keyFingerprint != expected->keyFingerprint || header->keySize != expected->keySize){
+        fprintf(stderr, "Error: The container was made with another key.\n");
+        return 0;
+    }
+    if(header->chunkSize == 0 || header->chunkSize % header->keySize != 0 || header->chunkSize > (uint64_t)CONTAINER_MAX_CHUNK){
+        fprintf(stderr, "Error: The container's chunk size is invalid.\n");
+        return 0;
+    }
+    return 1;
+}
+
+
+/*
+ * Reads the frame of chunk n at offset (-1 for the current position) in host order.
+ * Returns 1 if it's the frame of chunk n, 0 if it isn't (the end of the chunks), -1 on error.
+ */
+static int readFrame(int fd, long offset, long n, long chunkSize, containerChunk* frame){
+    long got = readAt(fd, frame, sizeof(containerChunk), offset);
+    if(got < 0){
+        return -1;
+    }
+    chunkByteOrder(frame);
+    return got == CONTAINER_FRAME_SIZE && frame->magic == CONTAINER_CHUNK_MAGIC && frame->number == (uint64_t)n
+           && frame->length > 0 && frame->length <= (uint64_t)chunkSize;
+}
+
+
+/*
+ * Reads the index of a complete container in a regular file (size bytes from base). Returns the number of chunks,
+ * or -1 when there's no valid footer and index.
+ */
+static long readIndex(int fd, long base, long size, const containerHeader* header, containerChunk** chunks){
+    containerFooter footer;
+    if(size < CONTAINER_HEADER_SIZE + (long)sizeof(footer) || readAt(fd, &footer, sizeof(footer), base + size - sizeof(footer)) != sizeof(footer)){
+        return -1;
+    }
+    footerByteOrder(&footer);
+    if(footer.magic != CONTAINER_FOOTER_MAGIC || footer.totalChunks > (uint64_t)size / CONTAINER_FRAME_SIZE
+       || footer.indexOffset + footer.totalChunks * CONTAINER_FRAME_SIZE + sizeof(footer) != (uint64_t)size){
+        return -1;
+    }
+
+    long count = footer.totalChunks;
+    *chunks = (containerChunk*)malloc((count > 0 ? count : 1) * sizeof(containerChunk));
+    if(*chunks == NULL){
+        fprintf(stderr, "Error: Failed to allocate the container index.\n");
+        return -1;
+    }
+    if(readAt(fd, *chunks, count * CONTAINER_FRAME_SIZE, base + footer.indexOffset) != count * CONTAINER_FRAME_SIZE
+       || crc32cUpdate(0, (const uint8_t*)*chunks, count * CONTAINER_FRAME_SIZE) != footer.indexCrc){
+        free(*chunks);
+        return -1;
+    }
+
+    // Every chunk but the last is full, and they're where their number says
+    long chunkSize = header->chunkSize;
+    for(long i = 0; i < count; i++){
+        containerChunk* entry = &(*chunks)[i];
+        chunkByteOrder(entry);
+        if(entry->magic != CONTAINER_ENTRY_MAGIC || entry->number != (uint64_t)i || entry->length == 0
+           || entry->length > (uint64_t)chunkSize || (i < count - 1 && entry->length != (uint64_t)chunkSize)){
+            free(*chunks);
+            return -1;
+        }
+    }
+    if(footer.indexOffset != (uint64_t)(count > 0 ? chunkOffset(chunkSize, count - 1) + CONTAINER_FRAME_SIZE + (*chunks)[count - 1].length : CONTAINER_HEADER_SIZE)){
+        free(*chunks);
+        return -1;
+    }
+    return count;
+}
+
+
+/*
+ * Lists the complete chunks of a container without its index (cut short), from their frames.
+ */
+static long scanFrames(int fd, long base, long size, const containerHeader* header, containerChunk** chunks){
+    long chunkSize = header->chunkSize;
+    long count = 0;
+    long capacity = 1024;
+    *chunks = (containerChunk*)malloc(capacity * sizeof(containerChunk));
+    if(*chunks == NULL){
+        fprintf(stderr, "Error: Failed to allocate the container index.\n");
+        return -1;
+    }
+
+    while(1){
+        long offset = chunkOffset(chunkSize, count);
+        containerChunk frame;
+        int found = readFrame(fd, base + offset, count, chunkSize, &frame);
+        if(found < 0){
+            free(*chunks);
+            return -1;
+        }
+        if(found == 0 || offset + CONTAINER_FRAME_SIZE + (long)frame.length > size){
+            break;
+        }
+        if(count == capacity){
+            capacity *= 2;
+            containerChunk* larger = (containerChunk*)realloc(*chunks, capacity * sizeof(containerChunk));
+            if(larger == NULL){
+                fprintf(stderr, "Error: Failed to allocate the container index.\n");
+                free(*chunks);
+                return -1;
+            }
+            *chunks = larger;
+        }
+        (*chunks)[count++] = frame;
+        // Only the last chunk is short
+        if(frame.length < (uint64_t)chunkSize){
+            break;
+        }
+    }
+    return count;
+}
+
+
+long containerResume(int fd, const containerHeader* header, ContainerIndex* index, int* complete){
+    *complete = 0;
+    struct stat info;
+    if(fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)){
+        fprintf(stderr, "Error: --resume needs the container as a regular file (-o).\n");
+        return -1;
+    }
+    // Nothing, or the start of the header this run would write (cut short while writing it) - a new container
+    containerHeader stored = *header;
+    headerByteOrder(&stored);
+    if(info.st_size < CONTAINER_HEADER_SIZE){
+        uint8_t start[sizeof(containerHeader)];
+        long known = info.st_size < (long)offsetof(containerHeader, totalBytes) ? info.st_size : (long)offsetof(containerHeader, totalBytes);
+        if(readAt(fd, start, info.st_size, 0) != info.st_size || memcmp(start, &stored, known) != 0){
+            fprintf(stderr, "Error: The input isn't a container (or a version this program doesn't know).\n");
+            return -1;
+        }
+        if(ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0){
+            perror("Error: restarting the container");
+            return -1;
+        }
+        return containerWriteHeader(fd, header) ? 0 : -1;
+    }
+
+    containerHeader existing;
+    if(!readHeader(fd, 0, header, &existing)){
+        return -1;
+    }
+    if(existing.chunkSize != header->chunkSize){
+        fprintf(stderr, "Error: The container was made with %" PRIu64 "-byte chunks, use --chunk %" PRIu64 " to resume it.\n", existing.chunkSize, existing.chunkSize);
+        return -1;
+    }
+
+    // A complete container is left as it is
+    long chunkSize = header->chunkSize;
+    containerChunk* chunks;
+    long count = readIndex(fd, 0, info.st_size, header, &chunks);
+    if(count >= 0){
+        for(long i = 0; i < count; i++){
+            containerChunk frame;
+            if(!containerAddChunk(index, chunks[i].length, chunks[i].cipherCrc, &frame)){
+                free(chunks);
+                return -1;
+            }
+        }
+        free(chunks);
+        *complete = 1;
+        return count;
+    }
+
+    // Otherwise keep the full chunks whose payload still matches their CRC (the short last one is redone)
+    uint8_t* payload = (uint8_t*)malloc(chunkSize);
+    if(payload == NULL){
+        fprintf(stderr, "Error: Failed to allocate the resume buffer.\n");
+        return -1;
+    }
+    long verified = 0;
+    while(1){
+        long offset = chunkOffset(chunkSize, verified);
+        containerChunk frame;
+        int found = readFrame(fd, offset, verified, chunkSize, &frame);
+        if(found < 0){
+            free(payload);
+            return -1;
+        }
+        if(found == 0 || frame.length != (uint64_t)chunkSize){
+            break;
+        }
+        long got = readAt(fd, payload, chunkSize, offset + CONTAINER_FRAME_SIZE);
+        if(got < 0){
+            free(payload);
+            return -1;
+        }
+        if(got < chunkSize || crc32cUpdate(0, payload, chunkSize) != frame.cipherCrc){
+            break;
+        }
+        if(!containerAddChunk(index, chunkSize, frame.cipherCrc, &frame)){
+            free(payload);
+            return -1;
+        }
+        verified++;
+    }
+    free(payload);
+
+    long end = chunkOffset(chunkSize, verified);
+    if(ftruncate(fd, end) != 0 || lseek(fd, end, SEEK_SET) != end){
+        perror("Error: cutting the container after its last verified chunk");
+        return -1;
+    }
+    return verified;
+}
+
+
+void containerIndexFree(ContainerIndex* index){
+    free(index->entries);
+    index->entries = NULL;
+    index->count = 0;
+    index->capacity = 0;
+    index->bytes = 0;
+}
+
+
+/*
+ * Checks a chunk's payload and decrypts it in place.
+ */
+static int decryptChunk(extractJob* job, const containerChunk* chunk, uint8_t* payload, KeyCursor* cursor){
+    long number = chunk->number;
+    if(crc32cUpdate(0, payload, chunk->length) != chunk->cipherCrc){
+        fprintf(stderr, "Error: Chunk %ld is damaged (its checksum doesn't match).\n", number);
+        return 0;
+    }
+    keyCursorEncrypt(cursor, payload, payload, chunk->length, number * (job->chunkSize / job->keySize));
+    return 1;
+}
+
+
+/*
+ * Decrypts one chunk from the input file to the output file, both at the chunk's offsets.
+ */
+static int extractChunk(extractJob* job, const containerChunk* chunk, uint8_t* payload, KeyCursor* cursor){
+    long number = chunk->number;
+    long plainOffset = job->outBase + number * job->chunkSize;
+
+    // Already decrypted by an interrupted run: the output encrypts back to the payload
+    if(job->resume){
+        long got = readAt(STDOUT_FILENO, payload, chunk->length, plainOffset);
+        if(got == (long)chunk->length){
+            keyCursorEncrypt(cursor, payload, payload, chunk->length, number * (job->chunkSize / job->keySize));
+        }
+        if(got == (long)chunk->length && crc32cUpdate(0, payload, chunk->length) == chunk->cipherCrc){
+            atomic_fetch_add(&job->skipped, 1);
+            return 1;
+        }
+    }
+
+    long offset = job->inBase + chunkOffset(job->chunkSize, number);
+    containerChunk frame;
+    int found = readFrame(STDIN_FILENO, offset, number, job->chunkSize, &frame);
+    if(found < 0){
+        return 0;
+    }
+    if(found == 0 || frame.length != chunk->length || frame.cipherCrc != chunk->cipherCrc){
+        fprintf(stderr, "Error: Chunk %ld is damaged (its frame doesn't match the index).\n", number);
+        return 0;
+    }
+    long got = readAt(STDIN_FILENO, payload, chunk->length, offset + CONTAINER_FRAME_SIZE);
+    if(got != (long)chunk->length){
+        if(got >= 0){
+            fprintf(stderr, "Error: Chunk %ld is cut short.\n", number);
+        }
+        return 0;
+    }
+
+    return decryptChunk(job, chunk, payload, cursor) && pwriteAll(STDOUT_FILENO, payload, chunk->length, plainOffset);
+}
+
+
+static void* extractThreadFunction(void* arg){
+    extractJob* job = (extractJob*)arg;
+
+    KeyCursor cursor;
+    if(!keyCursorInit(&cursor, job->key, job->keySize)){
+        atomic_store(&job->failed, 1);
+        return NULL;
+    }
+    keyCursorSetCache(&cursor, job->keyCache);
+    void* payload = NULL;
+    if(posix_memalign(&payload, 4096, job->chunkSize) != 0){
+        fprintf(stderr, "Error: Failed to allocate a chunk buffer.\n");
+        keyCursorFree(&cursor);
+        atomic_store(&job->failed, 1);
+        return NULL;
+    }
+
+    // Claim the next chunk until there's none left
+    while(1){
+        long n = atomic_fetch_add(&job->nextChunk, 1);
+        if(n > job->last){
+            break;
+        }
+        if(!extractChunk(job, &job->chunks[n], (uint8_t*)payload, &cursor)){
+            atomic_store(&job->failed, 1);
+        }
+    }
+
+    free(payload);
+    keyCursorFree(&cursor);
+    return NULL;
+}
+
+
+/*
+ * Decrypts the chunks in order to stdout, read at their offsets (chunks given) or one after the other from a pipe.
+ */
+static int extractInOrder(extractJob* job, const containerChunk* chunks, long count){
+    KeyCursor cursor;
+    uint8_t* payload = (uint8_t*)malloc(job->chunkSize);
+    if(payload == NULL || !keyCursorInit(&cursor, job->key, job->keySize)){
+        fprintf(stderr, "Error: Failed to allocate a chunk buffer.\n");
+        free(payload);
+        return 0;
+    }
+    keyCursorSetCache(&cursor, job->keyCache);
+
+    int done = 1;
+    for(long n = 0; chunks == NULL || n < count; n++){
+        containerChunk frame;
+        long offset = chunks != NULL ? job->inBase + chunkOffset(job->chunkSize, n) : -1;
+        int found = readFrame(STDIN_FILENO, offset, n, job->chunkSize, &frame);
+        if(found <= 0){
+            // From a pipe, the index entries come after the last chunk
+            if(found == 0 && chunks == NULL && frame.magic != CONTAINER_ENTRY_MAGIC){
+                fprintf(stderr, "Warning: The container has no index (cut short?), its %ld complete chunks were decrypted.\n", n);
+            }
+            else if(found == 0 && chunks != NULL){
+                fprintf(stderr, "Error: Chunk %ld is damaged (its frame doesn't match the index).\n", n);
+                done = 0;
+            }
+            done = done && found == 0;
+            break;
+        }
+        long got = readAt(STDIN_FILENO, payload, frame.length, offset >= 0 ? offset + CONTAINER_FRAME_SIZE : -1);
+        if(got != (long)frame.length){
+            if(got >= 0 && chunks != NULL){
+                fprintf(stderr, "Error: Chunk %ld is cut short.\n", n);
+            }
+            else if(got >= 0){
+                fprintf(stderr, "Warning: The container has no index (cut short?), its %ld complete chunks were decrypted.\n", n);
+            }
+            done = got >= 0 && chunks == NULL;
+            break;
+        }
+        if(chunks != NULL && (frame.length != chunks[n].length || frame.cipherCrc != chunks[n].cipherCrc)){
+            fprintf(stderr, "Error: Chunk %ld is damaged (its frame doesn't match the index).\n", n);
+            done = 0;
+            break;
+        }
+        if(!decryptChunk(job, &frame, payload, &cursor) || !writeAll(STDOUT_FILENO, payload, frame.length)){
+            done = 0;
+            break;
+        }
+    }
+
+    keyCursorFree(&cursor);
+    free(payload);
+    return done;
+}
+
+
+int extractContainer(const uint8_t* key, long keySize, KeyCache* keyCache, int threadsNum, long first, long last, int resume){
+    containerHeader expected;
+    containerInitHeader(&expected, key, keySize, keySize);
+
+    // A regular file is read at offsets (the index tells where the chunks are), a pipe in order
+    struct stat inInfo;
+    struct stat outInfo;
+    long inBase = -1;
+    long outBase = -1;
+    if(fstat(STDIN_FILENO, &inInfo) == 0 && S_ISREG(inInfo.st_mode)){
+        inBase = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    }
+    if(fstat(STDOUT_FILENO, &outInfo) == 0 && S_ISREG(outInfo.st_mode)){
+        outBase = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+    }
+    int parallel = inBase >= 0 && outBase >= 0;
+    if(!parallel && (resume || first > 0 || last >= 0)){
+        fprintf(stderr, "Error: --resume and --chunks need the container and the output as regular files (-i and -o).\n");
+        return 0;
+    }
+
+    containerHeader header;
+    if(!readHeader(STDIN_FILENO, inBase, &expected, &header)){
+        return 0;
+    }
+
+    extractJob job;
+    job.key = key;
+    job.keySize = keySize;
+    job.keyCache = keyCache;
+    job.chunkSize = header.chunkSize;
+    job.inBase = inBase;
+    job.outBase = outBase;
+    job.resume = resume;
+    atomic_init(&job.skipped, 0);
+    atomic_init(&job.failed, 0);
+
+    if(inBase < 0){
+        return extractInOrder(&job, NULL, 0);
+    }
+
+    // The chunks from the index, or from their frames when the container was cut short
+    long size = inInfo.st_size - inBase;
+    containerChunk* chunks;
+    long count = readIndex(STDIN_FILENO, inBase, size, &header, &chunks);
+    int cutShort = count < 0;
+    if(cutShort){
+        count = scanFrames(STDIN_FILENO, inBase, size, &header, &chunks);
+        if(count < 0){
+            return 0;
+        }
+        fprintf(stderr, "Warning: The container has no index (cut short?), decrypting its %ld complete chunks.\n", count);
+    }
+    if(!parallel){
+        int done = extractInOrder(&job, chunks, count);
+        free(chunks);
+        return done;
+    }
+
+    if(last < 0 || last > count - 1){
+        last = count - 1;
+    }
+    if(first > last && count > 0){
+        fprintf(stderr, "Error: The container only has %ld chunks.\n", count);
+        free(chunks);
+        return 0;
+    }
+    job.chunks = chunks;
+    job.last = last;
+    atomic_init(&job.nextChunk, first);
+
+    // The whole container - the output gets its exact size (a chunk range leaves the rest of the file alone)
+    long plainBytes = count > 0 ? (count - 1) * job.chunkSize + chunks[count - 1].length : 0;
+    if(first == 0 && last == count - 1 && ftruncate(STDOUT_FILENO, outBase + plainBytes) != 0){
+        perror("Error: sizing the output");
+        free(chunks);
+        return 0;
+    }
+
+    // No more threads than chunks
+    long chunksToDo = last - first + 1;
+    if(threadsNum > chunksToDo - 1){
+        threadsNum = chunksToDo > 0 ? chunksToDo - 1 : 0;
+    }
+    pthread_t threads[threadsNum + 1];
+    int created = 0;
+    for(; created < threadsNum; created++){
+        if(pthread_create(&threads[created], NULL, &extractThreadFunction, &job) != 0){
+            // Fewer threads only means less parallelism, the others (and this one) claim the rest
+            break;
+        }
+    }
+    extractThreadFunction(&job);
+    for(int i = 0; i < created; i++){
+        if(pthread_join(threads[i], NULL) != 0){
+            atomic_store(&job.failed, 1);
+        }
+    }
+
+    if(resume){
+        fprintf(stderr, "Info: --resume: %ld of %ld chunks were already decrypted.\n", atomic_load(&job.skipped), chunksToDo > 0 ? chunksToDo : 0);
+    }
+    free(chunks);
+    return !atomic_load(&job.failed);
+}
@@ -0,0 +1,79 @@
+#include "../include/daemonProtocol.h"
+
+int daemonReadFull(int fd, void* buffer, long length){
+    long done = 0;
+    while(done < length){
+        ssize_t bytes = recv(fd, (uint8_t*)buffer + done, length - done, 0);
+        if(bytes < 0 && errno == EINTR){
+            continue;
+        }
+        if(bytes == 0 && done == 0){
+            return 0;
+        }
+        if(bytes <= 0){
+            return -1;
+        }
+        done += bytes;
+    }
+    return 1;
+}
+
+
+int daemonSendFrame(int fd, uint32_t type, const void* payload, long length){
+    daemonHeader header = {type, (uint32_t)length};
+    struct iovec iov[2] = {{&header, sizeof(header)}, {(void*)payload, length}};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = iov;
+    message.msg_iovlen = length > 0 ? 2 : 1;
+
+    // Resume where a partial send stopped
+    long left = sizeof(header) + length;
+    while(left > 0){
+        ssize_t bytes = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if(bytes < 0 && errno == EINTR){
+            continue;
+        }
+        if(bytes <= 0){
+            return 0;
+        }
+        left -= bytes;
+        while(bytes > 0 && message.msg_iovlen > 0){
+            if((size_t)bytes >= message.msg_iov->iov_len){
+                bytes -= message.msg_iov->iov_len;
+                message.msg_iov++;
+                message.msg_iovlen--;
+            }
+            else {
+                message.msg_iov->iov_base = (uint8_t*)message.msg_iov->iov_base + bytes;
+                message.msg_iov->iov_len -= bytes;
+                bytes = 0;
+            }
+        }
+    }
+    return 1;
+}
+
+
+int daemonConnect(const char* path){
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(address.sun_path)){
+        fprintf(stderr, "Error: The socket path %s is too long.\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0){
+        perror("Error: socket");
+        return -1;
+    }
+    if(connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0){
+        fprintf(stderr, "Error: Can't connect to %s: %s.\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
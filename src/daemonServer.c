@@ -0,0 +1,276 @@
+#include "../include/daemonServer.h"
+
+int daemonListen(const char* path){
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(address.sun_path)){
+        fprintf(stderr, "Error: The socket path %s is too long.\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if(fd < 0){
+        perror("Error: socket");
+        return -1;
+    }
+
+    // A socket file left by a daemon that's gone is replaced, a live one is not
+    struct stat info;
+    if(stat(path, &info) == 0){
+        if(!S_ISSOCK(info.st_mode)){
+            fprintf(stderr, "Error: %s exists and is not a socket.\n", path);
+            close(fd);
+            return -1;
+        }
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int live = probe >= 0 && connect(probe, (struct sockaddr*)&address, sizeof(address)) == 0;
+        if(probe >= 0){
+            close(probe);
+        }
+        if(live){
+            fprintf(stderr, "Error: A daemon is already serving on %s.\n", path);
+            close(fd);
+            return -1;
+        }
+        unlink(path);
+    }
+
+    if(bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0){
+        fprintf(stderr, "Error: Can't listen on %s: %s.\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+int daemonServeFrame(daemonWorker* worker, daemonClient* client){
+    daemonHeader header;
+    if(daemonReadFull(client->fd, &header, sizeof(header)) != 1){
+        return 0;
+    }
+
+    long produced;
+    if(header.type == DAEMON_FRAME_DATA){
+        if(header.length > DAEMON_MAX_FRAME){
+            const char* message = "frame too large";
+            daemonSendFrame(client->fd, DAEMON_STATUS_ERROR, message, strlen(message));
+            return 0;
+        }
+        if(daemonReadFull(client->fd, worker->input, header.length) != 1){
+            return 0;
+        }
+        produced = xorStreamUpdate(client->stream, worker->input, worker->output, header.length);
+    }
+    else if(header.type == DAEMON_FRAME_FINAL && header.length == 0){
+        produced = xorStreamFinal(client->stream, worker->output);
+    }
+    else {
+        const char* message = "unknown frame";
+        daemonSendFrame(client->fd, DAEMON_STATUS_ERROR, message, strlen(message));
+        return 0;
+    }
+
+    atomic_fetch_add(&worker->server->requests, 1);
+    return daemonSendFrame(client->fd, DAEMON_STATUS_OK, worker->output, produced);
+}
+
+
+static void closeClient(daemonServer* server, daemonClient* client){
+    close(client->fd);
+    xorStreamDestroy(client->stream);
+    free(client);
+    atomic_fetch_sub(&server->clients, 1);
+}
+
+
+/*
+ * Accepts every pending connection and registers it, then re-arms the listening socket.
+ */
+static void acceptClients(daemonServer* server){
+    while(1){
+        int fd = accept4(server->listenFd, NULL, NULL, SOCK_CLOEXEC);
+        if(fd < 0){
+            if(errno == EINTR || errno == ECONNABORTED){
+                continue;
+            }
+            if(errno != EAGAIN && errno != EWOULDBLOCK){
+                perror("Error: accept");
+            }
+            break;
+        }
+
+        // The socket blocks, but never for long in the middle of a frame
+        struct timeval timeout = {DAEMON_FRAME_TIMEOUT, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        daemonClient* client = (daemonClient*)malloc(sizeof(daemonClient));
+        XorStream* stream = xorStreamCreateShared(server->key, server->keySize);
+        if(client == NULL || stream == NULL){
+            fprintf(stderr, "Error: Failed to allocate a client.\n");
+            free(client);
+            xorStreamDestroy(stream);
+            close(fd);
+            continue;
+        }
+        xorStreamSetKeyCache(stream, server->keyCache);
+        client->fd = fd;
+        client->stream = stream;
+        atomic_fetch_add(&server->clients, 1);
+
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.ptr = client;
+        if(epoll_ctl(server->epollFd, EPOLL_CTL_ADD, fd, &event) != 0){
+            perror("Error: epoll_ctl");
+            closeClient(server, client);
+        }
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.ptr = &server->listenFd;
+    epoll_ctl(server->epollFd, EPOLL_CTL_MOD, server->listenFd, &event);
+}
+
+
+static void* daemonThreadFunction(void* arg){
+    daemonWorker* worker = (daemonWorker*)arg;
+    daemonServer* server = worker->server;
+
+    // One event at a time: a worker busy with a frame never sits on events another worker could serve
+    while(1){
+        struct epoll_event event;
+        int count = epoll_wait(server->epollFd, &event, 1, -1);
+        if(count < 0 && errno == EINTR){
+            continue;
+        }
+        if(count < 0){
+            perror("Error: epoll_wait");
+            return (void*)1;
+        }
+        if(count == 0){
+            continue;
+        }
+
+        if(event.data.ptr == &server->stopFd){
+            break;
+        }
+        if(event.data.ptr == &server->listenFd){
+            acceptClients(server);
+            continue;
+        }
+
+        daemonClient* client = (daemonClient*)event.data.ptr;
+        if((event.events & (EPOLLHUP | EPOLLERR)) && !(event.events & EPOLLIN)){
+            closeClient(server, client);
+            continue;
+        }
+        if(!daemonServeFrame(worker, client)){
+            closeClient(server, client);
+            continue;
+        }
+
+        // Next frame (it may already be waiting, the registration is level triggered)
+        event.events = EPOLLIN | EPOLLONESHOT;
+        if(epoll_ctl(server->epollFd, EPOLL_CTL_MOD, client->fd, &event) != 0){
+            closeClient(server, client);
+        }
+    }
+    return NULL;
+}
+
+
+int runDaemon(const char* path, const uint8_t* key, long keySize, KeyCache* keyCache, int threadsNum){
+    if(threadsNum < 1){
+        threadsNum = 1;
+    }
+
+    daemonServer server;
+    server.key = key;
+    server.keySize = keySize;
+    server.keyCache = keyCache;
+    atomic_init(&server.clients, 0);
+    atomic_init(&server.requests, 0);
+    server.listenFd = daemonListen(path);
+    if(server.listenFd < 0){
+        return 0;
+    }
+    server.epollFd = epoll_create1(EPOLL_CLOEXEC);
+    server.stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(server.epollFd < 0 || server.stopFd < 0){
+        perror("Error: Failed to set up the daemon");
+        close(server.listenFd);
+        unlink(path);
+        return 0;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.ptr = &server.listenFd;
+    epoll_ctl(server.epollFd, EPOLL_CTL_ADD, server.listenFd, &event);
+    event.events = EPOLLIN;
+    event.data.ptr = &server.stopFd;
+    epoll_ctl(server.epollFd, EPOLL_CTL_ADD, server.stopFd, &event);
+
+    // Only the main thread takes the stop signals (the workers inherit the mask), a closed client can't kill us
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // The workers and their buffers are set up once, touched so they're resident before the first request
+    daemonWorker workers[threadsNum];
+    pthread_t threads[threadsNum];
+    int created = 0;
+    int failed = 0;
+    for(; created < threadsNum; created++){
+        workers[created].server = &server;
+        workers[created].input = (uint8_t*)malloc(DAEMON_MAX_FRAME);
+        workers[created].output = (uint8_t*)malloc(DAEMON_MAX_FRAME + keySize);
+        if(workers[created].input == NULL || workers[created].output == NULL){
+            fprintf(stderr, "Error: Failed to allocate the daemon buffers.\n");
+            free(workers[created].input);
+            free(workers[created].output);
+            failed = 1;
+            break;
+        }
+        memset(workers[created].input, 0, DAEMON_MAX_FRAME);
+        memset(workers[created].output, 0, DAEMON_MAX_FRAME + keySize);
+        if(pthread_create(&threads[created], NULL, &daemonThreadFunction, &workers[created]) != 0){
+            fprintf(stderr, "Error: Failed to create the daemon thread(s)\n");
+            free(workers[created].input);
+            free(workers[created].output);
+            failed = 1;
+            break;
+        }
+    }
+
+    if(!failed){
+        fprintf(stderr, "Info: Serving on %s with %d workers.\n", path, threadsNum);
+        int received;
+        sigwait(&signals, &received);
+    }
+
+    // Wake every worker up (the eventfd stays readable) and wait for them to finish their frame
+    eventfd_write(server.stopFd, 1);
+    for(int i = 0; i < created; i++){
+        void* result;
+        if(pthread_join(threads[i], &result) != 0 || result != NULL){
+            failed = 1;
+        }
+        free(workers[i].input);
+        free(workers[i].output);
+    }
+
+    close(server.listenFd);
+    unlink(path);
+    close(server.epollFd);
+    close(server.stopFd);
+    fprintf(stderr, "Info: Stopped after %ld requests, %ld clients still connected.\n", atomic_load(&server.requests), atomic_load(&server.clients));
+    return !failed;
+}
@@ -1,193 +1,1569 @@
 #include "../include/encryptUtil.h"
 
-pthread_mutex_t mutexBlockNum;
+uint8_t* readKeyFile(const uint8_t* filename, long* fileSize){
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    // Try to open the file, indicates if faild
+    if(fd < 0){
+        fprintf(stderr, "Error: opening the file!\n");
+        return NULL;
+    }
+
+    // Get the file size
+    struct stat info;
+    if(fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)){
+        fprintf(stderr, "Error: getting file size (the key must be a regular file)!\n");
+        close(fd);
+        return NULL;
+    }
+    *fileSize = info.st_size;
+    if(*fileSize == 0){
+        fprintf(stderr,"Error: The key can't by an empty file (blocksize must be > 0)\n");
+        close(fd);
+        return NULL;
+    }
+
+    // Map the key read-only: its pages are the page cache's, nothing is copied and every thread reads the same ones
+    void* array = mmap(NULL, *fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(array == MAP_FAILED){
+        fprintf(stderr, "Error: mapping the file!\n");
+        return NULL;
+    }
+
+    // Every block walks the key front to back: read it ahead, and start now rather than on the first fault
+    madvise(array, *fileSize, MADV_SEQUENTIAL);
+    madvise(array, *fileSize, MADV_WILLNEED);
+    return (uint8_t*)array;
+}
+
+
+void releaseKey(uint8_t* key, long keySize){
+    if(key != NULL){
+        munmap(key, keySize);
+    }
+}
+
+
+int writeEncrypted(const uint8_t* encrypted, long length){
+    struct iovec iov;
+    iov.iov_base = (void*)encrypted;
+    iov.iov_len = length;
+    return writeEncryptedBatch(&iov, 1);
+}
+
+
+int spliceEncryptedBatch(struct iovec* iov, int count){
+    int first = 1;
+
+    while(count > 0){
+        ssize_t written = vmsplice(STDOUT_FILENO, iov, count < IOV_MAX ? count : IOV_MAX, 0);
+        if(written < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            // Not supported here (e.g. not a pipe after all) - nothing was written, the caller can fall back
+            if(first && (errno == EINVAL || errno == EBADF || errno == ENOSYS)){
+                return -1;
+            }
+            perror("Error: splicing to stdout");
+            return 0;
+        }
+        first = 0;
+
+        // Same bookkeeping as writev
+        while(count > 0 && (size_t)written >= iov->iov_len){
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count > 0){
+            iov->iov_base = (uint8_t*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 1;
+}
+
+
+int setupSpliceOutput(const char* ioMode){
+    // Only on request: a consumer that splices the pages on (pipe to pipe) may still hold them when they're reused
+    if(strcmp(ioMode, "splice") != 0){
+        return 0;
+    }
+
+    struct stat outStat;
+    if(fstat(STDOUT_FILENO, &outStat) != 0 || !S_ISFIFO(outStat.st_mode)){
+        fprintf(stderr, "Warning: stdout is not a pipe, falling back to writev.\n");
+        return 0;
+    }
+
+    // A bigger pipe lets the buffers be recycled sooner (may be refused above /proc/sys/fs/pipe-max-size, that's fine)
+    fcntl(STDOUT_FILENO, F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+    int pipeSize = fcntl(STDOUT_FILENO, F_GETPIPE_SZ);
+    return pipeSize > 0 ? pipeSize : 0;
+}
+
+
+int writeEncryptedBatch(struct iovec* iov, int count){
+    while(count > 0){
+        ssize_t written = writev(STDOUT_FILENO, iov, count < IOV_MAX ? count : IOV_MAX);
+        if(written < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            perror("Error: writing to stdout");
+            return 0;
+        }
+
+        // Skip what was fully written, and move the start of a partially written block
+        while(count > 0 && (size_t)written >= iov->iov_len){
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count > 0){
+            iov->iov_base = (uint8_t*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 1;
+}
+
+
+long readInput(uint8_t* input, long length){
+    long counter = 0;
+
+    // Straight from file descriptor 0 into the (page aligned) buffer, no stdio copy. Pipes return what they have, so loop until full
+    while(counter < length){
+        ssize_t bytes = read(STDIN_FILENO, input + counter, length - counter);
+        if(bytes < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            perror("Error: reading from stdin");
+            break;
+        }
+        if(bytes == 0){
+            break;
+        }
+        counter += bytes;
+    }
+
+    return counter;
+}
+
+
+int streamInput(threadData* thData, int threadsNum, workerData* mainWorker){
+    long chunkSize = thData->blocksPerChunk * thData->keySize;
+    long blockNum = 0;
+    long read;
+
+    while(1){
+        // Don't read further than the reorder window allows, or when toEncrypt is over the high-water mark.
+        // Wait for the workers to make room, or do the work when there are no workers.
+        while(!reorderHasRoom(thData->toWrite, blockNum) || workSize(thData->toEncrypt) >= HIGH_WATER_MARK){
+            if(threadsNum == 0){
+                int worked = processStep(mainWorker);
+                if(worked < 0){
+                    return 0;
+                }
+                if(worked){
+                    continue;
+                }
+            }
+
+            unsigned ticket = eventPrepareWait(&thData->spaceEvent);
+            if(reorderHasRoom(thData->toWrite, blockNum) && workSize(thData->toEncrypt) < HIGH_WATER_MARK){
+                eventCancelWait(&thData->spaceEvent);
+                break;
+            }
+            uint64_t waitStart = STATS_ON ? statsNow() : 0;
+            eventWait(&thData->spaceEvent, ticket);
+            if(STATS_ON){
+                statsAddTime(STAGE_WAIT, statsNow() - waitStart);
+                statsCount(COUNTER_PARKS, 1);
+            }
+        }
+
+        // Node (from the pool) to store the input data (plaintex)
+        Node* inputNode = poolAcquire(thData->pool);
+        if(inputNode == NULL){
+            fprintf(stderr, "Error: Failed to allocate inputData.\n");
+            return 0;
+        }
+
+        uint64_t readStart = STATS_ON ? statsNow() : 0;
+        read = readInput(inputNode->data, chunkSize);
+        // While we still read stdin data, get it, and put in the queue for encryption
+        if(read > 0){
+            inputNode->blockSize = read;
+            inputNode->blockNum = blockNum;
+            if(STATS_ON){
+                inputNode->readTime = statsNow();
+                statsAddTime(STAGE_READ, inputNode->readTime - readStart);
+                statsCount(COUNTER_CHUNKS_READ, 1);
+                statsCount(COUNTER_BYTES_READ, read);
+            }
+            tuneWorkers(thData, read);
+            // Queued to the worker whose node holds the buffer (in turn when none does).
+            // The high-water mark leaves room in toEncrypt, but if it's full anyway, main thread helps clearing it
+            while(!workPush(thData->toEncrypt, inputNode, inputNode->owner)){
+                if(processStep(mainWorker) < 0){
+                    return 0;
+                }
+            }
+            eventNotify(&thData->workEvent);
+            blockNum++;
+        }
+        else {
+            poolRelease(thData->pool, inputNode);
+        }
+
+        // Finished reading from stdin, wake up the parked workers so they can see it
+        if(read < chunkSize){
+            atomic_store(&thData->totalBlocks, blockNum);
+            atomic_store(&thData->finishFlag, 1);
+            eventNotify(&thData->workEvent);
+            eventNotify(&thData->writeEvent);
+            eventNotify(&thData->tuneEvent);
+            break;
+        }
+    }
+
+    return 1;
+}
+
+
+/*
+ * Adds the next chunk in stream order to the --checksum digest. Only the thread writing the chunks calls it.
+ */
+static inline void addToDigest(threadData* thData, const Node* node){
+    if(thData->checksum != CHECKSUM_OFF){
+        uint32_t crc = thData->checksum == CHECKSUM_INPUT ? node->inputChecksum : node->checksum;
+        thData->digest = crc32cCombine(thData->digest, crc, node->blockSize);
+        thData->digestBytes += node->blockSize;
+    }
+}
+
+
+/*
+ * Queues a read (or write) of the part of a buffer that isn't done yet.
+ * offset is the file offset of the buffer's first byte, -1 for the current position (pipes).
+ */
+static int uringQueueIo(Uring* ring, int op, int fixed, uringBuffer* buffer, int index, long offset){
+    struct io_uring_sqe* sqe = uringGetSqe(ring);
+    if(sqe == NULL){
+        fprintf(stderr, "Error: The io_uring submission ring is full.\n");
+        return 0;
+    }
+
+    if(op == URING_OP_READ){
+        sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = STDIN_FILENO;
+    }
+    else {
+        sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = STDOUT_FILENO;
+    }
+    sqe->addr = (uint64_t)(uintptr_t)(buffer->node->data + buffer->done);
+    sqe->len = buffer->length - buffer->done;
+    sqe->off = offset < 0 ? (uint64_t)-1 : (uint64_t)(offset + buffer->done);
+    sqe->buf_index = fixed ? index : 0;
+    sqe->user_data = (uint64_t)op << 32 | (uint32_t)index;
+    return 1;
+}
+
+
+int uringPipeline(threadData* thData, Uring* ring, int threadsNum, workerData* mainWorker){
+    long chunkSize = thData->blocksPerChunk * thData->keySize;
+
+    // Regular files are read/written at explicit offsets, so requests can complete in any order. Pipes go one at a time
+    struct stat inStat, outStat;
+    if(fstat(STDIN_FILENO, &inStat) != 0 || fstat(STDOUT_FILENO, &outStat) != 0){
+        perror("Error: fstat");
+        return 0;
+    }
+    long inBase = S_ISREG(inStat.st_mode) ? lseek(STDIN_FILENO, 0, SEEK_CUR) : -1;
+    long outBase = S_ISREG(outStat.st_mode) && !(fcntl(STDOUT_FILENO, F_GETFL) & O_APPEND) ? lseek(STDOUT_FILENO, 0, SEEK_CUR) : -1;
+    long inSize = 0;
+    long totalChunks = -1;
+    if(inBase >= 0){
+        inSize = inStat.st_size > inBase ? inStat.st_size - inBase : 0;
+        totalChunks = (inSize + chunkSize - 1) / chunkSize;
+    }
+    int maxReads = inBase >= 0 ? URING_MAX_READS : 1;
+    int maxWrites = outBase >= 0 ? URING_MAX_WRITES : 1;
+
+    // Enough buffers for the requests in flight and a couple of chunks per worker, within the reorder window
+    long count = maxReads + maxWrites + 2 * threadsNum + 2;
+    if(count > thData->toWrite->window){
+        count = thData->toWrite->window;
+    }
+    uringBuffer buffers[count];
+    struct iovec iov[count];
+    int freeList[count];
+    int freeCount = 0;
+    for(int i = 0; i < count; i++){
+        buffers[i].node = poolAcquire(thData->pool);
+        if(buffers[i].node == NULL){
+            fprintf(stderr, "Error: Failed to allocate the io_uring buffers.\n");
+            return 0;
+        }
+        iov[i].iov_base = buffers[i].node->data;
+        iov[i].iov_len = chunkSize;
+        freeList[freeCount++] = count - 1 - i;
+    }
+    // Registered buffers are pinned once instead of on every request (may be refused, e.g. over RLIMIT_MEMLOCK)
+    int fixed = uringRegisterBuffers(ring, iov, count);
+
+    // The wakeup read may complete after we return (a worker signalling late), so its target must outlive this call
+    static uint64_t wakeValue;
+    int wakeArmed = 0;
+
+    long nextRead = 0;
+    long enqueued = 0;
+    long written = 0;
+    long writtenBytes = 0;
+    int reads = 0;
+    int writes = 0;
+    int inputDone = 0;
+
+    while(1){
+        // Keep reading while there are free buffers
+        while(!inputDone && reads < maxReads && freeCount > 0){
+            if(totalChunks >= 0 && nextRead >= totalChunks){
+                inputDone = 1;
+                break;
+            }
+            int index = freeList[--freeCount];
+            uringBuffer* buffer = &buffers[index];
+            buffer->chunk = nextRead++;
+            buffer->done = 0;
+            buffer->length = chunkSize;
+            if(totalChunks >= 0 && inSize - buffer->chunk * chunkSize < chunkSize){
+                buffer->length = inSize - buffer->chunk * chunkSize;
+            }
+            if(!uringQueueIo(ring, URING_OP_READ, fixed, buffer, index, inBase >= 0 ? inBase + buffer->chunk * chunkSize : -1)){
+                return 0;
+            }
+            reads++;
+        }
+
+        // Every read came back - wake up the parked workers so they can drain and see it
+        if(inputDone && reads == 0 && !atomic_load(&thData->finishFlag)){
+            atomic_store(&thData->totalBlocks, enqueued);
+            atomic_store(&thData->finishFlag, 1);
+            eventNotify(&thData->workEvent);
+            eventNotify(&thData->tuneEvent);
+        }
+
+        // Write the encrypted chunks in order (only the next one can be taken from the reorder buffer)
+        while(writes < maxWrites){
+            Node* node = reorderTakeNext(thData->toWrite);
+            if(node == NULL){
+                break;
+            }
+            int index = 0;
+            while(buffers[index].node != node){
+                index++;
+            }
+            uringBuffer* buffer = &buffers[index];
+            buffer->done = 0;
+            buffer->length = node->blockSize;
+            addToDigest(thData, node);
+            if(STATS_ON){
+                statsRecordLatency(LATENCY_REORDER, statsNow() - node->encryptTime);
+                statsCount(COUNTER_WRITE_CALLS, 1);
+            }
+            if(!uringQueueIo(ring, URING_OP_WRITE, fixed, buffer, index, outBase >= 0 ? outBase + buffer->chunk * chunkSize : -1)){
+                return 0;
+            }
+            writes++;
+        }
+
+        // Everything read was written
+        if(atomic_load(&thData->finishFlag) && written == enqueued){
+            break;
+        }
+
+        if(!wakeArmed){
+            struct io_uring_sqe* sqe = uringGetSqe(ring);
+            if(sqe == NULL){
+                fprintf(stderr, "Error: The io_uring submission ring is full.\n");
+                return 0;
+            }
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = thData->wakeFd;
+            sqe->addr = (uint64_t)(uintptr_t)&wakeValue;
+            sqe->len = sizeof(wakeValue);
+            sqe->user_data = (uint64_t)URING_OP_WAKE << 32;
+            wakeArmed = 1;
+        }
+
+        // Without workers the main thread encrypts, and only waits when there's nothing left to encrypt
+        unsigned waitFor = 1;
+        if(threadsNum == 0){
+            int worked = processStep(mainWorker);
+            if(worked < 0){
+                return 0;
+            }
+            if(worked){
+                waitFor = 0;
+            }
+        }
+        uint64_t waitStart = STATS_ON ? statsNow() : 0;
+        if(!uringSubmit(ring, waitFor)){
+            perror("Error: io_uring_enter");
+            return 0;
+        }
+        if(STATS_ON && waitFor){
+            statsAddTime(STAGE_WAIT, statsNow() - waitStart);
+        }
+
+        struct io_uring_cqe cqe;
+        while(uringNextCqe(ring, &cqe)){
+            int op = (int)(cqe.user_data >> 32);
+            int index = (int)(cqe.user_data & 0xffffffff);
+
+            if(op == URING_OP_WAKE){
+                wakeArmed = 0;
+                continue;
+            }
+
+            uringBuffer* buffer = &buffers[index];
+            long offset = op == URING_OP_READ ? (inBase >= 0 ? inBase + buffer->chunk * chunkSize : -1) : (outBase >= 0 ? outBase + buffer->chunk * chunkSize : -1);
+            if(cqe.res == -EINTR || cqe.res == -EAGAIN){
+                if(!uringQueueIo(ring, op, fixed, buffer, index, offset)){
+                    return 0;
+                }
+                continue;
+            }
+            if(cqe.res < 0){
+                fprintf(stderr, "Error: %s %s: %s\n", op == URING_OP_READ ? "reading from" : "writing to", op == URING_OP_READ ? "stdin" : "stdout", strerror(-cqe.res));
+                return 0;
+            }
+
+            if(op == URING_OP_READ){
+                if(cqe.res == 0 && inBase >= 0){
+                    fprintf(stderr, "Error: The input file shrank while reading it.\n");
+                    return 0;
+                }
+                buffer->done += cqe.res;
+                // Pipes return what they have, keep filling the chunk (every chunk but the last must be whole)
+                if(cqe.res > 0 && buffer->done < buffer->length){
+                    if(!uringQueueIo(ring, op, fixed, buffer, index, offset)){
+                        return 0;
+                    }
+                    continue;
+                }
+
+                reads--;
+                if(cqe.res == 0){
+                    inputDone = 1;
+                }
+                if(buffer->done == 0){
+                    nextRead--;
+                    freeList[freeCount++] = index;
+                    continue;
+                }
+                buffer->node->blockSize = buffer->done;
+                buffer->node->blockNum = buffer->chunk;
+                if(STATS_ON){
+                    buffer->node->readTime = statsNow();
+                    statsCount(COUNTER_CHUNKS_READ, 1);
+                    statsCount(COUNTER_BYTES_READ, buffer->done);
+                }
+                tuneWorkers(thData, buffer->done);
+                // There are fewer buffers than toEncrypt slots, it can't be full
+                if(!workPush(thData->toEncrypt, buffer->node, buffer->node->owner)){
+                    fprintf(stderr, "Error: Failed to queue a chunk for encryption.\n");
+                    return 0;
+                }
+                eventNotify(&thData->workEvent);
+                enqueued++;
+            }
+            else {
+                if(cqe.res == 0){
+                    fprintf(stderr, "Error: writing to stdout: no progress.\n");
+                    return 0;
+                }
+                buffer->done += cqe.res;
+                if(buffer->done < buffer->length){
+                    if(!uringQueueIo(ring, op, fixed, buffer, index, offset)){
+                        return 0;
+                    }
+                    continue;
+                }
+
+                writes--;
+                written++;
+                writtenBytes += buffer->length;
+                if(STATS_ON){
+                    statsRecordLatency(LATENCY_TOTAL, statsNow() - buffer->node->readTime);
+                    statsCount(COUNTER_CHUNKS_WRITTEN, 1);
+                }
+                freeList[freeCount++] = index;
+            }
+        }
+    }
+
+    // Leave the file positions where a read/write loop would have
+    if(inBase >= 0){
+        lseek(STDIN_FILENO, inBase + inSize, SEEK_SET);
+    }
+    if(outBase >= 0){
+        lseek(STDOUT_FILENO, outBase + writtenBytes, SEEK_SET);
+    }
+
+    for(int i = 0; i < count; i++){
+        poolRelease(thData->pool, buffers[i].node);
+    }
+    return 1;
+}
+
+
+int initWorker(workerData* worker, threadData* thData, int id){
+    worker->shared = thData;
+    worker->id = id;
+    if(!keyCursorInit(&worker->cursor, thData->key, thData->keySize)){
+        return 0;
+    }
+    keyCursorSetCache(&worker->cursor, thData->keyCache);
+    return 1;
+}
+
+
+/*
+ * Adds the CPUs of a sysfs cpulist ("0-3,8,10-11") that are in the allowed set and not listed yet.
+ */
+static int addCpuList(const char* list, const cpu_set_t* allowed, int* listed, int* cpus, int count){
+    const char* cursor = list;
+    while(*cursor != '\0' && *cursor != '\n'){
+        char* end;
+        long first = strtol(cursor, &end, 10);
+        if(end == cursor){
+            break;
+        }
+        long last = first;
+        if(*end == '-'){
+            cursor = end + 1;
+            last = strtol(cursor, &end, 10);
+            if(end == cursor){
+                break;
+            }
+        }
+        for(long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++){
+            if(CPU_ISSET(cpu, allowed) && !listed[cpu]){
+                listed[cpu] = 1;
+                cpus[count++] = (int)cpu;
+            }
+        }
+        cursor = *end == ',' ? end + 1 : end;
+    }
+    return count;
+}
+
+
+int listNumaCpus(int** cpus){
+    cpu_set_t allowed;
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0){
+        perror("Error: sched_getaffinity");
+        return 0;
+    }
+
+    *cpus = (int*)malloc(CPU_SETSIZE * sizeof(int));
+    int* listed = (int*)calloc(CPU_SETSIZE, sizeof(int));
+    if(*cpus == NULL || listed == NULL){
+        fprintf(stderr, "Error: Failed to allocate the CPU list.\n");
+        free(*cpus);
+        free(listed);
+        return 0;
+    }
+
+    // The CPUs of each NUMA node, node by node (the nodes are numbered without gaps on all but exotic machines)
+    int count = 0;
+    char path[64];
+    char list[4096];
+    for(int node = 0; ; node++){
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE* file = fopen(path, "r");
+        if(file == NULL){
+            break;
+        }
+        if(fgets(list, sizeof(list), file) != NULL){
+            count = addCpuList(list, &allowed, listed, *cpus, count);
+        }
+        fclose(file);
+    }
+
+    // No NUMA information (or CPUs outside every node) - the rest in plain order
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+        if(CPU_ISSET(cpu, &allowed) && !listed[cpu]){
+            listed[cpu] = 1;
+            (*cpus)[count++] = cpu;
+        }
+    }
+
+    free(listed);
+    if(count == 0){
+        free(*cpus);
+        *cpus = NULL;
+    }
+    return count;
+}
+
+
+int placeWorker(workerData* worker){
+    threadData* thData = worker->shared;
+    int placed = 1;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(thData->cpus[worker->id % thData->cpuCount], &set);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if(error != 0){
+        fprintf(stderr, "Warning: Couldn't pin a worker to CPU %d: %s.\n", thData->cpus[worker->id % thData->cpuCount], strerror(error));
+    }
+
+    // Take this worker's share of the buffers (one queue per worker), touch every page from here and give them back tagged with its id
+    long share = thData->pool->depth / thData->toEncrypt->count;
+    Node* taken = NULL;
+    for(long i = 0; i < share; i++){
+        Node* node = poolAcquire(thData->pool);
+        if(node == NULL){
+            placed = 0;
+            break;
+        }
+        memset(node->data, 0, thData->pool->blockSize);
+        node->owner = worker->id;
+        node->next = taken;
+        taken = node;
+    }
+    while(taken != NULL){
+        Node* next = taken->next;
+        poolRelease(thData->pool, taken);
+        taken = next;
+    }
+    // Back to the shared free list, the reader is the one acquiring them
+    poolFlushCache(thData->pool);
+
+    // Even on failure, so the reader doesn't wait forever
+    atomic_fetch_add(&thData->placedWorkers, 1);
+    eventNotify(&thData->spaceEvent);
+    return placed;
+}
+
+
+void freeWorker(workerData* worker){
+    keyCursorFree(&worker->cursor);
+}
+
+
+void tuneWorkers(threadData* thData, long bytes){
+    AutoTuner* tuner = thData->tuner;
+    if(tuner == NULL){
+        return;
+    }
+
+    // New chunks only go to the active workers' queues, the others finish what they have (or it gets stolen)
+    if(autoTuneRecord(tuner, bytes, statsNow())){
+        workSetActive(thData->toEncrypt, tuner->level);
+        atomic_store(&thData->activeWorkers, tuner->level);
+        eventNotify(&thData->tuneEvent);
+    }
+    if(tuner->settled && tuner->level != tuner->reported){
+        fprintf(stderr, "Info: -n auto settled on %d workers (%.1f MB/s).\n", tuner->level, tuner->bestRate / 1e6);
+        tuner->reported = tuner->level;
+    }
+}
+
+
+/*
+ * Same as encryptChunk(), but charges the key rotation and the XOR of every block to their stages (--stats).
+ * The cycle counter is cheap enough to read twice per block even with tiny keys.
+ */
+static void encryptChunkTimed(workerData* worker, uint8_t* dest, const uint8_t* src, long length, long firstBlock){
+    long keySize = worker->shared->keySize;
+    long blockNum = firstBlock;
+    uint64_t rotateTicks = 0;
+    uint64_t xorTicks = 0;
+
+    // No rotated key is built (table or fused kernel), it's all XOR
+    if(!keyCursorRotates(&worker->cursor)){
+        uint64_t start = statsTicks();
+        keyCursorEncrypt(&worker->cursor, dest, src, length, firstBlock);
+        statsAddTime(STAGE_XOR, statsTicks() - start);
+        return;
+    }
+
+    for(long offset = 0; offset < length; offset += keySize){
+        long blockLength = length - offset < keySize ? length - offset : keySize;
+        uint64_t start = statsTicks();
+        const uint8_t* key = keyCursorBlockKey(&worker->cursor, blockNum, blockLength);
+        uint64_t rotated = statsTicks();
+        xorBlock(dest + offset, src + offset, key, blockLength);
+        rotateTicks += rotated - start;
+        xorTicks += statsTicks() - rotated;
+        blockNum++;
+    }
+
+    statsAddTime(STAGE_ROTATE, rotateTicks);
+    statsAddTime(STAGE_XOR, xorTicks);
+}
+
+
+void encryptChunk(workerData* worker, uint8_t* dest, const uint8_t* src, long length, long firstBlock){
+    if(STATS_ON){
+        encryptChunkTimed(worker, dest, src, length, firstBlock);
+        return;
+    }
+
+    keyCursorEncrypt(&worker->cursor, dest, src, length, firstBlock);
+}
+
+
+/*
+ * The CRC32C of a chunk for --checksum (charged to its stage with --stats).
+ */
+static uint32_t checksumChunk(const uint8_t* data, long length){
+    if(!STATS_ON){
+        return crc32cUpdate(0, data, length);
+    }
+    uint64_t start = statsTicks();
+    uint32_t crc = crc32cUpdate(0, data, length);
+    statsAddTime(STAGE_CHECKSUM, statsTicks() - start);
+    return crc;
+}
+
+
+/*
+ * The reorder buffer's and the pool's locks with --stats: the waits are charged to their stage.
+ */
+static void lockReorderTimed(pthread_mutex_t* mutex){
+    statsMutexLock(mutex, STAGE_REORDER_LOCK, COUNTER_REORDER_CONTENDED);
+}
+
+
+static void lockPoolTimed(pthread_mutex_t* mutex){
+    statsMutexLock(mutex, STAGE_POOL_LOCK, COUNTER_POOL_CONTENDED);
+}
+
+
+int processStep(workerData* worker){
+    threadData* thData = worker->shared;
+    int worked = 0;
+
+    // If there's plaintext data to be encrypted, do that (writing is the writer thread's job)
+    int stolen;
+    Node* encryptNode = workPop(thData->toEncrypt, worker->id, &stolen);
+    if(encryptNode != NULL){
+        eventNotify(&thData->spaceEvent);
+        uint64_t encryptStart = 0;
+        if(STATS_ON){
+            encryptStart = statsNow();
+            statsRecordLatency(LATENCY_QUEUED, encryptStart - encryptNode->readTime);
+            statsCount(COUNTER_STEALS, stolen);
+        }
+
+        // Encrypt the plaintext data, the chunk starts at key-block (firstChunk + blockNum) * blocksPerChunk.
+        // The checksum reads the chunk right before or after, while it's in this core's cache.
+        if(thData->checksum == CHECKSUM_INPUT){
+            encryptNode->inputChecksum = checksumChunk(encryptNode->data, encryptNode->blockSize);
+        }
+        encryptChunk(worker, encryptNode->data, encryptNode->data, encryptNode->blockSize, (thData->firstChunk + encryptNode->blockNum) * thData->blocksPerChunk);
+        if(thData->checksum == CHECKSUM_OUTPUT || thData->container != NULL){
+            encryptNode->checksum = checksumChunk(encryptNode->data, encryptNode->blockSize);
+        }
+        if(STATS_ON){
+            encryptNode->encryptTime = statsNow();
+            statsRecordLatency(LATENCY_ENCRYPT, encryptNode->encryptTime - encryptStart);
+            statsCount(COUNTER_CHUNKS_ENCRYPTED, 1);
+        }
+
+        // Put the node in its reorder slot to be written
+        int inserted = reorderInsert(thData->toWrite, encryptNode);
+        if(inserted == 0){
+            fprintf(stderr, "Error: Failed to insert a node in the reorder buffer.\n");
+            return -1;
+        }
+        if(STATS_ON && inserted == 2){
+            statsCount(COUNTER_OUT_OF_ORDER, 1);
+        }
+        eventNotify(&thData->writeEvent);
+        // The io_uring engine waits on its ring, it only needs a wakeup when it can write something
+        if(thData->wakeFd >= 0 && reorderNextReady(thData->toWrite)){
+            eventfd_write(thData->wakeFd, 1);
+        }
+        worked = 1;
+    }
+
+    return worked;
+}
+
+
+/*
+ * Checks if the encryption stage is drained: the reader finished and there's no block left to encrypt.
+ */
+static int pipelineDone(threadData* thData){
+    return atomic_load(&thData->finishFlag) && workIsEmpty(thData->toEncrypt);
+}
+
+
+/*
+ * Hint to the CPU that we're busy waiting.
+ */
+static inline void cpuRelax(){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+
+int runWorker(workerData* worker){
+    threadData* thData = worker->shared;
+    int idleRounds = 0;
+
+    while(!pipelineDone(thData)){
+        // Not wanted by the tuner - park until it wants more workers (everyone drains once the input ended)
+        if(worker->id >= atomic_load(&thData->activeWorkers) && !atomic_load(&thData->finishFlag)){
+            unsigned ticket = eventPrepareWait(&thData->tuneEvent);
+            if(worker->id < atomic_load(&thData->activeWorkers) || atomic_load(&thData->finishFlag)){
+                eventCancelWait(&thData->tuneEvent);
+            }
+            else {
+                eventWait(&thData->tuneEvent, ticket);
+            }
+            continue;
+        }
+
+        int worked = processStep(worker);
+        if(worked < 0){
+            return 0;
+        }
+        if(worked){
+            idleRounds = 0;
+            continue;
+        }
+
+        // Nothing to do - spin a little, work usually comes back quickly when the pipeline is busy
+        if(++idleRounds < SPIN_ROUNDS){
+            cpuRelax();
+            continue;
+        }
+
+        // Then park until a block is enqueued (re-check after taking the ticket so no wakeup is lost)
+        unsigned ticket = eventPrepareWait(&thData->workEvent);
+        worked = processStep(worker);
+        if(worked != 0 || pipelineDone(thData)){
+            eventCancelWait(&thData->workEvent);
+            if(worked < 0){
+                return 0;
+            }
+        }
+        else {
+            uint64_t waitStart = STATS_ON ? statsNow() : 0;
+            eventWait(&thData->workEvent, ticket);
+            if(STATS_ON){
+                statsAddTime(STAGE_WAIT, statsNow() - waitStart);
+                statsCount(COUNTER_PARKS, 1);
+            }
+        }
+        idleRounds = 0;
+    }
+
+    return 1;
+}
+
+
+void* threadFunction(void* arg){
+    // Threads variables data
+    workerData* worker = (workerData*) arg;
+    threadData* thData = worker->shared;
+    if(STATS_ON){
+        statsSetRole("worker");
+    }
+
+    // The rotated key of the last block this thread encrypted is kept in the worker data
+    if(!initWorker(worker, thData, worker->id)){
+        // Still counts as placed, the reader waits for every worker
+        if(thData->cpuCount > 0){
+            atomic_fetch_add(&thData->placedWorkers, 1);
+            eventNotify(&thData->spaceEvent);
+        }
+        return NULL;
+    }
+    if(thData->cpuCount > 0){
+        placeWorker(worker);
+    }
+
+    runWorker(worker);
+
+    freeWorker(worker);
+    return NULL;
+}
+
+
+void* writerFunction(void* arg){
+    threadData* thData = (threadData*) arg;
+
+    Node* nodes[MAX_WRITE_BATCH];
+    // With --container, each block is written after its frame
+    struct iovec iov[2 * MAX_WRITE_BATCH];
+    containerChunk frames[MAX_WRITE_BATCH];
+    long written = 0;
+    int idleRounds = 0;
+
+    // Blocks handed to the pipe with vmsplice are still referenced by it until the reader consumes them.
+    // The pipe never holds more than pipeSize bytes, so a block can be recycled once pipeSize more bytes were spliced after it.
+    Node* deferredHead = NULL;
+    Node* deferredTail = NULL;
+    long deferredStart = 0;
+    long splicedBytes = 0;
+    if(STATS_ON){
+        statsSetRole("writer");
+    }
+
+    while(1){
+        // Collect every consecutive block that is ready, starting at the next one to be written
+        int count = 0;
+        int iovCount = 0;
+        while(count < MAX_WRITE_BATCH){
+            Node* node = reorderTakeNext(thData->toWrite);
+            if(node == NULL){
+                break;
+            }
+            if(STATS_ON){
+                statsRecordLatency(LATENCY_REORDER, statsNow() - node->encryptTime);
+            }
+            addToDigest(thData, node);
+            if(thData->container != NULL){
+                if(!containerAddChunk(thData->container, node->blockSize, node->checksum, &frames[count])){
+                    exit(1);
+                }
+                iov[iovCount].iov_base = &frames[count];
+                iov[iovCount].iov_len = sizeof(containerChunk);
+                iovCount++;
+            }
+            nodes[count] = node;
+            iov[iovCount].iov_base = node->data;
+            iov[iovCount].iov_len = node->blockSize;
+            iovCount++;
+            count++;
+        }
+
+        if(count > 0){
+            // One syscall for the whole run, then the reader has room again
+            uint64_t writeStart = STATS_ON ? statsNow() : 0;
+            int done = -1;
+            if(thData->pipeSize > 0){
+                done = spliceEncryptedBatch(iov, iovCount);
+                if(done < 0){
+                    thData->pipeSize = 0;
+                }
+            }
+            if(done < 0){
+                done = writeEncryptedBatch(iov, iovCount);
+            }
+            if(!done){
+                exit(1);
+            }
+            if(STATS_ON){
+                uint64_t writeEnd = statsNow();
+                statsAddTime(STAGE_WRITE, writeEnd - writeStart);
+                statsCount(COUNTER_WRITE_CALLS, 1);
+                statsCount(COUNTER_CHUNKS_WRITTEN, count);
+                for(int i = 0; i < count; i++){
+                    statsRecordLatency(LATENCY_TOTAL, writeEnd - nodes[i]->readTime);
+                }
+            }
 
-uint8_t* readKeyFile(const uint8_t* filename, long* fileSize){
-    FILE* file = fopen(filename, "rb");
-    // Try to read the file, indicates if faild
-    if(file == NULL){
-        fprintf(stderr, "Error: opening the file!\n");
-        return NULL;
-    }
+            // The blocks go back to the pool for the reader (once the pipe is done with them when spliced)
+            for(int i = 0; i < count; i++){
+                if(thData->pipeSize > 0){
+                    splicedBytes += nodes[i]->blockSize;
+                    nodes[i]->next = NULL;
+                    if(deferredTail != NULL){
+                        deferredTail->next = nodes[i];
+                    }
+                    else {
+                        deferredHead = nodes[i];
+                    }
+                    deferredTail = nodes[i];
+                }
+                else {
+                    poolRelease(thData->pool, nodes[i]);
+                }
+            }
+            while(deferredHead != NULL && deferredStart + deferredHead->blockSize + thData->pipeSize <= splicedBytes){
+                Node* node = deferredHead;
+                deferredHead = node->next;
+                if(deferredHead == NULL){
+                    deferredTail = NULL;
+                }
+                deferredStart += node->blockSize;
+                poolRelease(thData->pool, node);
+            }
+            written += count;
+            eventNotify(&thData->spaceEvent);
+            idleRounds = 0;
+            continue;
+        }
 
-    // Get the file size
-    fseek(file, 0, SEEK_END);
-    *fileSize = ftell(file);
-    if(*fileSize == -1){
-        fprintf(stderr, "Error: getting file size!\n");
-        fclose(file);
-        return NULL;
-    }
-    fseek(file, 0, SEEK_SET);
+        // Everything the reader read was written
+        if(atomic_load(&thData->finishFlag) && written == atomic_load(&thData->totalBlocks)){
+            break;
+        }
 
-    // Allocate memory for the key file
-    uint8_t* array = (uint8_t*)malloc(*fileSize);
-    if(array == NULL){
-        fprintf(stderr, "Error: allocating memory!\n");
-        fclose(file);
-        return NULL;
+        if(++idleRounds < SPIN_ROUNDS){
+            cpuRelax();
+            continue;
+        }
+
+        // Park until a block is encrypted or the reader finishes
+        unsigned ticket = eventPrepareWait(&thData->writeEvent);
+        if(reorderNextReady(thData->toWrite) || (atomic_load(&thData->finishFlag) && written == atomic_load(&thData->totalBlocks))){
+            eventCancelWait(&thData->writeEvent);
+        }
+        else {
+            uint64_t waitStart = STATS_ON ? statsNow() : 0;
+            eventWait(&thData->writeEvent, ticket);
+            if(STATS_ON){
+                statsAddTime(STAGE_WAIT, statsNow() - waitStart);
+                statsCount(COUNTER_PARKS, 1);
+            }
+        }
+        idleRounds = 0;
     }
 
-    // Read the key file
-    size_t fileBytes = fread(array, 1, *fileSize, file);
-    if(fileBytes != *fileSize){
-        fprintf(stderr, "Error: reading the file!\n");
-        free(array);
-        fclose(file);
-        return NULL;
+    // The process is about to exit, the pipe keeps its own references to the pages of the blocks still in it
+    while(deferredHead != NULL){
+        Node* node = deferredHead;
+        deferredHead = node->next;
+        poolRelease(thData->pool, node);
     }
 
-    fclose(file);
-    return array;
+    // The released blocks cached by this thread go back to the pool
+    poolFlushCache(thData->pool);
+    return NULL;
 }
 
 
-void rotateKey(uint8_t* key, long amount, long size){
-    for(long i = 0; i < amount; i++){
-        leftShiftKey(key, size);
+int reportChecksum(const programOptions* options, uint32_t digest, long bytes){
+    const char* side = options->checksum == CHECKSUM_INPUT ? "input" : "output";
+    if(options->checksumPath == NULL){
+        fprintf(stderr, "crc32c %08" PRIx32 " %ld %s\n", digest, bytes, side);
+        return 1;
+    }
+
+    FILE* sidecar = fopen(options->checksumPath, "w");
+    if(sidecar == NULL){
+        perror("Error: opening the checksum file");
+        return 0;
+    }
+    fprintf(sidecar, "crc32c %08" PRIx32 " %ld %s\n", digest, bytes, side);
+    if(fclose(sidecar) != 0){
+        perror("Error: writing the checksum file");
+        return 0;
     }
+    return 1;
 }
 
 
-void leftShiftKey(uint8_t* key, long size){
-    uint8_t carry = 0;
-    
-    for(long i = size - 1; i >= 0; i--){
-        uint8_t curByte = key[i];
-        uint8_t tmpCarry = (curByte & 0x80) >> 7;
-        key[i] = (curByte << 1) | carry;
-        carry = tmpCarry;
+int openFiles(const programOptions* options, mappedFiles* files){
+    files->input = NULL;
+    files->output = NULL;
+    files->size = -1;
+
+    int inFd = -1;
+    struct stat inStat;
+    if(options->inputPath != NULL){
+        inFd = open(options->inputPath, O_RDONLY);
+        if(inFd < 0 || fstat(inFd, &inStat) != 0){
+            perror("Error: opening the input file");
+            return 0;
+        }
     }
-    
-    // Roll over the leftmost bit to be the rightmost bit
-    key[size-1] = key[size-1] | carry;
-}
 
+    int outFd = -1;
+    struct stat outStat;
+    if(options->outputPath != NULL){
+        // Not truncated yet - it could also be the input, and it may still be streamed to (e.g. /dev/null)
+        outFd = open(options->outputPath, O_RDWR | O_CREAT, 0644);
+        if(outFd < 0){
+            outFd = open(options->outputPath, O_WRONLY | O_CREAT, 0644);
+        }
+        if(outFd < 0 || fstat(outFd, &outStat) != 0){
+            perror("Error: opening the output file");
+            return 0;
+        }
+    }
 
-void encryptBlock(uint8_t* text, const uint8_t* key, long blockSize){
-    for(long i = 0; i < blockSize; i++){
-        text[i] = text[i] ^ key[i];
+    // A checksum, a container or the stats are made by the pipeline's threads, the files are streamed through it (and can't be the same file)
+    int framed = options->container || options->extract;
+    int streamed = options->checksum != CHECKSUM_OFF || framed || options->stats;
+    if(streamed && inFd >= 0 && outFd >= 0 && inStat.st_dev == outStat.st_dev && inStat.st_ino == outStat.st_ino){
+        fprintf(stderr, "Error: --checksum, --container, --extract and --stats can't encrypt a file in place.\n");
+        return 0;
     }
-}
 
+    // Both are regular files - map them, no stdin/stdout involved (a range is read where it is instead)
+    int range = options->rangeOffset >= 0 || options->rangeLength >= 0;
+    if(!range && !streamed && inFd >= 0 && outFd >= 0 && S_ISREG(inStat.st_mode) && S_ISREG(outStat.st_mode)){
+        long size = inStat.st_size;
+        // The same file on both sides is encrypted in place
+        int inPlace = inStat.st_dev == outStat.st_dev && inStat.st_ino == outStat.st_ino;
+        if(!inPlace && (ftruncate(outFd, 0) != 0 || ftruncate(outFd, size) != 0)){
+            perror("Error: sizing the output file");
+            return 0;
+        }
 
-void writeEncrypted(const uint8_t* encrypted, long length){
-    fwrite(encrypted, sizeof(uint8_t), length, stdout);
-}
+        if(size > 0){
+            void* output = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, outFd, 0);
+            void* input = inPlace ? output : mmap(NULL, size, PROT_READ, MAP_SHARED, inFd, 0);
+            if(input == MAP_FAILED || output == MAP_FAILED){
+                perror("Error: mapping the files");
+                return 0;
+            }
+            madvise(input, size, MADV_SEQUENTIAL);
+            files->input = (const uint8_t*)input;
+            files->output = (uint8_t*)output;
+        }
+        files->size = size;
 
+        close(inFd);
+        close(outFd);
+        return 1;
+    }
 
-long readInput(uint8_t* input, long length){
-    long counter = 0;
-    uint8_t byte;
+    // Otherwise the files are streamed through stdin/stdout
+    if(inFd >= 0){
+        if(dup2(inFd, STDIN_FILENO) < 0){
+            perror("Error: redirecting the input file");
+            return 0;
+        }
+        close(inFd);
+    }
+    // Resuming, or extracting some chunks, keeps what's in the output
+    int keep = options->resume || options->chunkFirst >= 0;
+    if(outFd >= 0){
+        if((S_ISREG(outStat.st_mode) && !keep && ftruncate(outFd, 0) != 0) || dup2(outFd, STDOUT_FILENO) < 0){
+            perror("Error: redirecting the output file");
+            return 0;
+        }
+        close(outFd);
+    }
+    return 1;
+}
 
-    counter = fread(input, sizeof(uint8_t), length, stdin);
 
-    return counter;
+int encryptMapped(const XorStream* stream, mappedFiles* files, int threadsNum, long chunkSize){
+    // No queues and no ordering: every thread (main thread included) claims chunks and XORs them from input to output map
+    if(!xorStreamProcessBuffer(stream, files->input, files->output, files->size, threadsNum, chunkSize)){
+        fprintf(stderr, "Error: Failed to encrypt the mapped files.\n");
+        return 0;
+    }
+
+    if(files->size > 0){
+        if(files->input != files->output){
+            munmap((void*)files->input, files->size);
+        }
+        munmap(files->output, files->size);
+    }
+    return 1;
 }
 
 
-void* threadFunction(void* arg){
-    // Threads variables data
-    threadData* thData = (threadData*) arg;
+int encryptRange(const uint8_t* key, long keySize, KeyCache* keyCache, long chunkSize, long offset, long length){
+    // A seekable input is read in place at the range, its size tells where the range (and the input) ends
+    struct stat inStat;
+    long base = -1;
+    long end = length >= 0 ? offset + length : LONG_MAX;
+    if(fstat(STDIN_FILENO, &inStat) == 0 && S_ISREG(inStat.st_mode)){
+        base = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    }
+    if(base >= 0 && inStat.st_size - base < end){
+        end = inStat.st_size - base;
+    }
+    if(offset >= end){
+        return 1;
+    }
 
-    while(!isEmpty(thData->toEncrypt) || !isEmpty(thData->toWrite) || !thData->finishFlag){
-        // Node to store the data from stdin/encrypted (encryptNode)
-        Node* encryptNode = NULL;
-        // Node to store the data to write to stdout (writeNode)
-        Node* writeNode = NULL;
-
-        // Try first to write to stdout if data is avliable
-        writeNode = dequeue(thData->toWrite);
-        if(writeNode != NULL){
-            // If got a node but not in the right order to write, return it to the queue
-            if(writeNode->blockNum != thData->blockNumber){
-                int enqueuedNode = enqueueNode(thData->toWrite, writeNode);
-                if(enqueuedNode == 0){
-                    fprintf(stderr, "Error: Failed to enqueue a node.\n");
-                    return NULL;
-                }
+    uint8_t* buffer = (uint8_t*)malloc(chunkSize);
+    KeyCursor cursor;
+    if(buffer == NULL || !keyCursorInit(&cursor, key, keySize)){
+        fprintf(stderr, "Error: Failed to allocate the range buffer.\n");
+        free(buffer);
+        return 0;
+    }
+    keyCursorSetCache(&cursor, keyCache);
+
+    // Work on whole key blocks, from the one containing offset to the one containing the last byte
+    long firstBlock = offset / keySize;
+    long position = firstBlock * keySize;
+    long stop = end == LONG_MAX ? LONG_MAX : (end - 1) / keySize * keySize + keySize;
+    int done = 1;
+
+    // Without seeking, the bytes before the first block are read and dropped (not encrypted)
+    if(base < 0){
+        long skipped = 0;
+        while(skipped < position){
+            long want = position - skipped < chunkSize ? position - skipped : chunkSize;
+            long got = readInput(buffer, want);
+            skipped += got;
+            if(got < want){
+                break;
             }
-            // Else - write the data to stdout, increment the block number to be written, and free allocated memory
-            else {
-                pthread_mutex_lock(&mutexBlockNum);
-                writeEncrypted(writeNode->data, writeNode->blockSize);
-                thData->blockNumber++;
-                pthread_mutex_unlock(&mutexBlockNum);
-
-                free(writeNode->data);
-                free(writeNode);
-            }
-        }
-
-        // If there's plaintext data to be encrypted, do that
-        if(!isEmpty(thData->toEncrypt)){
-            encryptNode = dequeue(thData->toEncrypt);
-        }
-        // If not null, we have data to process
-        if(encryptNode != NULL){
-            // Get by how much we need to rotate the key
-            long rotateAmount = encryptNode->blockNum % (encryptNode->blockSize * 8);
-            // Allocate memory, and copy, to store the rotated key (original stays untouched)
-            uint8_t* rotatedKey = (uint8_t*)malloc(thData->keySize);
-            memcpy(rotatedKey, thData->key, thData->keySize);
-            rotateKey(rotatedKey, rotateAmount, thData->keySize);
-            
-            // Encrypt the plaintext data
-            encryptBlock(encryptNode->data, rotatedKey, encryptNode->blockSize);
-            
-            free(rotatedKey);
-
-            // Put the node in the queue to be written
-            if(enqueueNode(thData->toWrite, encryptNode) == 0){
-                    fprintf(stderr, "Error: Failed to enqueue a node.\n");
-                    return NULL;
+        }
+        if(skipped < position){
+            stop = position;
+        }
+    }
+
+    while(position < stop){
+        long want = stop - position < chunkSize ? stop - position : chunkSize;
+        long got;
+        if(base >= 0){
+            got = 0;
+            while(got < want){
+                ssize_t bytes = pread(STDIN_FILENO, buffer + got, want - got, base + position + got);
+                if(bytes < 0 && errno == EINTR){
+                    continue;
+                }
+                if(bytes < 0){
+                    perror("Error: reading the range");
+                    done = 0;
+                    break;
                 }
+                if(bytes == 0){
+                    break;
+                }
+                got += bytes;
+            }
+        }
+        else {
+            got = readInput(buffer, want);
+        }
+        if(got <= 0){
+            break;
+        }
+
+        // A block cut short by the end of the input gets its short-block rotation, like in a full pass
+        keyCursorEncrypt(&cursor, buffer, buffer, got, position / keySize);
+
+        // Only the requested bytes of the first and last blocks are written
+        long from = offset > position ? offset - position : 0;
+        long to = end - position < got ? end - position : got;
+        if(to > from && !writeEncrypted(buffer + from, to - from)){
+            done = 0;
+            break;
+        }
+
+        position += got;
+        if(got < want){
+            break;
         }
     }
 
-    return NULL;
+    keyCursorFree(&cursor);
+    free(buffer);
+    return done;
+}
+
+
+/*
+ * Skips the first bytes of stdin: seeks past them when it's seekable, otherwise reads and drops them.
+ */
+static int skipInput(long bytes, long chunkSize){
+    struct stat inStat;
+    if(fstat(STDIN_FILENO, &inStat) == 0 && S_ISREG(inStat.st_mode) && lseek(STDIN_FILENO, bytes, SEEK_CUR) >= 0){
+        return 1;
+    }
+
+    uint8_t* buffer = (uint8_t*)malloc(chunkSize);
+    if(buffer == NULL){
+        fprintf(stderr, "Error: Failed to allocate the skip buffer.\n");
+        return 0;
+    }
+    long skipped = 0;
+    while(skipped < bytes){
+        long want = bytes - skipped < chunkSize ? bytes - skipped : chunkSize;
+        long got = readInput(buffer, want);
+        skipped += got;
+        if(got < want){
+            break;
+        }
+    }
+    free(buffer);
+    if(skipped < bytes){
+        fprintf(stderr, "Error: The input is shorter than the part of the container already written.\n");
+        return 0;
+    }
+    return 1;
+}
+
+
+long parseSize(const char* text){
+    char* end;
+    long size = strtol(text, &end, 10);
+    if(end == text || size < 0){
+        return -1;
+    }
+
+    // Optional binary suffix
+    switch(*end){
+        case '\0':
+            return size;
+        case 'k': case 'K':
+            size *= 1024L;
+            break;
+        case 'm': case 'M':
+            size *= 1024L * 1024;
+            break;
+        case 'g': case 'G':
+            size *= 1024L * 1024 * 1024;
+            break;
+        default:
+            return -1;
+    }
+    return end[1] == '\0' ? size : -1;
 }
 
 
-char* processInput(int argc, char* argv[], int* threads){
+int processInput(int argc, char* argv[], programOptions* options){
     // checks number of arguments are valid
-    if(argc != 5){
-        fprintf(stderr, "Error: Wrong number of arguments. Please use ./program -n threadNum -key keyPath\n");
-        return NULL;
+    if(argc < 5){
+        fprintf(stderr, "Error: Wrong number of arguments. Please use ./program -n threadNum|auto -key keyPath [-i input] [-o output] [--batch dirOrList -o outputDir] [--serve socketPath] [--key-cache-mb budget] [--checksum[=output|input]] [--checksum-file path] [--container|--extract [--chunks first-last]] [--resume] [--chunk size] [--offset size] [--length size] [--io=mode] [--kernel=name] [--affinity] [--alloc-stats] [--stats[=json]]\n");
+        return 0;
     }
 
-    char* path = NULL;
+    options->threads = -1;
+    options->autoThreads = 0;
+    options->keyPath = NULL;
+    options->kernel = NULL;
+    options->allocStats = 0;
+    options->chunkSize = DEFAULT_CHUNK_SIZE;
+    options->inputPath = NULL;
+    options->outputPath = NULL;
+    options->ioMode = "auto";
+    options->stats = 0;
+    options->rangeOffset = -1;
+    options->rangeLength = -1;
+    options->affinity = 0;
+    options->batchPath = NULL;
+    options->servePath = NULL;
+    options->keyCacheBytes = 0;
+    options->checksum = CHECKSUM_OFF;
+    options->checksumPath = NULL;
+    options->container = 0;
+    options->extract = 0;
+    options->resume = 0;
+    options->chunkFirst = -1;
+    options->chunkLast = -1;
     // Assuming each processor has THREADS_PER_CORE to use. If user asks for more, raise an error.
     int maxThreads = get_nprocs() * THREADS_PER_CORE;
 
     for (int i = 1; i < argc; i++){
         // Search for the number of threads
         if (strcmp(argv[i], "-n") == 0 && i < argc - 1) {
-            *threads = atoi(argv[++i]);
+            if(strcmp(argv[++i], "auto") == 0){
+                options->autoThreads = 1;
+                options->threads = get_nprocs() * AUTO_THREADS_PER_CORE;
+            }
+            else {
+                options->threads = atoi(argv[i]);
+            }
         }
         // Search for the the file path
-        else if (strcmp(argv[i], "-k") == 0 && i < argc) {
-            path = argv[++i];
+        else if (strcmp(argv[i], "-k") == 0 && i < argc - 1) {
+            options->keyPath = argv[++i];
+        }
+        // Search for the input/output files
+        else if (strcmp(argv[i], "-i") == 0 && i < argc - 1) {
+            options->inputPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i < argc - 1) {
+            options->outputPath = argv[++i];
+        }
+        // Search for the work unit size
+        else if (strcmp(argv[i], "--chunk") == 0 && i < argc - 1) {
+            options->chunkSize = parseSize(argv[++i]);
+            if(options->chunkSize <= 0){
+                fprintf(stderr, "Error: Invalid chunk size %s.\n", argv[i]);
+                return 0;
+            }
+        }
+        // Search for the range to output
+        else if (strcmp(argv[i], "--offset") == 0 && i < argc - 1) {
+            options->rangeOffset = parseSize(argv[++i]);
+            if(options->rangeOffset < 0){
+                fprintf(stderr, "Error: Invalid offset %s.\n", argv[i]);
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "--length") == 0 && i < argc - 1) {
+            options->rangeLength = parseSize(argv[++i]);
+            if(options->rangeLength < 0){
+                fprintf(stderr, "Error: Invalid length %s.\n", argv[i]);
+                return 0;
+            }
+        }
+        // Search for the I/O mode
+        else if (strncmp(argv[i], "--io=", strlen("--io=")) == 0) {
+            options->ioMode = argv[i] + strlen("--io=");
+            if(strcmp(options->ioMode, "auto") != 0 && strcmp(options->ioMode, "rw") != 0 && strcmp(options->ioMode, "splice") != 0 && strcmp(options->ioMode, "uring") != 0){
+                fprintf(stderr, "Error: Unknown I/O mode %s.\n", options->ioMode);
+                return 0;
+            }
+        }
+        // Search for a forced XOR kernel
+        else if (strncmp(argv[i], "--kernel=", strlen("--kernel=")) == 0) {
+            options->kernel = argv[i] + strlen("--kernel=");
+        }
+        // Search for the batch of files
+        else if (strcmp(argv[i], "--batch") == 0 && i < argc - 1) {
+            options->batchPath = argv[++i];
+        }
+        // Search for the daemon socket
+        else if (strcmp(argv[i], "--serve") == 0 && i < argc - 1) {
+            options->servePath = argv[++i];
+        }
+        // Search for the key cache budget
+        else if (strcmp(argv[i], "--key-cache-mb") == 0 && i < argc - 1) {
+            char* end;
+            long megabytes = strtol(argv[++i], &end, 10);
+            if(end == argv[i] || *end != '\0' || megabytes < 0 || megabytes > LONG_MAX / (1024L * 1024)){
+                fprintf(stderr, "Error: Invalid key cache budget %s.\n", argv[i]);
+                return 0;
+            }
+            options->keyCacheBytes = megabytes * 1024 * 1024;
+        }
+        // Search for the checksum side and its sidecar file
+        else if (strcmp(argv[i], "--checksum") == 0 || strcmp(argv[i], "--checksum=output") == 0) {
+            options->checksum = CHECKSUM_OUTPUT;
+        }
+        else if (strcmp(argv[i], "--checksum=input") == 0) {
+            options->checksum = CHECKSUM_INPUT;
+        }
+        else if (strcmp(argv[i], "--checksum-file") == 0 && i < argc - 1) {
+            options->checksumPath = argv[++i];
+        }
+        // Search for the container mode and its options
+        else if (strcmp(argv[i], "--container") == 0) {
+            options->container = 1;
+        }
+        else if (strcmp(argv[i], "--extract") == 0) {
+            options->extract = 1;
+        }
+        else if (strcmp(argv[i], "--resume") == 0) {
+            options->resume = 1;
+        }
+        else if (strcmp(argv[i], "--chunks") == 0 && i < argc - 1) {
+            char* end;
+            options->chunkFirst = strtol(argv[++i], &end, 10);
+            options->chunkLast = options->chunkFirst;
+            if(end != argv[i] && *end == '-'){
+                char* last = end + 1;
+                options->chunkLast = strtol(last, &end, 10);
+                if(end == last){
+                    options->chunkLast = -2;
+                }
+            }
+            if(end == argv[i] || *end != '\0' || options->chunkFirst < 0 || options->chunkLast < options->chunkFirst){
+                fprintf(stderr, "Error: Invalid chunks %s (first-last, or one chunk).\n", argv[i]);
+                return 0;
+            }
+        }
+        // Search for the worker pinning flag
+        else if (strcmp(argv[i], "--affinity") == 0) {
+            options->affinity = 1;
+        }
+        // Search for the allocation report flag
+        else if (strcmp(argv[i], "--alloc-stats") == 0) {
+            options->allocStats = 1;
+        }
+        // Search for the pipeline statistics flag (text or JSON report)
+        else if (strcmp(argv[i], "--stats") == 0) {
+            options->stats = 1;
+        }
+        else if (strcmp(argv[i], "--stats=json") == 0) {
+            options->stats = 2;
+        }
+        else {
+            fprintf(stderr, "Error: Unknown argument %s.\n", argv[i]);
+            return 0;
         }
     }
 
-    if(*threads < 0 || *threads > maxThreads || path == NULL){
+    if(options->threads < 0 || options->threads > maxThreads || options->keyPath == NULL){
         fprintf(stderr, "Error: In valid arguments were provided.\n");
-        return NULL;
+        return 0;
+    }
+    // A batch has its own inputs, and writes a whole file each
+    if(options->batchPath != NULL && (options->outputPath == NULL || options->inputPath != NULL || options->rangeOffset >= 0 || options->rangeLength >= 0)){
+        fprintf(stderr, "Error: --batch needs -o with the output directory, and can't be used with -i, --offset or --length.\n");
+        return 0;
+    }
+    // The daemon's streams come from its clients
+    if(options->servePath != NULL && (options->inputPath != NULL || options->outputPath != NULL || options->batchPath != NULL || options->rangeOffset >= 0 || options->rangeLength >= 0)){
+        fprintf(stderr, "Error: --serve can't be used with -i, -o, --batch, --offset or --length.\n");
+        return 0;
+    }
+    // The checksum is computed by the streaming pipeline's workers
+    if(options->checksumPath != NULL && options->checksum == CHECKSUM_OFF){
+        options->checksum = CHECKSUM_OUTPUT;
+    }
+    if(options->checksum != CHECKSUM_OFF && (options->batchPath != NULL || options->servePath != NULL || options->rangeOffset >= 0 || options->rangeLength >= 0)){
+        fprintf(stderr, "Error: --checksum can't be used with --batch, --serve, --offset or --length.\n");
+        return 0;
+    }
+    // A container is one stream, with its own checksums
+    if((options->container || options->extract) && (options->container == options->extract || options->checksum != CHECKSUM_OFF || options->batchPath != NULL
+       || options->servePath != NULL || options->rangeOffset >= 0 || options->rangeLength >= 0)){
+        fprintf(stderr, "Error: Use either --container or --extract, without --checksum, --batch, --serve, --offset or --length.\n");
+        return 0;
+    }
+    // The stats are recorded by the streaming pipeline only
+    if(options->stats && (options->batchPath != NULL || options->servePath != NULL || options->rangeOffset >= 0 || options->rangeLength >= 0 || options->extract)){
+        fprintf(stderr, "Error: --stats can't be used with --batch, --serve, --offset, --length or --extract.\n");
+        return 0;
+    }
+    if((options->resume && !options->container && !options->extract) || (options->chunkFirst >= 0 && !options->extract)){
+        fprintf(stderr, "Error: --resume needs --container or --extract, and --chunks needs --extract.\n");
+        return 0;
+    }
+    if(options->resume && options->outputPath == NULL){
+        fprintf(stderr, "Error: --resume needs the output file (-o).\n");
+        return 0;
     }
 
-    return path;
+    return 1;
 }
 
 
 int main(int argc, char* argv[]){    
-    int threadsNum = -1;
-    char* keyfilePath = processInput(argc, argv, &threadsNum);
-
-    if(keyfilePath == NULL){
+    programOptions options;
+    if(!processInput(argc, argv, &options)){
         fprintf(stderr, "Error: In valid arguments were provided.\n");
         return 1;
     }
+    int threadsNum = options.threads;
+    char* keyfilePath = options.keyPath;
+
+    // Statistics are on before any thread starts recording
+    if(options.stats){
+        statsInit(options.stats == 2);
+    }
+
+    // Pick the XOR kernel once, before any thread starts encrypting
+    if(!selectXorKernel(options.kernel)){
+        fprintf(stderr, "Error: Couldn't select the XOR kernel.\n");
+        return 1;
+    }
+
+    // The CRC tables are built before any worker checksums a chunk
+    if(options.checksum != CHECKSUM_OFF || options.container || options.extract){
+        crc32cInit();
+    }
 
     // Try to read the the keyfile if succeed, we also get the block size (in bytes)
     long blockSize;
@@ -196,76 +1572,293 @@ int main(int argc, char* argv[]){
         fprintf(stderr, "Error: Wasn't able to read the key file.\n");
         return 1;
     }
-    if(blockSize == 0){
-        fprintf(stderr,"Error: The key can't by an empty file (blocksize must be > 0)\n");
+
+    // The work unit is a chunk of whole key-sized blocks, whatever the key size
+    long blocksPerChunk = (options.chunkSize + blockSize - 1) / blockSize;
+    long chunkSize = blocksPerChunk * blockSize;
+
+    // Optional keystream period cache, built once (with every core) and shared by all the threads
+    KeyCache* keyCache = NULL;
+    // It's only an optimization: without room for one key, or without the memory, the run goes on without it
+    if(options.keyCacheBytes > 0 && options.keyCacheBytes < blockSize){
+        fprintf(stderr, "Warning: --key-cache-mb is smaller than the key (%ld bytes), running without the key cache.\n", blockSize);
+    }
+    else if(options.keyCacheBytes > 0){
+        keyCache = keyCacheCreate(key, blockSize, options.keyCacheBytes, get_nprocs() - 1);
+        if(keyCache == NULL){
+            fprintf(stderr, "Warning: The key cache couldn't be allocated, running without it.\n");
+        }
+    }
+
+    // Daemon: the key and the workers stay loaded, the clients send the streams
+    if(options.servePath != NULL){
+        if(options.autoThreads){
+            threadsNum = get_nprocs();
+        }
+        int served = runDaemon(options.servePath, key, blockSize, keyCache, threadsNum);
+        if(options.allocStats && keyCache != NULL){
+            keyCacheReport(keyCache);
+        }
+        keyCacheDestroy(keyCache);
+        releaseKey(key, blockSize);
+        return served ? 0 : 1;
+    }
+
+    // A batch of files: the key, the threads and the buffers are set up once for all of them
+    if(options.batchPath != NULL){
+        if(options.autoThreads){
+            threadsNum = get_nprocs() - 1;
+        }
+        int batchDone = encryptBatch(options.batchPath, options.outputPath, key, blockSize, keyCache, chunkSize, threadsNum);
+        if(options.allocStats && keyCache != NULL){
+            keyCacheReport(keyCache);
+        }
+        keyCacheDestroy(keyCache);
+        releaseKey(key, blockSize);
+        return batchDone ? 0 : 1;
+    }
+
+    // Input/output files: mapped when both are regular files, otherwise streamed through stdin/stdout
+    mappedFiles files;
+    if(!openFiles(&options, &files)){
         return 1;
     }
+    // Only a range of the input - start at its block, nothing before it is encrypted
+    if(options.rangeOffset >= 0 || options.rangeLength >= 0){
+        long offset = options.rangeOffset >= 0 ? options.rangeOffset : 0;
+        int rangeDone = encryptRange(key, blockSize, keyCache, chunkSize, offset, options.rangeLength);
+        keyCacheDestroy(keyCache);
+        releaseKey(key, blockSize);
+        return rangeDone ? 0 : 1;
+    }
+    // A container's chunks are decrypted on their own, by threads claiming them
+    if(options.extract){
+        if(options.autoThreads){
+            threadsNum = get_nprocs() - 1;
+        }
+        int extractDone = extractContainer(key, blockSize, keyCache, threadsNum, options.chunkFirst >= 0 ? options.chunkFirst : 0, options.chunkLast, options.resume);
+        if(options.allocStats && keyCache != NULL){
+            keyCacheReport(keyCache);
+        }
+        keyCacheDestroy(keyCache);
+        releaseKey(key, blockSize);
+        return extractDone ? 0 : 1;
+    }
+    if(files.size >= 0){
+        XorStream* stream = xorStreamCreateShared(key, blockSize);
+        if(stream == NULL){
+            return 1;
+        }
+        xorStreamSetKeyCache(stream, keyCache);
+        // Mapped chunks are claimed by whoever is free, there's nothing to tune: one thread per core
+        if(options.autoThreads){
+            threadsNum = get_nprocs() - 1;
+        }
+        int mappedDone = encryptMapped(stream, &files, threadsNum, chunkSize);
+        if(options.allocStats && keyCache != NULL){
+            keyCacheReport(keyCache);
+        }
+        xorStreamDestroy(stream);
+        keyCacheDestroy(keyCache);
+        releaseKey(key, blockSize);
+        return mappedDone ? 0 : 1;
+    }
+
+    // A container starts with its header, or after the chunks of an interrupted one that still verify
+    ContainerIndex containerIndex = {NULL, 0, 0, 0};
+    containerHeader header;
+    long containerBase = -1;
+    long firstChunk = 0;
+    if(options.container){
+        if(chunkSize > CONTAINER_MAX_CHUNK){
+            fprintf(stderr, "Error: The container chunks can't be larger than %ld bytes.\n", CONTAINER_MAX_CHUNK);
+            return 1;
+        }
+        containerInitHeader(&header, key, blockSize, chunkSize);
+        if(options.resume){
+            int complete;
+            firstChunk = containerResume(STDOUT_FILENO, &header, &containerIndex, &complete);
+            if(firstChunk < 0){
+                return 1;
+            }
+            if(complete){
+                fprintf(stderr, "Info: --resume: the container is already complete (%ld chunks).\n", firstChunk);
+                containerIndexFree(&containerIndex);
+                keyCacheDestroy(keyCache);
+                releaseKey(key, blockSize);
+                return 0;
+            }
+            if(firstChunk > 0 && !skipInput(firstChunk * chunkSize, chunkSize)){
+                return 1;
+            }
+            fprintf(stderr, "Info: --resume: %ld chunks verified, continuing from byte %ld.\n", firstChunk, firstChunk * chunkSize);
+            containerBase = 0;
+        }
+        else {
+            struct stat outStat;
+            if(fstat(STDOUT_FILENO, &outStat) == 0 && S_ISREG(outStat.st_mode)){
+                containerBase = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+            }
+            if(!containerWriteHeader(STDOUT_FILENO, &header)){
+                return 1;
+            }
+        }
+    }
 
-    Queue* toEncrypt = createQueue();
-    Queue* toWrite = createQueue();
+    // One queue per worker (the main thread shares the first one).
+    // With -n auto only some of them get chunks at a time, each must be able to hold the whole high-water mark.
+    WorkQueues* toEncrypt = createWorkQueues(threadsNum > 0 ? threadsNum : 1, options.autoThreads ? MAX_QUEUE_SIZE * threadsNum : MAX_QUEUE_SIZE);
+    // Keep about PIPELINE_BYTES in flight, but always enough chunks to keep every thread busy
+    long depth = PIPELINE_BYTES / chunkSize;
+    if(depth < 2 * threadsNum + 4){
+        depth = 2 * threadsNum + 4;
+    }
+    if(depth > REORDER_WINDOW){
+        depth = REORDER_WINDOW;
+    }
+
+    ReorderBuffer* toWrite = createReorderBuffer(depth);
     if(toEncrypt == NULL || toWrite == NULL){
         fprintf(stderr, "Error: Couldn't create a queue,\n");
         return 1;
     }
+    if(STATS_ON){
+        reorderSetLockHook(toWrite, lockReorderTimed);
+    }
 
-    pthread_mutex_init(&mutexBlockNum, NULL);
+    // Blocks in flight are bounded by the reorder window (plus the one being read and what the threads cache)
+    BlockPool* pool = createBlockPool(chunkSize, depth + 4 * POOL_CACHE_SIZE);
+    if(pool == NULL){
+        fprintf(stderr, "Error: Couldn't create the block pool.\n");
+        return 1;
+    }
+    if(STATS_ON){
+        poolSetLockHook(pool, lockPoolTimed);
+    }
 
     // Structre to hold the queues data
     threadData thData; 
     thData.toEncrypt = toEncrypt;
     thData.toWrite = toWrite;
+    thData.pool = pool;
+    thData.pipeSize = 0;
+    thData.wakeFd = -1;
+    thData.cpus = NULL;
+    thData.cpuCount = 0;
+    atomic_init(&thData.placedWorkers, 0);
+    thData.tuner = NULL;
+    atomic_init(&thData.activeWorkers, threadsNum);
     thData.key = key;
     thData.keySize = blockSize;
-    thData.blockNumber = 0;
-    thData.finishFlag = 0;
+    thData.keyCache = keyCache;
+    thData.blocksPerChunk = blocksPerChunk;
+    atomic_init(&thData.finishFlag, 0);
+    atomic_init(&thData.totalBlocks, 0);
+    thData.checksum = options.checksum;
+    thData.digest = 0;
+    thData.digestBytes = 0;
+    thData.container = options.container ? &containerIndex : NULL;
+    thData.firstChunk = firstChunk;
+    eventInit(&thData.workEvent);
+    eventInit(&thData.spaceEvent);
+    eventInit(&thData.writeEvent);
+    eventInit(&thData.tuneEvent);
+
+    // -n auto starts with one worker per core, the reader tunes it from there
+    AutoTuner tuner;
+    if(options.autoThreads){
+        autoTuneInit(&tuner, 1, threadsNum, get_nprocs(), statsNow());
+        thData.tuner = &tuner;
+        atomic_store(&thData.activeWorkers, tuner.level);
+        workSetActive(toEncrypt, tuner.level);
+    }
+
+    if(options.stats && !statsStartSampler(toEncrypt, toWrite)){
+        return 1;
+    }
+
+    // The io_uring engine does both the reading and the writing, when the kernel allows it
+    Uring ring;
+    int useUring = 0;
+    if(strcmp(options.ioMode, "uring") == 0 && options.container){
+        fprintf(stderr, "Warning: --container writes through the writer thread, ignoring --io=uring.\n");
+    }
+    else if(strcmp(options.ioMode, "uring") == 0){
+        useUring = uringInit(&ring, URING_QUEUE_DEPTH);
+        if(useUring){
+            thData.wakeFd = eventfd(0, EFD_CLOEXEC);
+            if(thData.wakeFd < 0){
+                uringDestroy(&ring);
+                useUring = 0;
+            }
+        }
+        if(!useUring){
+            fprintf(stderr, "Warning: io_uring isn't available, falling back to --io=auto.\n");
+        }
+    }
+
+    // Otherwise the writer thread is the only one writing to stdout
+    pthread_t writer;
+    if(!useUring){
+        // The frames of a container live on the writer's stack, they're copied with writev()
+        thData.pipeSize = options.container ? 0 : setupSpliceOutput(options.ioMode);
+        if (pthread_create(&writer, NULL, &writerFunction, (void*)&thData) != 0) {
+            fprintf(stderr, "Error: Failed to create the writer thread\n");
+            return 1;
+        }
+    }
     
-    // Create N threads and send them to work
+    // Pinned workers, in NUMA node order
+    if(options.affinity && threadsNum > 0){
+        thData.cpuCount = listNumaCpus(&thData.cpus);
+        if(thData.cpuCount == 0){
+            fprintf(stderr, "Warning: No CPU to pin the workers to, running without --affinity.\n");
+        }
+    }
+
+    // Create N threads and send them to work, each with its own queue
     pthread_t threads[threadsNum];
+    workerData workers[threadsNum];
     for(int i = 0; i < threadsNum; i++){
-        if (pthread_create(&threads[i], NULL, &threadFunction, (void*)&thData) != 0) {
+        workers[i].shared = &thData;
+        workers[i].id = i;
+        if (pthread_create(&threads[i], NULL, &threadFunction, (void*)&workers[i]) != 0) {
             fprintf(stderr, "Error: Failed to create the thread(s)\n");
             return 1;
         }
     }
 
-    // Array to store the input data (plaintex)
-    uint8_t* inputData = (uint8_t*)malloc(blockSize);
-
-    long blockNum = 0;
-    long read;
-
-    while(1){
-        read = readInput(inputData, blockSize);
-        // While we still read stdin data, get it, and put in the queue for encryption
-        if(read > 0){
-            int enqueued = enqueue(toEncrypt, inputData, read, blockNum);
-            if(enqueued == 0){
-                fprintf(stderr,"Error: Failed to enqueue the data.\n");
-                return 1;
-            }
-            
-            inputData = (uint8_t*)malloc(blockSize);
-            if(inputData == NULL){
-                fprintf(stderr, "Error: Failed to allocate inputData.\n");
-                return 1;
-            }
-            blockNum++;
+    // The main thread's own worker data, used when it has to help clearing the pipeline
+    workerData mainWorker;
+    if(!initWorker(&mainWorker, &thData, 0)){
+        return 1;
+    }
 
-            // If the toEncrypt Q is getting to large (75% +), main thread rests (as longs as it's not the only thread)
-            if(getSize(toEncrypt) >= (0.75 * MAX_QUEUE_SIZE) && threadsNum > 0){
-                sleep(0.05);
-            }
+    // Pinned workers first place their buffers, nothing is read into them before that
+    while(thData.cpuCount > 0 && atomic_load(&thData.placedWorkers) < threadsNum){
+        unsigned ticket = eventPrepareWait(&thData.spaceEvent);
+        if(atomic_load(&thData.placedWorkers) == threadsNum){
+            eventCancelWait(&thData.spaceEvent);
+            break;
         }
+        eventWait(&thData.spaceEvent, ticket);
+    }
 
-        // Finished reading from stdin
-        if(read < blockSize){
-            thData.finishFlag = 1;
-            break;
+    // Read with the io_uring engine (it writes too), or the regular reader feeding the writer thread
+    if(useUring){
+        if(!uringPipeline(&thData, &ring, threadsNum, &mainWorker)){
+            return 1;
         }
     }
+    else if(!streamInput(&thData, threadsNum, &mainWorker)){
+        return 1;
+    }
 
     // Main finished to read from stdin; goes to "help" encrypting and writing to stdout
-    threadFunction((void*)&thData);
+    if(!runWorker(&mainWorker)){
+        return 1;
+    }
+    freeWorker(&mainWorker);
 
     // Wait for the threads to finish
     for (int i = 0; i < threadsNum; i++) {
@@ -274,16 +1867,48 @@ int main(int argc, char* argv[]){
             return 1;
         }
     }
+    if (!useUring && pthread_join(writer, NULL) != 0) {
+        perror("Failed to join the writer thread");
+        return 1;
+    }
+    // No worker signals the eventfd anymore, the ring can go
+    if(useUring){
+        uringDestroy(&ring);
+        close(thData.wakeFd);
+    }
+
+    if(options.checksum != CHECKSUM_OFF && !reportChecksum(&options, thData.digest, thData.digestBytes)){
+        return 1;
+    }
+    if(options.container){
+        if(!containerFinish(STDOUT_FILENO, containerBase, &header, &containerIndex)){
+            return 1;
+        }
+        containerIndexFree(&containerIndex);
+    }
+    if(thData.tuner != NULL && tuner.reported == 0){
+        fprintf(stderr, "Info: -n auto: the input ended before the tuning settled, %d workers were active.\n", tuner.level);
+    }
+    if(options.allocStats){
+        poolReport(pool);
+        if(keyCache != NULL){
+            keyCacheReport(keyCache);
+        }
+    }
+    statsReport();
 
     // Clean up
-    queueDistroyMutex(toEncrypt);
-    queueDistroyMutex(toWrite);
-    pthread_mutex_destroy(&mutexBlockNum);
+    reorderDestroy(toWrite);
+    eventDestroy(&thData.workEvent);
+    eventDestroy(&thData.spaceEvent);
+    eventDestroy(&thData.writeEvent);
+    eventDestroy(&thData.tuneEvent);
     
-    free(inputData);
-    free(key);
-    free(toEncrypt);
-    free(toWrite);
+    poolDestroy(pool);
+    keyCacheDestroy(keyCache);
+    releaseKey(key, blockSize);
+    free(thData.cpus);
+    workQueuesDestroy(toEncrypt);
 
     return 0;
 }
\ No newline at end of file
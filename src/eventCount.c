@@ -0,0 +1,55 @@
+#include "../include/eventCount.h"
+
+void eventInit(EventCount* event){
+    atomic_init(&event->epoch, 0);
+    atomic_init(&event->waiters, 0);
+    pthread_mutex_init(&event->mutexEvent, NULL);
+    pthread_cond_init(&event->condEvent, NULL);
+}
+
+
+unsigned eventPrepareWait(EventCount* event){
+    // Register first, then read the epoch and let the caller re-check its condition.
+    // A notifier that doesn't see this waiter made the condition true before, so the re-check will see it.
+    atomic_fetch_add(&event->waiters, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    return atomic_load(&event->epoch);
+}
+
+
+void eventCancelWait(EventCount* event){
+    atomic_fetch_sub(&event->waiters, 1);
+}
+
+
+void eventWait(EventCount* event, unsigned ticket){
+    pthread_mutex_lock(&event->mutexEvent);
+    while(atomic_load(&event->epoch) == ticket){
+        pthread_cond_wait(&event->condEvent, &event->mutexEvent);
+    }
+    pthread_mutex_unlock(&event->mutexEvent);
+
+    atomic_fetch_sub(&event->waiters, 1);
+}
+
+
+void eventNotify(EventCount* event){
+    // Pairs with the fence in eventPrepareWait(): either the waiter is seen here, or it sees the condition
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // Nobody waiting - a fence and a load is all it costs
+    if(atomic_load_explicit(&event->waiters, memory_order_relaxed) == 0){
+        return;
+    }
+
+    pthread_mutex_lock(&event->mutexEvent);
+    atomic_fetch_add(&event->epoch, 1);
+    pthread_cond_broadcast(&event->condEvent);
+    pthread_mutex_unlock(&event->mutexEvent);
+}
+
+
+void eventDestroy(EventCount* event){
+    pthread_mutex_destroy(&event->mutexEvent);
+    pthread_cond_destroy(&event->condEvent);
+}
@@ -0,0 +1,278 @@
+#include "../include/keyCache.h"
+#include "../include/xorStream.h"
+
+/*
+ * The cache: either the whole table (period rotations), or slots rotations kept in LRU order.
+ * The LRU is a list of slots from newest to oldest, and a chained hash from rotation to slot.
+ */
+struct KeyCache{
+    const uint8_t* key;
+    long keySize;
+    long period;
+    uint8_t* table;
+    int whole;
+    long slots;
+    long used;
+    long* amounts;
+    long* newer;
+    long* older;
+    long newest;
+    long oldest;
+    long* buckets;
+    long* chain;
+    long bucketMask;
+    pthread_mutex_t mutexCache;
+    atomic_long hits;
+    atomic_long misses;
+};
+
+
+/*
+ * Data structure to hold the part of the table one thread builds: rotations [first, last).
+ */
+typedef struct tableJob{
+    KeyCache* cache;
+    long first;
+    long last;
+} tableJob;
+
+
+/*
+ * Builds a part of the table: one full rotation, then each next one is the previous rotated by one more bit.
+ */
+static void* buildTableFunction(void* arg){
+    tableJob* job = (tableJob*)arg;
+    KeyCache* cache = job->cache;
+    long keySize = cache->keySize;
+
+    if(job->first < job->last){
+        rotateKeyCopy(cache->table + job->first * keySize, cache->key, job->first, keySize);
+    }
+    for(long r = job->first + 1; r < job->last; r++){
+        rotateKeyCopy(cache->table + r * keySize, cache->table + (r - 1) * keySize, 1, keySize);
+    }
+    return NULL;
+}
+
+
+static int buildTable(KeyCache* cache, int threads){
+    // At least 64 rotations per thread (none for keys under 8 bytes), and never a negative count
+    if(threads > cache->period / 64){
+        threads = (int)(cache->period / 64);
+    }
+    if(threads < 0){
+        threads = 0;
+    }
+
+    tableJob jobs[threads + 1];
+    pthread_t workers[threads > 0 ? threads : 1];
+    long share = (cache->period + threads) / (threads + 1);
+    for(int i = 0; i <= threads; i++){
+        jobs[i].cache = cache;
+        jobs[i].first = i * share < cache->period ? i * share : cache->period;
+        jobs[i].last = (i + 1) * share < cache->period ? (i + 1) * share : cache->period;
+    }
+    jobs[threads].last = cache->period;
+
+    int created = 0;
+    for(; created < threads; created++){
+        if(pthread_create(&workers[created], NULL, &buildTableFunction, &jobs[created]) != 0){
+            break;
+        }
+    }
+    // The parts of the threads that couldn't be created are built here
+    for(int i = created; i <= threads; i++){
+        buildTableFunction(&jobs[i]);
+    }
+    for(int i = 0; i < created; i++){
+        if(pthread_join(workers[i], NULL) != 0){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+KeyCache* keyCacheCreate(const uint8_t* key, long keySize, long budget, int threads){
+    // Failures are silent, the cache is only an optimization: the caller says it runs without it
+    if(key == NULL || keySize <= 0 || budget < keySize){
+        return NULL;
+    }
+
+    KeyCache* cache = (KeyCache*)calloc(1, sizeof(KeyCache));
+    if(cache == NULL){
+        return NULL;
+    }
+    cache->key = key;
+    cache->keySize = keySize;
+    cache->period = keySize * 8;
+    cache->newest = -1;
+    cache->oldest = -1;
+    pthread_mutex_init(&cache->mutexCache, NULL);
+    atomic_init(&cache->hits, 0);
+    atomic_init(&cache->misses, 0);
+
+    // The whole period when it fits (the division keeps huge keys from overflowing)
+    cache->whole = budget / keySize >= cache->period;
+    cache->slots = cache->whole ? cache->period : budget / keySize;
+
+    void* table = NULL;
+    if(posix_memalign(&table, 64, cache->slots * keySize) != 0){
+        table = NULL;
+    }
+    cache->table = (uint8_t*)table;
+    if(cache->table == NULL){
+        keyCacheDestroy(cache);
+        return NULL;
+    }
+
+    if(cache->whole){
+        if(!buildTable(cache, threads)){
+            keyCacheDestroy(cache);
+            return NULL;
+        }
+        return cache;
+    }
+
+    long bucketCount = 1;
+    while(bucketCount < cache->slots){
+        bucketCount *= 2;
+    }
+    cache->bucketMask = bucketCount - 1;
+    cache->amounts = (long*)malloc(cache->slots * sizeof(long));
+    cache->newer = (long*)malloc(cache->slots * sizeof(long));
+    cache->older = (long*)malloc(cache->slots * sizeof(long));
+    cache->chain = (long*)malloc(cache->slots * sizeof(long));
+    cache->buckets = (long*)malloc(bucketCount * sizeof(long));
+    if(cache->amounts == NULL || cache->newer == NULL || cache->older == NULL || cache->chain == NULL || cache->buckets == NULL){
+        keyCacheDestroy(cache);
+        return NULL;
+    }
+    for(long i = 0; i < bucketCount; i++){
+        cache->buckets[i] = -1;
+    }
+    return cache;
+}
+
+
+const uint8_t* keyCacheTable(const KeyCache* cache){
+    return cache->whole ? cache->table : NULL;
+}
+
+
+static long findSlot(KeyCache* cache, long amount){
+    for(long slot = cache->buckets[amount & cache->bucketMask]; slot >= 0; slot = cache->chain[slot]){
+        if(cache->amounts[slot] == amount){
+            return slot;
+        }
+    }
+    return -1;
+}
+
+
+static void unlinkSlot(KeyCache* cache, long slot){
+    if(cache->newer[slot] >= 0){
+        cache->older[cache->newer[slot]] = cache->older[slot];
+    }
+    else {
+        cache->newest = cache->older[slot];
+    }
+    if(cache->older[slot] >= 0){
+        cache->newer[cache->older[slot]] = cache->newer[slot];
+    }
+    else {
+        cache->oldest = cache->newer[slot];
+    }
+}
+
+
+static void pushNewest(KeyCache* cache, long slot){
+    cache->newer[slot] = -1;
+    cache->older[slot] = cache->newest;
+    if(cache->newest >= 0){
+        cache->newer[cache->newest] = slot;
+    }
+    cache->newest = slot;
+    if(cache->oldest < 0){
+        cache->oldest = slot;
+    }
+}
+
+
+/*
+ * Takes the oldest slot out of the list and the hash, for a new rotation.
+ */
+static long evictOldest(KeyCache* cache){
+    long slot = cache->oldest;
+    unlinkSlot(cache, slot);
+
+    long* link = &cache->buckets[cache->amounts[slot] & cache->bucketMask];
+    while(*link != slot){
+        link = &cache->chain[*link];
+    }
+    *link = cache->chain[slot];
+    return slot;
+}
+
+
+void keyCacheGet(KeyCache* cache, uint8_t* dest, long amount){
+    long keySize = cache->keySize;
+    if(cache->whole){
+        memcpy(dest, cache->table + amount * keySize, keySize);
+        return;
+    }
+
+    pthread_mutex_lock(&cache->mutexCache);
+    long slot = findSlot(cache, amount);
+    if(slot >= 0){
+        memcpy(dest, cache->table + slot * keySize, keySize);
+        unlinkSlot(cache, slot);
+        pushNewest(cache, slot);
+        pthread_mutex_unlock(&cache->mutexCache);
+        atomic_fetch_add(&cache->hits, 1);
+        return;
+    }
+    pthread_mutex_unlock(&cache->mutexCache);
+
+    // Miss - rotate outside the lock, then keep a copy (unless another thread added it meanwhile)
+    atomic_fetch_add(&cache->misses, 1);
+    rotateKeyCopy(dest, cache->key, amount, keySize);
+
+    pthread_mutex_lock(&cache->mutexCache);
+    if(findSlot(cache, amount) < 0){
+        slot = cache->used < cache->slots ? cache->used++ : evictOldest(cache);
+        memcpy(cache->table + slot * keySize, dest, keySize);
+        cache->amounts[slot] = amount;
+        cache->chain[slot] = cache->buckets[amount & cache->bucketMask];
+        cache->buckets[amount & cache->bucketMask] = slot;
+        pushNewest(cache, slot);
+    }
+    pthread_mutex_unlock(&cache->mutexCache);
+}
+
+
+void keyCacheReport(KeyCache* cache){
+    if(cache->whole){
+        fprintf(stderr, "key cache: whole table, %ld rotations, %ld bytes\n", cache->period, cache->period * cache->keySize);
+        return;
+    }
+    long hits = atomic_load(&cache->hits);
+    long misses = atomic_load(&cache->misses);
+    fprintf(stderr, "key cache: LRU of %ld of %ld rotations, %ld hits, %ld misses (%.1f%% hit rate)\n",
+            cache->slots, cache->period, hits, misses, hits + misses > 0 ? 100.0 * hits / (hits + misses) : 0.0);
+}
+
+
+void keyCacheDestroy(KeyCache* cache){
+    if(cache == NULL){
+        return;
+    }
+    free(cache->table);
+    free(cache->amounts);
+    free(cache->newer);
+    free(cache->older);
+    free(cache->chain);
+    free(cache->buckets);
+    pthread_mutex_destroy(&cache->mutexCache);
+    free(cache);
+}
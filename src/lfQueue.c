@@ -0,0 +1,157 @@
+#include "../include/lfQueue.h"
+
+LfQueue* createLfQueue(long capacity){
+    if(capacity < 2){
+        capacity = 2;
+    }
+
+    // The position to slot mapping is a mask, so the capacity must be a power of 2
+    size_t size = 1;
+    while(size < (size_t)capacity){
+        size <<= 1;
+    }
+
+    LfQueue* queue = (LfQueue*)aligned_alloc(CACHE_LINE_SIZE, sizeof(LfQueue));
+    if(queue == NULL){
+        fprintf(stderr, "Error: Failed to allocate memory for the queue.\n");
+        return NULL;
+    }
+
+    queue->slots = (LfSlot*)aligned_alloc(CACHE_LINE_SIZE, size * sizeof(LfSlot));
+    if(queue->slots == NULL){
+        fprintf(stderr, "Error: Failed to allocate memory for the queue slots.\n");
+        free(queue);
+        return NULL;
+    }
+
+    // Slot i is first free for the producer at position i
+    for(size_t i = 0; i < size; i++){
+        atomic_init(&queue->slots[i].sequence, i);
+        queue->slots[i].node = NULL;
+    }
+    queue->mask = size - 1;
+    atomic_init(&queue->enqueuePos, 0);
+    atomic_init(&queue->dequeuePos, 0);
+
+    return queue;
+}
+
+
+int lfEnqueue(LfQueue* queue, uint8_t* data, long blockSize, long blockNum){
+    Node* newNode = createNode(data, blockSize, blockNum);
+    if(newNode == NULL){
+        fprintf(stderr, "Error: Can't enqueue a new node");
+        return 0;
+    }
+
+    if(!lfEnqueueNode(queue, newNode)){
+        free(newNode);
+        return 0;
+    }
+    return 1;
+}
+
+
+int lfEnqueueNode(LfQueue* queue, Node* node){
+    if(queue == NULL || node == NULL){
+        fprintf(stderr, "Error: Can't enqueue a node.\n");
+        return 0;
+    }
+
+    size_t pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+    LfSlot* slot;
+
+    while(1){
+        slot = &queue->slots[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+        // The slot is free for this position - try to claim it
+        if(diff == 0){
+            if(atomic_compare_exchange_weak_explicit(&queue->enqueuePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)){
+                break;
+            }
+        }
+        // The slot still holds the node from one lap ago - the queue is full
+        else if(diff < 0){
+            return 0;
+        }
+        // Another producer took this position, catch up
+        else {
+            pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+        }
+    }
+
+    node->next = NULL;
+    slot->node = node;
+    // Hand the slot over to the consumer of this position
+    atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+    return 1;
+}
+
+
+Node* lfDequeue(LfQueue* queue){
+    if(queue == NULL){
+        fprintf(stderr, "Error: Can't dequeue - Queue is null");
+        return NULL;
+    }
+
+    size_t pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+    LfSlot* slot;
+
+    while(1){
+        slot = &queue->slots[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+
+        // The slot holds the node of this position - try to claim it
+        if(diff == 0){
+            if(atomic_compare_exchange_weak_explicit(&queue->dequeuePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)){
+                break;
+            }
+        }
+        // Nothing was enqueued at this position yet - the queue is empty
+        else if(diff < 0){
+            return NULL;
+        }
+        // Another consumer took this position, catch up
+        else {
+            pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+        }
+    }
+
+    Node* node = slot->node;
+    // Free the slot for the producer one lap later
+    atomic_store_explicit(&slot->sequence, pos + queue->mask + 1, memory_order_release);
+    return node;
+}
+
+
+int lfIsEmpty(LfQueue* queue){
+    return lfGetSize(queue) == 0;
+}
+
+
+int lfGetSize(LfQueue* queue){
+    if(queue == NULL){
+        fprintf(stderr, "Error: Given queue is invalid.\n");
+        return 0;
+    }
+
+    // Read the consumer side first so a concurrent dequeue can't make the size negative
+    size_t dequeuePos = atomic_load_explicit(&queue->dequeuePos, memory_order_acquire);
+    size_t enqueuePos = atomic_load_explicit(&queue->enqueuePos, memory_order_acquire);
+    if(enqueuePos <= dequeuePos){
+        return 0;
+    }
+    return (int)(enqueuePos - dequeuePos);
+}
+
+
+void lfQueueDestroy(LfQueue* queue){
+    if(queue == NULL){
+        return;
+    }
+    free(queue->slots);
+    free(queue);
+}
@@ -0,0 +1,352 @@
+#include "../include/pipelineStats.h"
+
+#include <time.h>
+#include <string.h>
+
+int statsEnabled = 0;
+
+static int statsJson = 0;
+static uint64_t startTime;
+static uint64_t startTicks;
+
+// The records of every thread that recorded something, merged by statsReport()
+static ThreadStats* statsList = NULL;
+static pthread_mutex_t mutexStats = PTHREAD_MUTEX_INITIALIZER;
+static __thread ThreadStats* localStats = NULL;
+
+// The queue depth timeline, written by the sampler thread only
+typedef struct depthSample{
+    uint64_t time;
+    long toEncrypt;
+    long toWrite;
+} depthSample;
+
+static depthSample samples[STATS_MAX_SAMPLES];
+static int sampleCount = 0;
+static long samplePeriod = STATS_SAMPLE_MS;
+static WorkQueues* sampledQueue;
+static ReorderBuffer* sampledBuffer;
+static pthread_t sampler;
+static int samplerRunning = 0;
+static atomic_int samplerStop;
+
+static const char* stageNames[STAGE_COUNT] = {"read", "rotate", "xor", "checksum", "write", "wait", "reorderLock", "poolLock"};
+static const char* latencyNames[LATENCY_COUNT] = {"queued", "encrypt", "reorder", "total"};
+static const char* counterNames[COUNTER_COUNT] = {"chunksRead", "bytesRead", "chunksEncrypted", "steals", "outOfOrder", "chunksWritten", "writeCalls", "parks", "reorderContended", "poolContended"};
+
+
+void statsInit(int json){
+    statsJson = json;
+    startTime = statsNow();
+    startTicks = statsTicks();
+    statsEnabled = 1;
+}
+
+
+/*
+ * Gets the calling thread's record, created on first use.
+ */
+static ThreadStats* threadStats(){
+    if(localStats == NULL){
+        localStats = (ThreadStats*)calloc(1, sizeof(ThreadStats));
+        if(localStats == NULL){
+            fprintf(stderr, "Error: Failed to allocate the thread statistics.\n");
+            exit(1);
+        }
+        localStats->role = "main";
+        pthread_mutex_lock(&mutexStats);
+        localStats->next = statsList;
+        statsList = localStats;
+        pthread_mutex_unlock(&mutexStats);
+    }
+    return localStats;
+}
+
+
+void statsSetRole(const char* role){
+    threadStats()->role = role;
+}
+
+
+uint64_t statsNow(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+uint64_t statsTicks(){
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return statsNow();
+#endif
+}
+
+
+void statsAddTime(statsStage stage, uint64_t time){
+    threadStats()->stageTime[stage] += time;
+}
+
+
+void statsCount(statsCounter counter, long amount){
+    threadStats()->counters[counter] += amount;
+}
+
+
+/*
+ * Log-linear bucket: STATS_SUB_BUCKETS buckets per power of two.
+ */
+static int bucketOf(uint64_t time){
+    if(time < STATS_SUB_BUCKETS){
+        return (int)time;
+    }
+    int power = 63 - __builtin_clzll(time);
+    int sub = (int)((time >> (power - 2)) & (STATS_SUB_BUCKETS - 1));
+    return (power - 1) * STATS_SUB_BUCKETS + sub;
+}
+
+
+/*
+ * The largest time that falls in a bucket (its upper bound, what the percentiles report).
+ */
+static uint64_t bucketLimit(int bucket){
+    if(bucket < STATS_SUB_BUCKETS){
+        return bucket;
+    }
+    int power = bucket / STATS_SUB_BUCKETS + 1;
+    int sub = bucket % STATS_SUB_BUCKETS;
+    return ((uint64_t)(STATS_SUB_BUCKETS + sub + 1) << (power - 2)) - 1;
+}
+
+
+void statsRecordLatency(statsLatency latency, uint64_t time){
+    threadStats()->histograms[latency][bucketOf(time)]++;
+}
+
+
+void statsLockTimed(pthread_mutex_t* mutex, statsStage stage, statsCounter contended){
+    // Uncontended locks only cost the trylock
+    if(pthread_mutex_trylock(mutex) == 0){
+        return;
+    }
+    uint64_t start = statsNow();
+    pthread_mutex_lock(mutex);
+    ThreadStats* stats = threadStats();
+    stats->stageTime[stage] += statsNow() - start;
+    stats->counters[contended]++;
+}
+
+
+static void* samplerFunction(void* arg){
+    (void)arg;
+    while(!atomic_load(&samplerStop)){
+        // Full - keep every other sample and sample half as often
+        if(sampleCount == STATS_MAX_SAMPLES){
+            for(int i = 0; i < STATS_MAX_SAMPLES / 2; i++){
+                samples[i] = samples[2 * i];
+            }
+            sampleCount = STATS_MAX_SAMPLES / 2;
+            samplePeriod *= 2;
+        }
+
+        depthSample* sample = &samples[sampleCount++];
+        sample->time = statsNow() - startTime;
+        sample->toEncrypt = workSize(sampledQueue);
+        pthread_mutex_lock(&sampledBuffer->mutexBuffer);
+        sample->toWrite = sampledBuffer->size;
+        pthread_mutex_unlock(&sampledBuffer->mutexBuffer);
+
+        struct timespec period = {samplePeriod / 1000, (samplePeriod % 1000) * 1000000};
+        nanosleep(&period, NULL);
+    }
+    return NULL;
+}
+
+
+int statsStartSampler(WorkQueues* toEncrypt, ReorderBuffer* toWrite){
+    sampledQueue = toEncrypt;
+    sampledBuffer = toWrite;
+    atomic_init(&samplerStop, 0);
+    if(pthread_create(&sampler, NULL, &samplerFunction, NULL) != 0){
+        fprintf(stderr, "Error: Failed to create the statistics sampler thread.\n");
+        return 0;
+    }
+    samplerRunning = 1;
+    return 1;
+}
+
+
+void statsStopSampler(){
+    if(samplerRunning){
+        atomic_store(&samplerStop, 1);
+        pthread_join(sampler, NULL);
+        samplerRunning = 0;
+    }
+}
+
+
+/*
+ * Gets the latency under which the given fraction of the histogram falls (0 if it's empty).
+ */
+static uint64_t percentile(const uint64_t* histogram, double fraction){
+    uint64_t total = 0;
+    for(int i = 0; i < STATS_BUCKETS; i++){
+        total += histogram[i];
+    }
+    if(total == 0){
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(fraction * total);
+    uint64_t seen = 0;
+    for(int i = 0; i < STATS_BUCKETS; i++){
+        seen += histogram[i];
+        if(seen > rank || seen == total){
+            return bucketLimit(i);
+        }
+    }
+    return 0;
+}
+
+
+static uint64_t histogramCount(const uint64_t* histogram){
+    uint64_t total = 0;
+    for(int i = 0; i < STATS_BUCKETS; i++){
+        total += histogram[i];
+    }
+    return total;
+}
+
+
+void statsReport(){
+    if(!statsEnabled){
+        return;
+    }
+    statsStopSampler();
+
+    uint64_t elapsed = statsNow() - startTime;
+    double nsPerTick = (double)elapsed / (double)(statsTicks() - startTicks);
+
+    // Merge the threads by role (in the order the roles first appear), and everything into the totals
+    ThreadStats roles[16];
+    int roleThreads[16];
+    int roleCount = 0;
+    ThreadStats total;
+    memset(&total, 0, sizeof(total));
+
+    pthread_mutex_lock(&mutexStats);
+    for(ThreadStats* stats = statsList; stats != NULL; stats = stats->next){
+        stats->stageTime[STAGE_ROTATE] = (uint64_t)(stats->stageTime[STAGE_ROTATE] * nsPerTick);
+        stats->stageTime[STAGE_XOR] = (uint64_t)(stats->stageTime[STAGE_XOR] * nsPerTick);
+        stats->stageTime[STAGE_CHECKSUM] = (uint64_t)(stats->stageTime[STAGE_CHECKSUM] * nsPerTick);
+
+        int role = 0;
+        while(role < roleCount && strcmp(roles[role].role, stats->role) != 0){
+            role++;
+        }
+        if(role == roleCount){
+            if(roleCount == 16){
+                role = 15;
+            }
+            else {
+                memset(&roles[role], 0, sizeof(ThreadStats));
+                roles[role].role = stats->role;
+                roleThreads[role] = 0;
+                roleCount++;
+            }
+        }
+        roleThreads[role]++;
+
+        ThreadStats* targets[2] = {&roles[role], &total};
+        for(int t = 0; t < 2; t++){
+            for(int i = 0; i < STAGE_COUNT; i++){
+                targets[t]->stageTime[i] += stats->stageTime[i];
+            }
+            for(int i = 0; i < COUNTER_COUNT; i++){
+                targets[t]->counters[i] += stats->counters[i];
+            }
+            for(int l = 0; l < LATENCY_COUNT; l++){
+                for(int i = 0; i < STATS_BUCKETS; i++){
+                    targets[t]->histograms[l][i] += stats->histograms[l][i];
+                }
+            }
+        }
+    }
+
+    long maxEncrypt = 0, maxWrite = 0;
+    double sumEncrypt = 0, sumWrite = 0;
+    for(int i = 0; i < sampleCount; i++){
+        sumEncrypt += samples[i].toEncrypt;
+        sumWrite += samples[i].toWrite;
+        maxEncrypt = samples[i].toEncrypt > maxEncrypt ? samples[i].toEncrypt : maxEncrypt;
+        maxWrite = samples[i].toWrite > maxWrite ? samples[i].toWrite : maxWrite;
+    }
+    double avgEncrypt = sampleCount > 0 ? sumEncrypt / sampleCount : 0;
+    double avgWrite = sampleCount > 0 ? sumWrite / sampleCount : 0;
+
+    if(statsJson){
+        fprintf(stderr, "{\"elapsedMs\": %.3f, \"roles\": [", elapsed / 1e6);
+        for(int r = 0; r < roleCount; r++){
+            fprintf(stderr, "%s{\"role\": \"%s\", \"threads\": %d, \"stagesMs\": {", r > 0 ? ", " : "", roles[r].role, roleThreads[r]);
+            for(int i = 0; i < STAGE_COUNT; i++){
+                fprintf(stderr, "%s\"%s\": %.3f", i > 0 ? ", " : "", stageNames[i], roles[r].stageTime[i] / 1e6);
+            }
+            fprintf(stderr, "}}");
+        }
+        fprintf(stderr, "], \"latencyNs\": {");
+        for(int l = 0; l < LATENCY_COUNT; l++){
+            const uint64_t* histogram = total.histograms[l];
+            fprintf(stderr, "%s\"%s\": {\"count\": %" PRIu64 ", \"p50\": %" PRIu64 ", \"p90\": %" PRIu64 ", \"p99\": %" PRIu64 ", \"max\": %" PRIu64 "}",
+                    l > 0 ? ", " : "", latencyNames[l], histogramCount(histogram), percentile(histogram, 0.5), percentile(histogram, 0.9),
+                    percentile(histogram, 0.99), percentile(histogram, 1.0));
+        }
+        fprintf(stderr, "}, \"counters\": {");
+        for(int i = 0; i < COUNTER_COUNT; i++){
+            fprintf(stderr, "%s\"%s\": %ld", i > 0 ? ", " : "", counterNames[i], total.counters[i]);
+        }
+        fprintf(stderr, "}, \"depth\": {\"periodMs\": %ld, \"toEncrypt\": {\"avg\": %.1f, \"max\": %ld}, \"toWrite\": {\"avg\": %.1f, \"max\": %ld}, \"samples\": [",
+                samplePeriod, avgEncrypt, maxEncrypt, avgWrite, maxWrite);
+        for(int i = 0; i < sampleCount; i++){
+            fprintf(stderr, "%s[%.1f, %ld, %ld]", i > 0 ? ", " : "", samples[i].time / 1e6, samples[i].toEncrypt, samples[i].toWrite);
+        }
+        fprintf(stderr, "]}}\n");
+    }
+    else {
+        fprintf(stderr, "stats: %.3f ms elapsed\n", elapsed / 1e6);
+        fprintf(stderr, "stats: %-18s", "time (ms)");
+        for(int i = 0; i < STAGE_COUNT; i++){
+            fprintf(stderr, " %11s", stageNames[i]);
+        }
+        fprintf(stderr, "\n");
+        for(int r = 0; r < roleCount; r++){
+            fprintf(stderr, "stats: %-8s x%-9d", roles[r].role, roleThreads[r]);
+            for(int i = 0; i < STAGE_COUNT; i++){
+                fprintf(stderr, " %11.3f", roles[r].stageTime[i] / 1e6);
+            }
+            fprintf(stderr, "\n");
+        }
+        for(int l = 0; l < LATENCY_COUNT; l++){
+            const uint64_t* histogram = total.histograms[l];
+            fprintf(stderr, "stats: latency %-8s %10" PRIu64 " chunks  p50 %10.1f us  p90 %10.1f us  p99 %10.1f us  max %10.1f us\n",
+                    latencyNames[l], histogramCount(histogram), percentile(histogram, 0.5) / 1e3, percentile(histogram, 0.9) / 1e3,
+                    percentile(histogram, 0.99) / 1e3, percentile(histogram, 1.0) / 1e3);
+        }
+        fprintf(stderr, "stats: depth toEncrypt avg %.1f max %ld, toWrite avg %.1f max %ld (%d samples, every %ld ms)\n",
+                avgEncrypt, maxEncrypt, avgWrite, maxWrite, sampleCount, samplePeriod);
+        fprintf(stderr, "stats:");
+        for(int i = 0; i < COUNTER_COUNT; i++){
+            fprintf(stderr, " %s %ld", counterNames[i], total.counters[i]);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    // The records aren't needed anymore
+    while(statsList != NULL){
+        ThreadStats* stats = statsList;
+        statsList = stats->next;
+        free(stats);
+    }
+    localStats = NULL;
+    pthread_mutex_unlock(&mutexStats);
+}
@@ -1,6 +1,15 @@
 
 #include "../include/queue.h"
 
+
+/*
+ * The default lock of the reorder buffer.
+ */
+static void lockPlain(pthread_mutex_t* mutex){
+    pthread_mutex_lock(mutex);
+}
+
+
 Node* createNode(uint8_t* data, long blockSize, long blockNum){
     Node* newNode = (Node*)malloc(sizeof(Node));
     if(newNode == NULL){
@@ -16,6 +25,7 @@ Node* createNode(uint8_t* data, long blockSize, long blockNum){
     newNode->blockSize = blockSize;
     newNode->blockNum = blockNum;
     newNode->next = NULL;
+    newNode->owner = -1;
 
     return newNode;
 }
@@ -199,4 +209,125 @@ int getSize(Queue* queue) {
 
 void queueDistroyMutex(Queue* queue){
     pthread_mutex_destroy(&queue->mutexQueue);
-}
\ No newline at end of file
+}
+
+
+ReorderBuffer* createReorderBuffer(long window){
+    if(window <= 0){
+        fprintf(stderr, "Error: The reorder window must be > 0.\n");
+        return NULL;
+    }
+
+    ReorderBuffer* buffer = (ReorderBuffer*)malloc(sizeof(ReorderBuffer));
+    if(buffer == NULL){
+        fprintf(stderr, "Error: Failed to allocate memory for the reorder buffer.\n");
+        return NULL;
+    }
+
+    buffer->slots = (Node**)calloc(window, sizeof(Node*));
+    if(buffer->slots == NULL){
+        fprintf(stderr, "Error: Failed to allocate memory for the reorder slots.\n");
+        free(buffer);
+        return NULL;
+    }
+
+    buffer->window = window;
+    buffer->nextBlock = 0;
+    buffer->size = 0;
+    pthread_mutex_init(&buffer->mutexBuffer, NULL);
+    buffer->lockMutex = lockPlain;
+
+    return buffer;
+}
+
+
+int reorderInsert(ReorderBuffer* buffer, Node* node){
+    if(buffer == NULL || node == NULL){
+        fprintf(stderr, "Error: Can't insert a node in the reorder buffer.\n");
+        return 0;
+    }
+
+    buffer->lockMutex(&buffer->mutexBuffer);
+
+    // Only blocks in [nextBlock, nextBlock + window) have a slot of their own
+    long slot = node->blockNum % buffer->window;
+    if(node->blockNum < buffer->nextBlock || node->blockNum >= buffer->nextBlock + buffer->window || buffer->slots[slot] != NULL){
+        fprintf(stderr, "Error: Block %ld is outside the reorder window.\n", node->blockNum);
+        pthread_mutex_unlock(&buffer->mutexBuffer);
+        return 0;
+    }
+
+    // A chunk encrypted before the one the writer waits for has to sit in the buffer
+    int early = node->blockNum != buffer->nextBlock;
+    node->next = NULL;
+    buffer->slots[slot] = node;
+    buffer->size++;
+
+    pthread_mutex_unlock(&buffer->mutexBuffer);
+    return early ? 2 : 1;
+}
+
+
+void reorderSetLockHook(ReorderBuffer* buffer, void (*lockMutex)(pthread_mutex_t* mutex)){
+    buffer->lockMutex = lockMutex != NULL ? lockMutex : lockPlain;
+}
+
+
+Node* reorderTakeNext(ReorderBuffer* buffer){
+    if(buffer == NULL){
+        fprintf(stderr, "Error: Can't take from the reorder buffer - buffer is null");
+        return NULL;
+    }
+
+    buffer->lockMutex(&buffer->mutexBuffer);
+
+    long slot = buffer->nextBlock % buffer->window;
+    Node* node = buffer->slots[slot];
+    if(node != NULL){
+        buffer->slots[slot] = NULL;
+        buffer->nextBlock++;
+        buffer->size--;
+    }
+
+    pthread_mutex_unlock(&buffer->mutexBuffer);
+    return node;
+}
+
+
+int reorderNextReady(ReorderBuffer* buffer){
+    buffer->lockMutex(&buffer->mutexBuffer);
+    int ready = buffer->slots[buffer->nextBlock % buffer->window] != NULL;
+    pthread_mutex_unlock(&buffer->mutexBuffer);
+    return ready;
+}
+
+
+int reorderHasRoom(ReorderBuffer* buffer, long blockNum){
+    buffer->lockMutex(&buffer->mutexBuffer);
+    int room = blockNum < buffer->nextBlock + buffer->window;
+    pthread_mutex_unlock(&buffer->mutexBuffer);
+    return room;
+}
+
+
+int reorderIsEmpty(ReorderBuffer* buffer){
+    if(buffer == NULL){
+        fprintf(stderr, "Error: Given reorder buffer is invalid.\n");
+        return 0;
+    }
+    buffer->lockMutex(&buffer->mutexBuffer);
+    int empty = buffer->size == 0;
+    pthread_mutex_unlock(&buffer->mutexBuffer);
+
+    return empty;
+}
+
+
+void reorderDestroy(ReorderBuffer* buffer){
+    if(buffer == NULL){
+        return;
+    }
+    pthread_mutex_destroy(&buffer->mutexBuffer);
+    free(buffer->slots);
+    free(buffer);
+}
@@ -0,0 +1,159 @@
+#include "../include/uring.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+
+int uringInit(Uring* ring, unsigned entries){
+    memset(ring, 0, sizeof(Uring));
+    ring->ringFd = -1;
+
+#ifdef __NR_io_uring_setup
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if(fd < 0){
+        return 0;
+    }
+    ring->ringFd = fd;
+    ring->entries = params.sq_entries;
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    // Newer kernels map both rings with a single mmap
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        if(ring->cqRingSize > ring->sqRingSize){
+            ring->sqRingSize = ring->cqRingSize;
+        }
+        ring->cqRingSize = ring->sqRingSize;
+    }
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(ring->sqRing == MAP_FAILED){
+        ring->sqRing = NULL;
+        uringDestroy(ring);
+        return 0;
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        ring->cqRing = ring->sqRing;
+    }
+    else {
+        ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(ring->cqRing == MAP_FAILED){
+            ring->cqRing = NULL;
+            uringDestroy(ring);
+            return 0;
+        }
+    }
+
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED){
+        ring->sqes = NULL;
+        uringDestroy(ring);
+        return 0;
+    }
+
+    uint8_t* sq = (uint8_t*)ring->sqRing;
+    ring->sqHead = (unsigned*)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned*)(sq + params.sq_off.array);
+
+    uint8_t* cq = (uint8_t*)ring->cqRing;
+    ring->cqHead = (unsigned*)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    return 1;
+#else
+    (void)entries;
+    return 0;
+#endif
+}
+
+
+int uringRegisterBuffers(Uring* ring, const struct iovec* buffers, unsigned count){
+#ifdef __NR_io_uring_register
+    return syscall(__NR_io_uring_register, ring->ringFd, IORING_REGISTER_BUFFERS, buffers, count) == 0;
+#else
+    return 0;
+#endif
+}
+
+
+struct io_uring_sqe* uringGetSqe(Uring* ring){
+    unsigned head = atomic_load_explicit((_Atomic unsigned*)ring->sqHead, memory_order_acquire);
+    unsigned tail = *ring->sqTail + ring->toSubmit;
+    if(tail - head >= ring->entries){
+        return NULL;
+    }
+
+    unsigned index = tail & *ring->sqMask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sqArray[index] = index;
+    ring->toSubmit++;
+    return sqe;
+}
+
+
+int uringSubmit(Uring* ring, unsigned waitFor){
+    unsigned submit = ring->toSubmit;
+
+    // Publish the new entries to the kernel
+    if(submit > 0){
+        atomic_store_explicit((_Atomic unsigned*)ring->sqTail, *ring->sqTail + submit, memory_order_release);
+        ring->toSubmit = 0;
+    }
+    if(submit == 0 && waitFor == 0){
+        return 1;
+    }
+
+    while(1){
+        long done = syscall(__NR_io_uring_enter, ring->ringFd, submit, waitFor, waitFor > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if(done >= 0){
+            return 1;
+        }
+        if(errno != EINTR){
+            return 0;
+        }
+        // Interrupted - the entries may already be consumed, only the wait is left
+        submit = 0;
+    }
+}
+
+
+int uringNextCqe(Uring* ring, struct io_uring_cqe* cqe){
+    unsigned head = *ring->cqHead;
+    if(head == atomic_load_explicit((_Atomic unsigned*)ring->cqTail, memory_order_acquire)){
+        return 0;
+    }
+
+    *cqe = ring->cqes[head & *ring->cqMask];
+    atomic_store_explicit((_Atomic unsigned*)ring->cqHead, head + 1, memory_order_release);
+    return 1;
+}
+
+
+void uringDestroy(Uring* ring){
+    if(ring->sqes != NULL){
+        munmap(ring->sqes, ring->sqesSize);
+    }
+    if(ring->cqRing != NULL && ring->cqRing != ring->sqRing){
+        munmap(ring->cqRing, ring->cqRingSize);
+    }
+    if(ring->sqRing != NULL){
+        munmap(ring->sqRing, ring->sqRingSize);
+    }
+    if(ring->ringFd >= 0){
+        close(ring->ringFd);
+    }
+    memset(ring, 0, sizeof(Uring));
+    ring->ringFd = -1;
+}
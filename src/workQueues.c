@@ -0,0 +1,120 @@
+#include "../include/workQueues.h"
+
+WorkQueues* createWorkQueues(int count, long capacity){
+    if(count <= 0){
+        fprintf(stderr, "Error: There must be at least one work queue.\n");
+        return NULL;
+    }
+
+    WorkQueues* work = (WorkQueues*)malloc(sizeof(WorkQueues));
+    if(work == NULL){
+        fprintf(stderr, "Error: Failed to allocate memory for the work queues.\n");
+        return NULL;
+    }
+    work->queues = (LfQueue**)calloc(count, sizeof(LfQueue*));
+    if(work->queues == NULL){
+        fprintf(stderr, "Error: Failed to allocate memory for the work queues.\n");
+        free(work);
+        return NULL;
+    }
+    work->count = count;
+    work->active = count;
+    work->nextQueue = 0;
+
+    long perQueue = (capacity + count - 1) / count;
+    if(perQueue < MIN_WORK_QUEUE_SIZE){
+        perQueue = MIN_WORK_QUEUE_SIZE;
+    }
+    for(int i = 0; i < count; i++){
+        work->queues[i] = createLfQueue(perQueue);
+        if(work->queues[i] == NULL){
+            workQueuesDestroy(work);
+            return NULL;
+        }
+    }
+
+    return work;
+}
+
+
+int workPush(WorkQueues* work, Node* node, int queue){
+    // Without a preference, spread the chunks in turn (only the reader pushes, no need for an atomic)
+    if(queue < 0 || queue >= work->active){
+        queue = work->nextQueue % work->active;
+        work->nextQueue = (queue + 1) % work->active;
+    }
+
+    for(int i = 0; i < work->active; i++){
+        if(lfEnqueueNode(work->queues[(queue + i) % work->active], node)){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+void workSetActive(WorkQueues* work, int active){
+    if(active < 1){
+        active = 1;
+    }
+    if(active > work->count){
+        active = work->count;
+    }
+    work->active = active;
+}
+
+
+Node* workPop(WorkQueues* work, int home, int* stolen){
+    Node* node = lfDequeue(work->queues[home]);
+    if(stolen != NULL){
+        *stolen = 0;
+    }
+    if(node != NULL){
+        return node;
+    }
+
+    // Own queue empty - steal the oldest chunk of the next queues
+    for(int i = 1; i < work->count; i++){
+        node = lfDequeue(work->queues[(home + i) % work->count]);
+        if(node != NULL){
+            if(stolen != NULL){
+                *stolen = 1;
+            }
+            return node;
+        }
+    }
+    return NULL;
+}
+
+
+long workSize(WorkQueues* work){
+    long size = 0;
+    for(int i = 0; i < work->count; i++){
+        size += lfGetSize(work->queues[i]);
+    }
+    return size;
+}
+
+
+int workIsEmpty(WorkQueues* work){
+    for(int i = 0; i < work->count; i++){
+        if(!lfIsEmpty(work->queues[i])){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+void workQueuesDestroy(WorkQueues* work){
+    if(work == NULL){
+        return;
+    }
+    for(int i = 0; i < work->count; i++){
+        if(work->queues[i] != NULL){
+            lfQueueDestroy(work->queues[i]);
+        }
+    }
+    free(work->queues);
+    free(work);
+}
@@ -0,0 +1,139 @@
+/*
+ * A small client of the encryptUtil daemon (encryptUtil --serve): encrypts stdin to stdout through the daemon's socket.
+ * The output is the same as ./encryptUtil's with the daemon's key. stdin is sent as one stream, in frames of the given size.
+ *
+ * Build: make xorClient (or gcc -O2 src/xorClient.c src/daemonProtocol.c -o xorClient)
+ * Run:   ./xorClient -s socketPath [--frame size] < plaintext > cyphertext
+ */
+#include "../include/daemonProtocol.h"
+
+#define CLIENT_FRAME_SIZE (64 * 1024)
+
+
+/*
+ * Reads until the buffer is full or stdin ends.
+ */
+static long readStdin(uint8_t* buffer, long length){
+    long done = 0;
+    while(done < length){
+        ssize_t bytes = read(STDIN_FILENO, buffer + done, length - done);
+        if(bytes < 0 && errno == EINTR){
+            continue;
+        }
+        if(bytes < 0){
+            perror("Error: reading stdin");
+            return -1;
+        }
+        if(bytes == 0){
+            break;
+        }
+        done += bytes;
+    }
+    return done;
+}
+
+
+static int writeStdout(const uint8_t* buffer, long length){
+    long done = 0;
+    while(done < length){
+        ssize_t bytes = write(STDOUT_FILENO, buffer + done, length - done);
+        if(bytes < 0 && errno == EINTR){
+            continue;
+        }
+        if(bytes <= 0){
+            perror("Error: writing stdout");
+            return 0;
+        }
+        done += bytes;
+    }
+    return 1;
+}
+
+
+/*
+ * Sends one frame and writes its reply to stdout.
+ * The reply buffer grows when needed (a reply can be up to a key size longer than the request).
+ */
+static int exchange(int fd, uint32_t type, const uint8_t* payload, long length, uint8_t** reply, long* replySize){
+    if(!daemonSendFrame(fd, type, payload, length)){
+        fprintf(stderr, "Error: Failed to send a frame.\n");
+        return 0;
+    }
+
+    daemonHeader header;
+    if(daemonReadFull(fd, &header, sizeof(header)) != 1){
+        fprintf(stderr, "Error: The daemon closed the connection.\n");
+        return 0;
+    }
+    if(header.length > *replySize){
+        uint8_t* larger = (uint8_t*)realloc(*reply, header.length);
+        if(larger == NULL){
+            fprintf(stderr, "Error: Failed to allocate the reply buffer.\n");
+            return 0;
+        }
+        *reply = larger;
+        *replySize = header.length;
+    }
+    if(daemonReadFull(fd, *reply, header.length) < 0){
+        fprintf(stderr, "Error: The daemon closed the connection.\n");
+        return 0;
+    }
+    if(header.type != DAEMON_STATUS_OK){
+        fprintf(stderr, "Error: The daemon refused the frame: %.*s.\n", (int)header.length, (const char*)*reply);
+        return 0;
+    }
+    return writeStdout(*reply, header.length);
+}
+
+
+int main(int argc, char* argv[]){
+    const char* socketPath = NULL;
+    long frameSize = CLIENT_FRAME_SIZE;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "-s") == 0 && i < argc - 1){
+            socketPath = argv[++i];
+        }
+        else if(strcmp(argv[i], "--frame") == 0 && i < argc - 1){
+            frameSize = atol(argv[++i]);
+        }
+        else {
+            fprintf(stderr, "Error: Unknown argument %s.\n", argv[i]);
+            return 1;
+        }
+    }
+    if(socketPath == NULL || frameSize <= 0 || frameSize > DAEMON_MAX_FRAME){
+        fprintf(stderr, "Error: Please use ./xorClient -s socketPath [--frame size (1 to %d)]\n", DAEMON_MAX_FRAME);
+        return 1;
+    }
+
+    int fd = daemonConnect(socketPath);
+    if(fd < 0){
+        return 1;
+    }
+
+    uint8_t* request = (uint8_t*)malloc(frameSize);
+    long replySize = frameSize;
+    uint8_t* reply = (uint8_t*)malloc(replySize);
+    if(request == NULL || reply == NULL){
+        fprintf(stderr, "Error: Failed to allocate the buffers.\n");
+        return 1;
+    }
+
+    // The stream in frames, then the end of the stream for the held back bytes
+    int done = 1;
+    long read;
+    while(done && (read = readStdin(request, frameSize)) > 0){
+        done = exchange(fd, DAEMON_FRAME_DATA, request, read, &reply, &replySize);
+    }
+    if(read < 0){
+        done = 0;
+    }
+    if(done){
+        done = exchange(fd, DAEMON_FRAME_FINAL, NULL, 0, &reply, &replySize);
+    }
+
+    close(fd);
+    free(request);
+    free(reply);
+    return done ? 0 : 1;
+}
@@ -0,0 +1,347 @@
+#include "../include/xorKernel.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+static void xorBlockResolve(uint8_t* dest, const uint8_t* src, const uint8_t* key, long length);
+
+static void xorShiftedResolve(uint8_t* dest, const uint8_t* src, const uint8_t* key, int bits, long length);
+
+// The kernel used by xorBlock() and xorBlockRotated(), resolved to the best supported one on first use.
+// Threads of a library user may get there at the same time: the pointers are atomic (relaxed, they only point to code)
+// and the first use resolves them once.
+static _Atomic(xorKernelFunc) activeKernel = xorBlockResolve;
+static _Atomic(xorShiftedFunc) activeShifted = xorShiftedResolve;
+static _Atomic(const char*) activeName = "none";
+static pthread_once_t resolveOnce = PTHREAD_ONCE_INIT;
+
+
+static inline xorKernelFunc loadKernel(){
+    return atomic_load_explicit(&activeKernel, memory_order_relaxed);
+}
+
+
+static inline xorShiftedFunc loadShifted(){
+    return atomic_load_explicit(&activeShifted, memory_order_relaxed);
+}
+
+
+static void setKernel(const xorKernel* kernel){
+    atomic_store_explicit(&activeKernel, kernel->run, memory_order_relaxed);
+    atomic_store_explicit(&activeShifted, kernel->shifted, memory_order_relaxed);
+    atomic_store_explicit(&activeName, kernel->name, memory_order_relaxed);
+}
+
+
+void xorBlockScalar(uint8_t* dest, const uint8_t* src, const uint8_t* key, long length){
+    for(long i = 0; i < length; i++){
+        dest[i] = src[i] ^ key[i];
+    }
+}
+
+
+void xorShiftedScalar(uint8_t* dest, const uint8_t* src, const uint8_t* key, int bits, long length){
+    for(long i = 0; i < length; i++){
+        dest[i] = src[i] ^ (uint8_t)((key[i] << bits) | (key[i + 1] >> (8 - bits)));
+    }
+}
+
+
+static int alwaysSupported(void){
+    return 1;
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*
+ * Number of bytes to process one by one until dest is aligned to the vector width.
+ */
+static inline long headLength(const uint8_t* dest, long width, long length){
+    long head = (long)((width - ((uintptr_t)dest & (width - 1))) & (width - 1));
+    return head < length ? head : length;
+}
+
+
+__attribute__((target("sse2")))
+void xorBlockSse2(uint8_t* dest, const uint8_t* src, const uint8_t* key, long length){
+    long i = headLength(dest, 16, length);
+    xorBlockScalar(dest, src, key, i);
+
+    for(; i + 64 <= length; i += 64){
+        __m128i a = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + i)), _mm_loadu_si128((const __m128i*)(key + i)));
+        __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + i + 16)), _mm_loadu_si128((const __m128i*)(key + i + 16)));
+        __m128i c = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + i + 32)), _mm_loadu_si128((const __m128i*)(key + i + 32)));
+        __m128i d = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + i + 48)), _mm_loadu_si128((const __m128i*)(key + i + 48)));
+        _mm_store_si128((__m128i*)(dest + i), a);
+        _mm_store_si128((__m128i*)(dest + i + 16), b);
+        _mm_store_si128((__m128i*)(dest + i + 32), c);
+        _mm_store_si128((__m128i*)(dest + i + 48), d);
+    }
+    for(; i + 16 <= length; i += 16){
+        __m128i a = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + i)), _mm_loadu_si128((const __m128i*)(key + i)));
+        _mm_store_si128((__m128i*)(dest + i), a);
+    }
+
+    xorBlockScalar(dest + i, src + i, key + i, length - i);
+}
+
+
+__attribute__((target("avx2")))
+void xorBlockAvx2(uint8_t* dest, const uint8_t* src, const uint8_t* key, long length){
+    long i = headLength(dest, 32, length);
+    xorBlockScalar(dest, src, key, i);
+
+    for(; i + 128 <= length; i += 128){
+        __m256i a = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(src + i)), _mm256_loadu_si256((const __m256i*)(key + i)));
+        __m256i b = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(src + i + 32)), _mm256_loadu_si256((const __m256i*)(key + i + 32)));
+        __m256i c = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(src + i + 64)), _mm256_loadu_si256((const __m256i*)(key + i + 64)));
+        __m256i d = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(src + i + 96)), _mm256_loadu_si256((const __m256i*)(key + i + 96)));
+        _mm256_store_si256((__m256i*)(dest + i), a);
+        _mm256_store_si256((__m256i*)(dest + i + 32), b);
+        _mm256_store_si256((__m256i*)(dest + i + 64), c);
+        _mm256_store_si256((__m256i*)(dest + i + 96), d);
+    }
+    for(; i + 32 <= length; i += 32){
+        __m256i a = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(src + i)), _mm256_loadu_si256((const __m256i*)(key + i)));
+        _mm256_store_si256((__m256i*)(dest + i), a);
+    }
+    _mm256_zeroupper();
+
+    xorBlockScalar(dest + i, src + i, key + i, length - i);
+}
+
+
+__attribute__((target("avx512f")))
+void xorBlockAvx512(uint8_t* dest, const uint8_t* src, const uint8_t* key, long length){
+    long i = headLength(dest, 64, length);
+    xorBlockScalar(dest, src, key, i);
+
+    for(; i + 256 <= length; i += 256){
+        __m512i a = _mm512_xor_si512(_mm512_loadu_si512(src + i), _mm512_loadu_si512(key + i));
+        __m512i b = _mm512_xor_si512(_mm512_loadu_si512(src + i + 64), _mm512_loadu_si512(key + i + 64));
+        __m512i c = _mm512_xor_si512(_mm512_loadu_si512(src + i + 128), _mm512_loadu_si512(key + i + 128));
+        __m512i d = _mm512_xor_si512(_mm512_loadu_si512(src + i + 192), _mm512_loadu_si512(key + i + 192));
+        _mm512_store_si512(dest + i, a);
+        _mm512_store_si512(dest + i + 64, b);
+        _mm512_store_si512(dest + i + 128, c);
+        _mm512_store_si512(dest + i + 192, d);
+    }
+    for(; i + 64 <= length; i += 64){
+        _mm512_store_si512(dest + i, _mm512_xor_si512(_mm512_loadu_si512(src + i), _mm512_loadu_si512(key + i)));
+    }
+    _mm256_zeroupper();
+
+    xorBlockScalar(dest + i, src + i, key + i, length - i);
+}
+
+
+/*
+ * The shifted kernels build 16/32/64 shifted key bytes at once from two loads one byte apart: each lane is shifted
+ * as a 64-bit word, and the masks drop the bits that crossed into the neighbouring byte.
+ */
+__attribute__((target("sse2")))
+void xorShiftedSse2(uint8_t* dest, const uint8_t* src, const uint8_t* key, int bits, long length){
+    long i = headLength(dest, 16, length);
+    xorShiftedScalar(dest, src, key, bits, i);
+
+    __m128i highMask = _mm_set1_epi8((char)(0xFF << bits));
+    __m128i lowMask = _mm_set1_epi8((char)(0xFF >> (8 - bits)));
+    __m128i leftCount = _mm_cvtsi32_si128(bits);
+    __m128i rightCount = _mm_cvtsi32_si128(8 - bits);
+    for(; i + 16 <= length; i += 16){
+        __m128i high = _mm_and_si128(_mm_sll_epi64(_mm_loadu_si128((const __m128i*)(key + i)), leftCount), highMask);
+        __m128i low = _mm_and_si128(_mm_srl_epi64(_mm_loadu_si128((const __m128i*)(key + i + 1)), rightCount), lowMask);
+        __m128i a = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + i)), _mm_or_si128(high, low));
+        _mm_store_si128((__m128i*)(dest + i), a);
+    }
+
+    xorShiftedScalar(dest + i, src + i, key + i, bits, length - i);
+}
+
+
+__attribute__((target("avx2")))
+void xorShiftedAvx2(uint8_t* dest, const uint8_t* src, const uint8_t* key, int bits, long length){
+    long i = headLength(dest, 32, length);
+    xorShiftedScalar(dest, src, key, bits, i);
+
+    __m256i highMask = _mm256_set1_epi8((char)(0xFF << bits));
+    __m256i lowMask = _mm256_set1_epi8((char)(0xFF >> (8 - bits)));
+    __m128i leftCount = _mm_cvtsi32_si128(bits);
+    __m128i rightCount = _mm_cvtsi32_si128(8 - bits);
+    for(; i + 64 <= length; i += 64){
+        __m256i highA = _mm256_and_si256(_mm256_sll_epi64(_mm256_loadu_si256((const __m256i*)(key + i)), leftCount), highMask);
+        __m256i lowA = _mm256_and_si256(_mm256_srl_epi64(_mm256_loadu_si256((const __m256i*)(key + i + 1)), rightCount), lowMask);
+        __m256i highB = _mm256_and_si256(_mm256_sll_epi64(_mm256_loadu_si256((const __m256i*)(key + i + 32)), leftCount), highMask);
+        __m256i lowB = _mm256_and_si256(_mm256_srl_epi64(_mm256_loadu_si256((const __m256i*)(key + i + 33)), rightCount), lowMask);
+        __m256i a = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(src + i)), _mm256_or_si256(highA, lowA));
+        __m256i b = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(src + i + 32)), _mm256_or_si256(highB, lowB));
+        _mm256_store_si256((__m256i*)(dest + i), a);
+        _mm256_store_si256((__m256i*)(dest + i + 32), b);
+    }
+    for(; i + 32 <= length; i += 32){
+        __m256i high = _mm256_and_si256(_mm256_sll_epi64(_mm256_loadu_si256((const __m256i*)(key + i)), leftCount), highMask);
+        __m256i low = _mm256_and_si256(_mm256_srl_epi64(_mm256_loadu_si256((const __m256i*)(key + i + 1)), rightCount), lowMask);
+        __m256i a = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(src + i)), _mm256_or_si256(high, low));
+        _mm256_store_si256((__m256i*)(dest + i), a);
+    }
+    _mm256_zeroupper();
+
+    xorShiftedScalar(dest + i, src + i, key + i, bits, length - i);
+}
+
+
+__attribute__((target("avx512f")))
+void xorShiftedAvx512(uint8_t* dest, const uint8_t* src, const uint8_t* key, int bits, long length){
+    long i = headLength(dest, 64, length);
+    xorShiftedScalar(dest, src, key, bits, i);
+
+    // Byte masks through 32-bit lanes, byte granularity needs AVX512BW
+    __m512i highMask = _mm512_set1_epi32((int)(0x01010101u * (uint8_t)(0xFF << bits)));
+    __m512i lowMask = _mm512_set1_epi32((int)(0x01010101u * (uint8_t)(0xFF >> (8 - bits))));
+    __m128i leftCount = _mm_cvtsi32_si128(bits);
+    __m128i rightCount = _mm_cvtsi32_si128(8 - bits);
+    for(; i + 128 <= length; i += 128){
+        __m512i highA = _mm512_and_si512(_mm512_sll_epi64(_mm512_loadu_si512(key + i), leftCount), highMask);
+        __m512i lowA = _mm512_and_si512(_mm512_srl_epi64(_mm512_loadu_si512(key + i + 1), rightCount), lowMask);
+        __m512i highB = _mm512_and_si512(_mm512_sll_epi64(_mm512_loadu_si512(key + i + 64), leftCount), highMask);
+        __m512i lowB = _mm512_and_si512(_mm512_srl_epi64(_mm512_loadu_si512(key + i + 65), rightCount), lowMask);
+        _mm512_store_si512(dest + i, _mm512_xor_si512(_mm512_loadu_si512(src + i), _mm512_or_si512(highA, lowA)));
+        _mm512_store_si512(dest + i + 64, _mm512_xor_si512(_mm512_loadu_si512(src + i + 64), _mm512_or_si512(highB, lowB)));
+    }
+    for(; i + 64 <= length; i += 64){
+        __m512i high = _mm512_and_si512(_mm512_sll_epi64(_mm512_loadu_si512(key + i), leftCount), highMask);
+        __m512i low = _mm512_and_si512(_mm512_srl_epi64(_mm512_loadu_si512(key + i + 1), rightCount), lowMask);
+        _mm512_store_si512(dest + i, _mm512_xor_si512(_mm512_loadu_si512(src + i), _mm512_or_si512(high, low)));
+    }
+    _mm256_zeroupper();
+
+    xorShiftedScalar(dest + i, src + i, key + i, bits, length - i);
+}
+
+
+static int sse2Supported(void){
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+
+
+static int avx2Supported(void){
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+
+static int avx512Supported(void){
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f");
+}
+
+#endif
+
+
+// All the kernels, ordered from the reference to the widest (the best supported is the last one that passes)
+static const xorKernel kernels[] = {
+    {"scalar", xorBlockScalar, xorShiftedScalar, alwaysSupported},
+#if defined(__x86_64__) || defined(__i386__)
+    {"sse2", xorBlockSse2, xorShiftedSse2, sse2Supported},
+    {"avx2", xorBlockAvx2, xorShiftedAvx2, avx2Supported},
+    {"avx512", xorBlockAvx512, xorShiftedAvx512, avx512Supported},
+#endif
+};
+
+
+int selectXorKernel(const char* name){
+    int count = sizeof(kernels) / sizeof(kernels[0]);
+
+    // No name given - pick the widest kernel this CPU supports
+    if(name == NULL){
+        for(int i = count - 1; i >= 0; i--){
+            if(kernels[i].supported()){
+                setKernel(&kernels[i]);
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    for(int i = 0; i < count; i++){
+        if(strcmp(kernels[i].name, name) == 0){
+            if(!kernels[i].supported()){
+                fprintf(stderr, "Error: The %s kernel isn't supported by this CPU.\n", name);
+                return 0;
+            }
+            setKernel(&kernels[i]);
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "Error: Unknown kernel %s.\n", name);
+    return 0;
+}
+
+
+const char* xorKernelName(){
+    return atomic_load_explicit(&activeName, memory_order_relaxed);
+}
+
+
+const xorKernel* xorKernelList(int* count){
+    *count = sizeof(kernels) / sizeof(kernels[0]);
+    return kernels;
+}
+
+
+static void resolveKernel(){
+    // Unless one was selected before the first use
+    if(loadKernel() == xorBlockResolve){
+        selectXorKernel(NULL);
+    }
+}
+
+
+static void xorBlockResolve(uint8_t* dest, const uint8_t* src, const uint8_t* key, long length){
+    pthread_once(&resolveOnce, resolveKernel);
+    loadKernel()(dest, src, key, length);
+}
+
+
+static void xorShiftedResolve(uint8_t* dest, const uint8_t* src, const uint8_t* key, int bits, long length){
+    pthread_once(&resolveOnce, resolveKernel);
+    loadShifted()(dest, src, key, bits, length);
+}
+
+
+void xorBlock(uint8_t* dest, const uint8_t* src, const uint8_t* key, long length){
+    loadKernel()(dest, src, key, length);
+}
+
+
+void xorBlockRotated(uint8_t* dest, const uint8_t* src, const uint8_t* key, long keySize, long amount, long length){
+    long bytes = amount / 8;
+    int bits = amount % 8;
+
+    // Whole bytes - the rotated key is the key from bytes on, then its start
+    if(bits == 0){
+        long first = keySize - bytes < length ? keySize - bytes : length;
+        loadKernel()(dest, src, key + bytes, first);
+        loadKernel()(dest + first, src + first, key, length - first);
+        return;
+    }
+
+    // Up to the byte before the last key byte, each rotated byte's next byte is in the key too
+    long first = keySize - bytes - 1 < length ? keySize - bytes - 1 : length;
+    loadShifted()(dest, src, key + bytes, bits, first);
+    if(first == length){
+        return;
+    }
+
+    // The last key byte takes its low bits from the first one, then the rest starts over at the key's start
+    dest[first] = src[first] ^ (uint8_t)((key[keySize - 1] << bits) | (key[0] >> (8 - bits)));
+    first++;
+    loadShifted()(dest + first, src + first, key, bits, length - first);
+}
@@ -0,0 +1,439 @@
+#include "../include/xorStream.h"
+
+/*
+ * The streaming context: the key (ownKey is its copy, NULL when it's shared), the rotation state, the next key block
+ * of the stream, and tail, the first tailLength bytes of a key block that isn't complete yet.
+ */
+struct XorStream{
+    const uint8_t* key;
+    uint8_t* ownKey;
+    long keySize;
+    KeyCursor cursor;
+    long nextBlock;
+    uint8_t* tail;
+    long tailLength;
+    KeyCache* cache;
+};
+
+
+/*
+ * Data structure to hold what the threads of xorStreamProcessBuffer() share.
+ */
+typedef struct bufferJob{
+    const XorStream* stream;
+    const uint8_t* in;
+    uint8_t* out;
+    long length;
+    long blocksPerChunk;
+    atomic_long nextChunk;
+} bufferJob;
+
+
+/*
+ * Loads 8 bytes as a big-endian word, so key[i] ends up in the most significant byte.
+ * The key is a big-endian bit string (the MSB of key[0] is its leftmost bit), this keeps word shifts in the same order.
+ */
+static inline uint64_t loadWordBE(const uint8_t* src){
+    uint64_t word;
+    memcpy(&word, src, sizeof(word));
+    return __builtin_bswap64(word);
+}
+
+
+static inline void storeWordBE(uint8_t* dst, uint64_t word){
+    word = __builtin_bswap64(word);
+    memcpy(dst, &word, sizeof(word));
+}
+
+
+/*
+ * Reverses key[from..to] (inclusive) in place.
+ */
+static void reverseBytes(uint8_t* key, long from, long to){
+    while(from < to){
+        uint8_t tmp = key[from];
+        key[from++] = key[to];
+        key[to--] = tmp;
+    }
+}
+
+
+/*
+ * Shifts the whole key left by 1..7 bits in place, rolling the leftmost bits over to the right end.
+ * Each output byte only depends on itself and the byte to its right, so a single forward pass is enough
+ * as long as the first byte is saved for the wrap around.
+ */
+static void shiftKeyBits(uint8_t* key, long size, int bits){
+    uint8_t first = key[0];
+    long i = 0;
+
+    // Work on 64-bit words while there's a full word plus the byte after it
+    for(; i + (long)sizeof(uint64_t) < size; i += sizeof(uint64_t)){
+        uint64_t word = loadWordBE(key + i);
+        storeWordBE(key + i, (word << bits) | (key[i + sizeof(uint64_t)] >> (8 - bits)));
+    }
+
+    // Tail bytes (and the last one takes its low bits from the saved first byte)
+    for(; i < size - 1; i++){
+        key[i] = (uint8_t)((key[i] << bits) | (key[i + 1] >> (8 - bits)));
+    }
+    key[size - 1] = (uint8_t)((key[size - 1] << bits) | (first >> (8 - bits)));
+}
+
+
+void rotateKey(uint8_t* key, long amount, long size){
+    if(size <= 0){
+        return;
+    }
+
+    // A rotation by the key length in bits is the identity
+    amount %= size * 8;
+    long bytes = amount / 8;
+    int bits = amount % 8;
+
+    // Byte level rotation - three reversals, no scratch memory needed
+    if(bytes > 0){
+        reverseBytes(key, 0, bytes - 1);
+        reverseBytes(key, bytes, size - 1);
+        reverseBytes(key, 0, size - 1);
+    }
+
+    // Then the remaining sub-byte shift
+    if(bits > 0){
+        shiftKeyBits(key, size, bits);
+    }
+}
+
+
+void rotateKeyCopy(uint8_t* dest, const uint8_t* key, long amount, long size){
+    if(size <= 0){
+        return;
+    }
+
+    amount %= size * 8;
+    long bytes = amount / 8;
+    int bits = amount % 8;
+
+    // Byte level rotation is just two copies when the source is left untouched
+    memcpy(dest, key + bytes, size - bytes);
+    memcpy(dest + size - bytes, key, bytes);
+
+    if(bits > 0){
+        shiftKeyBits(dest, size, bits);
+    }
+}
+
+
+void leftShiftKey(uint8_t* key, long size){
+    if(size <= 0){
+        return;
+    }
+
+    shiftKeyBits(key, size, 1);
+}
+
+
+void encryptBlock(uint8_t* text, const uint8_t* key, long blockSize){
+    xorBlock(text, text, key, blockSize);
+}
+
+
+int keyCursorInit(KeyCursor* cursor, const uint8_t* key, long keySize){
+    cursor->key = key;
+    cursor->keySize = keySize;
+    cursor->rotatedAmount = -1;
+    cursor->cache = NULL;
+    // Cache line aligned, so the kernels' vector loads of the key never split a line
+    void* rotatedKey = NULL;
+    if(posix_memalign(&rotatedKey, 64, keySize) != 0){
+        rotatedKey = NULL;
+    }
+    cursor->rotatedKey = (uint8_t*)rotatedKey;
+    if(cursor->rotatedKey == NULL){
+        fprintf(stderr, "Error: Failed to allocate the rotated key.\n");
+        return 0;
+    }
+    return 1;
+}
+
+
+void keyCursorSetCache(KeyCursor* cursor, KeyCache* cache){
+    cursor->cache = cache;
+    cursor->rotatedAmount = -1;
+}
+
+
+void keyCursorFree(KeyCursor* cursor){
+    free(cursor->rotatedKey);
+    cursor->rotatedKey = NULL;
+}
+
+
+const uint8_t* keyCursorBlockKey(KeyCursor* cursor, long blockNum, long blockLength){
+    // Get by how much we need to rotate the key
+    long rotateAmount = blockNum % (blockLength * 8);
+    // Every rotation is in the table already
+    const uint8_t* table = cursor->cache != NULL ? keyCacheTable(cursor->cache) : NULL;
+    if(table != NULL){
+        return table + rotateAmount * cursor->keySize;
+    }
+
+    // Next block's key is the previous one rotated by one more bit, otherwise rotate the original (stays untouched)
+    if(cursor->rotatedAmount >= 0 && rotateAmount == (cursor->rotatedAmount + 1) % (cursor->keySize * 8)){
+        leftShiftKey(cursor->rotatedKey, cursor->keySize);
+    }
+    else if(rotateAmount != cursor->rotatedAmount && cursor->cache != NULL){
+        keyCacheGet(cursor->cache, cursor->rotatedKey, rotateAmount);
+    }
+    else if(rotateAmount != cursor->rotatedAmount){
+        rotateKeyCopy(cursor->rotatedKey, cursor->key, rotateAmount, cursor->keySize);
+    }
+    cursor->rotatedAmount = rotateAmount;
+
+    return cursor->rotatedKey;
+}
+
+
+/*
+ * Same as keyCursorEncrypt() with the whole table: consecutive whole blocks use consecutive rotations,
+ * so each run up to the end of the period is a single XOR with the table.
+ */
+static void tableEncrypt(const uint8_t* table, long keySize, uint8_t* dest, const uint8_t* src, long length, long firstBlock){
+    long period = keySize * 8;
+    long blockNum = firstBlock;
+    long offset = 0;
+
+    long wholeBlocks = length / keySize;
+    while(wholeBlocks > 0){
+        long rotation = blockNum % period;
+        long run = period - rotation < wholeBlocks ? period - rotation : wholeBlocks;
+        xorBlock(dest + offset, src + offset, table + rotation * keySize, run * keySize);
+        offset += run * keySize;
+        blockNum += run;
+        wholeBlocks -= run;
+    }
+
+    // A short last block has its own rotation
+    if(offset < length){
+        long blockLength = length - offset;
+        xorBlock(dest + offset, src + offset, table + (blockNum % (blockLength * 8)) * keySize, blockLength);
+    }
+}
+
+
+void keyCursorEncrypt(KeyCursor* cursor, uint8_t* dest, const uint8_t* src, long length, long firstBlock){
+    long keySize = cursor->keySize;
+    long blockNum = firstBlock;
+
+    const uint8_t* table = cursor->cache != NULL ? keyCacheTable(cursor->cache) : NULL;
+    if(table != NULL){
+        tableEncrypt(table, keySize, dest, src, length, firstBlock);
+        return;
+    }
+
+    // One key-sized block at a time, each with its own rotation
+    for(long offset = 0; offset < length; offset += keySize){
+        long blockLength = length - offset < keySize ? length - offset : keySize;
+        if(keySize >= FUSED_MIN_KEY_SIZE){
+            xorBlockRotated(dest + offset, src + offset, cursor->key, keySize, blockNum % (blockLength * 8), blockLength);
+        }
+        else {
+            xorBlock(dest + offset, src + offset, keyCursorBlockKey(cursor, blockNum, blockLength), blockLength);
+        }
+        blockNum++;
+    }
+}
+
+
+int keyCursorRotates(const KeyCursor* cursor){
+    return cursor->keySize < FUSED_MIN_KEY_SIZE && (cursor->cache == NULL || keyCacheTable(cursor->cache) == NULL);
+}
+
+
+/*
+ * Creates a context using key in place (shared) or a copy of it.
+ */
+static XorStream* createStream(const uint8_t* key, long keySize, int shared){
+    if(key == NULL || keySize <= 0){
+        fprintf(stderr, "Error: The key can't be empty.\n");
+        return NULL;
+    }
+
+    XorStream* stream = (XorStream*)malloc(sizeof(XorStream));
+    if(stream == NULL){
+        fprintf(stderr, "Error: Failed to allocate memory for the stream.\n");
+        return NULL;
+    }
+
+    stream->ownKey = shared ? NULL : (uint8_t*)malloc(keySize);
+    stream->key = shared ? key : stream->ownKey;
+    stream->tail = (uint8_t*)malloc(keySize);
+    if(stream->key == NULL || stream->tail == NULL || !keyCursorInit(&stream->cursor, stream->key, keySize)){
+        fprintf(stderr, "Error: Failed to allocate memory for the stream.\n");
+        free(stream->ownKey);
+        free(stream->tail);
+        free(stream);
+        return NULL;
+    }
+    if(!shared){
+        memcpy(stream->ownKey, key, keySize);
+    }
+    stream->keySize = keySize;
+    stream->nextBlock = 0;
+    stream->tailLength = 0;
+    stream->cache = NULL;
+
+    return stream;
+}
+
+
+XorStream* xorStreamCreate(const uint8_t* key, long keySize){
+    return createStream(key, keySize, 0);
+}
+
+
+XorStream* xorStreamCreateShared(const uint8_t* key, long keySize){
+    return createStream(key, keySize, 1);
+}
+
+
+long xorStreamKeySize(const XorStream* stream){
+    return stream->keySize;
+}
+
+
+long xorStreamUpdate(XorStream* stream, const uint8_t* in, uint8_t* out, long length){
+    long keySize = stream->keySize;
+    long produced = 0;
+
+    // Complete the held back block first, it's encrypted as soon as it's whole
+    if(stream->tailLength > 0){
+        long take = keySize - stream->tailLength < length ? keySize - stream->tailLength : length;
+        memcpy(stream->tail + stream->tailLength, in, take);
+        stream->tailLength += take;
+        in += take;
+        length -= take;
+        if(stream->tailLength < keySize){
+            return 0;
+        }
+        keyCursorEncrypt(&stream->cursor, out, stream->tail, keySize, stream->nextBlock++);
+        stream->tailLength = 0;
+        produced = keySize;
+    }
+
+    // Then every whole block straight from in to out
+    long whole = length / keySize * keySize;
+    keyCursorEncrypt(&stream->cursor, out + produced, in, whole, stream->nextBlock);
+    stream->nextBlock += whole / keySize;
+    produced += whole;
+
+    // And hold back what's left of a block
+    memcpy(stream->tail, in + whole, length - whole);
+    stream->tailLength = length - whole;
+
+    return produced;
+}
+
+
+long xorStreamFinal(XorStream* stream, uint8_t* out){
+    long length = stream->tailLength;
+    if(length > 0){
+        keyCursorEncrypt(&stream->cursor, out, stream->tail, length, stream->nextBlock);
+    }
+    xorStreamReset(stream);
+    return length;
+}
+
+
+void xorStreamReset(XorStream* stream){
+    stream->nextBlock = 0;
+    stream->tailLength = 0;
+}
+
+
+static void* bufferThreadFunction(void* arg){
+    bufferJob* job = (bufferJob*)arg;
+    long keySize = job->stream->keySize;
+    long chunkSize = job->blocksPerChunk * keySize;
+
+    KeyCursor cursor;
+    if(!keyCursorInit(&cursor, job->stream->key, keySize)){
+        return (void*)1;
+    }
+    keyCursorSetCache(&cursor, job->stream->cache);
+
+    // Claim the next chunk until there's none left - its offset and rotation only depend on its number
+    while(1){
+        long chunk = atomic_fetch_add(&job->nextChunk, 1);
+        long offset = chunk * chunkSize;
+        if(offset >= job->length){
+            break;
+        }
+        long length = job->length - offset < chunkSize ? job->length - offset : chunkSize;
+
+        keyCursorEncrypt(&cursor, job->out + offset, job->in + offset, length, chunk * job->blocksPerChunk);
+    }
+
+    keyCursorFree(&cursor);
+    return NULL;
+}
+
+
+int xorStreamProcessBuffer(const XorStream* stream, const uint8_t* in, uint8_t* out, long length, int threads, long chunkSize){
+    if(stream == NULL || length < 0 || threads < 0 || chunkSize < 0){
+        fprintf(stderr, "Error: Invalid buffer to process.\n");
+        return 0;
+    }
+    if(chunkSize == 0){
+        chunkSize = XOR_STREAM_CHUNK_SIZE;
+    }
+
+    bufferJob job;
+    job.stream = stream;
+    job.in = in;
+    job.out = out;
+    job.length = length;
+    job.blocksPerChunk = (chunkSize + stream->keySize - 1) / stream->keySize;
+    atomic_init(&job.nextChunk, 0);
+
+    // No more threads than chunks
+    long chunks = (length + job.blocksPerChunk * stream->keySize - 1) / (job.blocksPerChunk * stream->keySize);
+    if(threads > chunks - 1){
+        threads = chunks > 0 ? chunks - 1 : 0;
+    }
+
+    pthread_t workers[threads + 1];
+    int created = 0;
+    for(; created < threads; created++){
+        if(pthread_create(&workers[created], NULL, &bufferThreadFunction, &job) != 0){
+            // Fewer threads only means less parallelism, the others (and this one) claim the rest
+            break;
+        }
+    }
+    int failed = bufferThreadFunction(&job) != NULL;
+
+    for(int i = 0; i < created; i++){
+        void* result;
+        if(pthread_join(workers[i], &result) != 0 || result != NULL){
+            failed = 1;
+        }
+    }
+    return !failed;
+}
+
+
+void xorStreamSetKeyCache(XorStream* stream, KeyCache* cache){
+    stream->cache = cache;
+    keyCursorSetCache(&stream->cursor, cache);
+}
+
+
+void xorStreamDestroy(XorStream* stream){
+    if(stream == NULL){
+        return;
+    }
+    keyCursorFree(&stream->cursor);
+    free(stream->ownKey);
+    free(stream->tail);
+    free(stream);
+}